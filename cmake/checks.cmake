@@ -7,6 +7,9 @@ set(CMAKE_REQUIRED_DEFINITIONS "-D_GNU_SOURCE")
 
 if(ARCH_X86 OR ARCH_X86_64)
   check_c_compiler_flag("-mpclmul" HAVE_PCLMUL)
+  check_c_compiler_flag("-maes" HAVE_AES)
+  check_c_compiler_flag("-msha" HAVE_SHA)
+  check_c_compiler_flag("-mavx2" HAVE_AVX2)
 endif(ARCH_X86 OR ARCH_X86_64)
 
 
@@ -40,6 +43,9 @@ check_prototype_definition("get_current_dir_name" "char *get_current_dir_name(vo
 check_symbol_exists("setresuid" "unistd.h" HAVE_SETRESUID)
 check_symbol_exists("setresgid" "unistd.h" HAVE_SETRESGID)
 
+check_symbol_exists("recvmmsg" "sys/socket.h" HAVE_RECVMMSG)
+check_symbol_exists("sendmmsg" "sys/socket.h" HAVE_SENDMMSG)
+
 if(NOT DARWIN)
   set(RT_LIBRARY "")
   check_symbol_exists("clock_gettime" "time.h" HAVE_CLOCK_GETTIME)
@@ -60,6 +60,9 @@ set(WITH_CMDLINE_COMMANDS TRUE CACHE BOOL "Include support for setting handler s
 
 set(WITH_DYNAMIC_PEERS TRUE CACHE BOOL "Include support for dynamic peers (using on-verify handlers)")
 set(WITH_STATUS_SOCKET TRUE CACHE BOOL "Include support for the status socket")
+set(WITH_TASK_WHEEL TRUE CACHE BOOL "Use a hierarchical timer wheel instead of a pairing heap for scheduled tasks")
+
+set(ENABLE_BENCHMARKS FALSE CACHE BOOL "Build benchmark programs (not installed)")
 
 set(MAX_CONFIG_DEPTH 10 CACHE STRING "Maximum config include depth")
 
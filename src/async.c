@@ -32,6 +32,7 @@
 
 #include "async.h"
 #include "fastd.h"
+#include "worker.h"
 
 #include <sys/uio.h>
 
@@ -125,6 +126,10 @@ void fastd_async_handle(void) {
 		handle_resolve_return((const fastd_async_resolve_return_t *)buf);
 		break;
 
+	case ASYNC_TYPE_WORKER_RETURN:
+		fastd_worker_handle_return(*(fastd_worker_job_t *const *)buf);
+		break;
+
 #ifdef WITH_DYNAMIC_PEERS
 	case ASYNC_TYPE_VERIFY_RETURN:
 		handle_verify_return((const fastd_async_verify_return_t *)buf);
@@ -136,6 +141,44 @@ void fastd_async_handle(void) {
 	}
 }
 
+/**
+   Reads and discards all pending notifications from the async notification socket
+
+   Jobs returned by the worker threads are freed without handling their results.
+*/
+void fastd_async_discard(void) {
+	while (true) {
+		fastd_async_hdr_t header;
+		struct iovec vec[2] = {
+			{ .iov_base = &header, .iov_len = sizeof(header) },
+		};
+		struct msghdr msg = {
+			.msg_iov = vec,
+			.msg_iovlen = 1,
+		};
+
+		if (recvmsg(ctx.async_rfd.fd, &msg, MSG_PEEK) < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				pr_warn_errno("fastd_async_discard: recvmsg");
+
+			return;
+		}
+
+		uint8_t buf[header.len] __attribute__((aligned(8)));
+		vec[1].iov_base = buf;
+		vec[1].iov_len = sizeof(buf);
+		msg.msg_iovlen = 2;
+
+		if (recvmsg(ctx.async_rfd.fd, &msg, 0) < 0) {
+			pr_warn_errno("fastd_async_discard: recvmsg");
+			return;
+		}
+
+		if (header.type == ASYNC_TYPE_WORKER_RETURN)
+			fastd_worker_discard_return(*(fastd_worker_job_t *const *)buf);
+	}
+}
+
 /** Enqueues a new async notification */
 void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len) {
 	fastd_async_hdr_t header;
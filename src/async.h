@@ -41,6 +41,7 @@ typedef enum fastd_async_type {
 	ASYNC_TYPE_NOP,				/**< Does nothing (is used to ensure poll returns quickly after a signal has occurred) */
 	ASYNC_TYPE_RESOLVE_RETURN,		/**< A DNS resolver response */
 	ASYNC_TYPE_VERIFY_RETURN,		/**< A on-verify return */
+	ASYNC_TYPE_WORKER_RETURN,		/**< A job computed by a worker thread */
 } fastd_async_type_t;
 
 
@@ -71,4 +72,5 @@ typedef struct fastd_async_verify_return {
 
 void fastd_async_init(void);
 void fastd_async_handle(void);
+void fastd_async_discard(void);
 void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len);
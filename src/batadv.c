@@ -0,0 +1,93 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Duplicate suppression for BATMAN-adv broadcast packets
+
+   The broadcast cache is a direct-mapped hashtable: a new broadcast replaces the
+   entry occupying its slot, so an evicted broadcast may occasionally be sent to
+   all peers twice, but a broadcast is never mistaken for a duplicate.
+*/
+
+
+#include "batadv.h"
+#include "hash.h"
+
+
+/** The EtherType of BATMAN-adv packets */
+#define BATADV_ETHERTYPE 0x4305
+
+/** The packet type of BATMAN-adv broadcast packets */
+#define BATADV_BCAST 0x01
+
+/** The length of the ethernet and BATMAN-adv broadcast headers */
+#define BATADV_BCAST_LEN (sizeof(fastd_eth_header_t) + 14)
+
+
+/** Checks if a packet is a BATMAN-adv broadcast that has already been sent to all peers (and records it otherwise) */
+bool fastd_batadv_bcast_seen(const fastd_buffer_t buffer) {
+	if (buffer.len < BATADV_BCAST_LEN)
+		return false;
+
+	const uint8_t *data = buffer.data;
+	if (((data[12] << 8) | data[13]) != BATADV_ETHERTYPE || data[14] != BATADV_BCAST)
+		return false;
+
+	const uint8_t *bcast = data + sizeof(fastd_eth_header_t);
+
+	fastd_batadv_bcast_t key = {
+		.seqno = (bcast[4] << 24) | (bcast[5] << 16) | (bcast[6] << 8) | bcast[7],
+	};
+	memcpy(key.orig.data, bcast + 8, sizeof(key.orig.data));
+
+	if (!ctx.batadv_bcasts) {
+		fastd_random_bytes(&ctx.batadv_bcast_seed, sizeof(ctx.batadv_bcast_seed), false);
+		ctx.batadv_bcasts = fastd_new0_array(BATADV_BCAST_CACHE_SIZE, fastd_batadv_bcast_t);
+	}
+
+	uint32_t hash = ctx.batadv_bcast_seed;
+	fastd_hash(&hash, key.orig.data, sizeof(key.orig.data));
+	fastd_hash(&hash, &key.seqno, sizeof(key.seqno));
+	fastd_hash_final(&hash);
+
+	fastd_batadv_bcast_t *entry = &ctx.batadv_bcasts[hash % BATADV_BCAST_CACHE_SIZE];
+
+	if (!fastd_timed_out(entry->timeout) && entry->seqno == key.seqno
+	    && memcmp(entry->orig.data, key.orig.data, sizeof(key.orig.data)) == 0)
+		return true;
+
+	*entry = key;
+	entry->timeout = ctx.now + BATADV_BCAST_TIMEOUT;
+
+	return false;
+}
+
+/** Frees the BATMAN-adv broadcast cache */
+void fastd_batadv_free(void) {
+	free(ctx.batadv_bcasts);
+	ctx.batadv_bcasts = NULL;
+}
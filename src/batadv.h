@@ -0,0 +1,61 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Duplicate suppression for BATMAN-adv broadcast packets
+
+   When packet forwarding is enabled in TAP mode, BATMAN-adv broadcast packets
+   would be sent to all peers again every time a copy of them is received from a
+   peer or rebroadcast by the local node. The originator and sequence number of
+   the broadcasts sent to all peers are kept in a small cache for a few seconds,
+   and repeated broadcasts are dropped before they are sent to all peers.
+*/
+
+#pragma once
+
+#include "fastd.h"
+
+
+/** An entry of the BATMAN-adv broadcast cache */
+struct fastd_batadv_bcast {
+	fastd_timeout_t timeout;		/**< Timeout until the entry is forgotten */
+	uint32_t seqno;				/**< The sequence number of the broadcast */
+	fastd_eth_addr_t orig;			/**< The originator of the broadcast */
+};
+
+
+bool fastd_batadv_bcast_seen(const fastd_buffer_t buffer);
+void fastd_batadv_free(void);
+
+
+/** Checks if a packet is a BATMAN-adv broadcast that has already been sent to all peers (and records it otherwise) */
+static inline bool fastd_batadv_bcast_duplicate(const fastd_buffer_t buffer) {
+	if (conf.mode != MODE_TAP || !conf.forward)
+		return false;
+
+	return fastd_batadv_bcast_seen(buffer);
+}
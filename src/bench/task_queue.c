@@ -0,0 +1,230 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Benchmark comparing the pairing heap and the timer wheel task queue implementations
+
+   The benchmark simulates the task queue load of a fastd instance with many
+   peers: time advances in steps of one millisecond, in each step some peer tasks
+   are rescheduled (as it happens on received packets and handshakes) and all
+   expired tasks are handled and rescheduled (as keepalives and handshake timeouts
+   are).
+*/
+
+
+#include "../log.h"
+#include "../pqueue.h"
+#include "../timer_wheel.h"
+#include "../util.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+
+/** The number of simulated milliseconds */
+#define SIMULATED_TIME 60000
+
+/** The maximum delay of a rescheduled task in milliseconds */
+#define MAX_DELAY 25000
+
+
+/** A simulated task, which can be put into both queue implementations */
+typedef struct bench_task {
+	fastd_pqueue_t pqueue_entry;		/**< The pairing heap entry */
+	fastd_timer_wheel_entry_t wheel_entry;	/**< The timer wheel entry */
+} bench_task_t;
+
+/** The operations of a task queue implementation */
+typedef struct bench_queue {
+	const char *name;					/**< The name of the implementation */
+	void (*schedule)(bench_task_t *task, int64_t timeout);	/**< Inserts a task that is not scheduled */
+	void (*reschedule)(bench_task_t *task, int64_t timeout);	/**< Removes a task and inserts it with a new timeout */
+	bench_task_t * (*pop)(int64_t now);			/**< Removes and returns a task whose timeout has been reached */
+} bench_queue_t;
+
+
+/** The pairing heap */
+static fastd_pqueue_t *pqueue;
+
+/** The timer wheel */
+static fastd_timer_wheel_t wheel;
+
+/** State of the pseudo random number generator */
+static uint64_t rand_state;
+
+
+/** Required by exit_bug() */
+void fastd_logf(UNUSED fastd_loglevel_t level, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+
+	fputs("\n", stderr);
+	abort();
+}
+
+/** Returns a pseudo random number (xorshift64) */
+static inline uint64_t bench_rand(void) {
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state;
+}
+
+/** Returns a random task delay */
+static inline int64_t random_delay(void) {
+	return 1 + bench_rand() % MAX_DELAY;
+}
+
+/** Returns the current CPU time in nanoseconds */
+static int64_t cpu_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/** Inserts a task into the pairing heap */
+static void pqueue_schedule(bench_task_t *task, int64_t timeout) {
+	task->pqueue_entry.value = timeout;
+	fastd_pqueue_insert(&pqueue, &task->pqueue_entry);
+}
+
+/** Reschedules a task in the pairing heap */
+static void pqueue_reschedule(bench_task_t *task, int64_t timeout) {
+	fastd_pqueue_remove(&task->pqueue_entry);
+	pqueue_schedule(task, timeout);
+}
+
+/** Removes an expired task from the pairing heap */
+static bench_task_t * pqueue_pop(int64_t now) {
+	if (!pqueue || pqueue->value > now)
+		return NULL;
+
+	bench_task_t *task = container_of(pqueue, bench_task_t, pqueue_entry);
+	fastd_pqueue_remove(pqueue);
+	return task;
+}
+
+/** Inserts a task into the timer wheel */
+static void wheel_schedule(bench_task_t *task, int64_t timeout) {
+	task->wheel_entry.value = timeout;
+	fastd_timer_wheel_insert(&wheel, &task->wheel_entry);
+}
+
+/** Reschedules a task in the timer wheel */
+static void wheel_reschedule(bench_task_t *task, int64_t timeout) {
+	fastd_timer_wheel_remove(&wheel, &task->wheel_entry);
+	wheel_schedule(task, timeout);
+}
+
+/** Removes an expired task from the timer wheel */
+static bench_task_t * wheel_pop(int64_t now) {
+	fastd_timer_wheel_advance(&wheel, now);
+
+	fastd_timer_wheel_entry_t *entry = fastd_timer_wheel_pop(&wheel);
+	if (!entry)
+		return NULL;
+
+	return container_of(entry, bench_task_t, wheel_entry);
+}
+
+
+/** The benchmarked queue implementations */
+static const bench_queue_t queues[] = {
+	{ "pairing heap", pqueue_schedule, pqueue_reschedule, pqueue_pop },
+	{ "timer wheel", wheel_schedule, wheel_reschedule, wheel_pop },
+};
+
+
+/** Runs the simulation for one queue implementation and prints the results */
+static void run(const bench_queue_t *queue, size_t n_tasks) {
+	bench_task_t *tasks = calloc(n_tasks, sizeof(bench_task_t));
+	if (!tasks)
+		abort();
+
+	pqueue = NULL;
+	memset(&wheel, 0, sizeof(wheel));
+	rand_state = 0x9e3779b97f4a7c15;
+
+	size_t reschedules_per_step = n_tasks / 1000 + 1;
+	uint64_t ops = 0, expired = 0;
+
+	int64_t start = cpu_time();
+
+	size_t i;
+	for (i = 0; i < n_tasks; i++)
+		queue->schedule(&tasks[i], random_delay());
+
+	int64_t now;
+	for (now = 1; now <= SIMULATED_TIME; now++) {
+		for (i = 0; i < reschedules_per_step; i++)
+			queue->reschedule(&tasks[bench_rand() % n_tasks], now + random_delay());
+
+		ops += reschedules_per_step;
+
+		bench_task_t *task;
+		while ((task = queue->pop(now))) {
+			queue->schedule(task, now + random_delay());
+			expired++;
+		}
+	}
+
+	int64_t elapsed = cpu_time() - start;
+	ops += n_tasks + expired;
+
+	printf("%8zu tasks  %-12s  %8.1f ms  %6.1f ns/op  (%llu reschedules, %llu expirations)\n",
+	       n_tasks, queue->name, elapsed / 1e6, (double)elapsed / ops,
+	       (unsigned long long)(ops - n_tasks - expired), (unsigned long long)expired);
+
+	free(tasks);
+}
+
+
+int main(int argc, char *argv[]) {
+	static const size_t default_sizes[] = { 1000, 10000, 100000 };
+
+	int i;
+	size_t j;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			for (j = 0; j < array_size(queues); j++)
+				run(&queues[j], strtoul(argv[i], NULL, 10));
+		}
+	}
+	else {
+		for (i = 0; i < (int)array_size(default_sizes); i++) {
+			for (j = 0; j < array_size(queues); j++)
+				run(&queues[j], default_sizes[i]);
+		}
+	}
+
+	return 0;
+}
@@ -41,6 +41,7 @@
 #include "method.h"
 #include "peer.h"
 #include "peer_group.h"
+#include "route.h"
 #include <generated/config.yy.h>
 
 #include <dirent.h>
@@ -77,6 +78,8 @@ static void default_config(void) {
 	conf.peer_group = fastd_new0(fastd_peer_group_t);
 	conf.peer_group->name = fastd_strdup("default");
 	conf.peer_group->max_connections = -1;
+	conf.peer_group->keepalive_interval = KEEPALIVE_TIMEOUT;
+	conf.peer_group->keepalive_adaptive = FASTD_TRISTATE_FALSE;
 }
 
 /** Handles the configuration of a handshake protocol */
@@ -168,6 +171,68 @@ void fastd_config_bind_address(const fastd_peer_address_t *address, const char *
 		conf.bind_addr_default_v6 = addr;
 }
 
+/** Handles the configuration of a prefix routed to a peer */
+void fastd_config_peer_route(fastd_peer_t *peer, sa_family_t af, const void *addr, unsigned len) {
+	fastd_route_prefix_t prefix = {
+		.af = af,
+		.len = len,
+	};
+
+	memcpy(prefix.addr, addr, (len+7)/8);
+
+	if (len % 8)
+		prefix.addr[len/8] &= 0xff << (8 - len%8);
+
+	VECTOR_ADD(peer->routes, prefix);
+}
+
+/** Handles the configuration of a filter rule, returns the new rule so the matched fields can be set */
+fastd_filter_rule_t * fastd_config_filter(fastd_filter_action_t action, unsigned limit) {
+	fastd_filter_rule_t **rulep = &conf.filter_rules;
+	while (*rulep)
+		rulep = &(*rulep)->next;
+
+	fastd_filter_rule_t *rule = fastd_new0(fastd_filter_rule_t);
+	rule->action = action;
+	rule->limit = limit;
+
+	*rulep = rule;
+	return rule;
+}
+
+/** Handles the configuration of the destination MAC address of a filter rule (with an optional prefix length) */
+bool fastd_config_filter_dest(fastd_filter_rule_t *rule, const char *addr) {
+	fastd_eth_addr_t dest;
+	unsigned len = 8 * sizeof(dest.data);
+	int n;
+
+	if (sscanf(addr, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n", &dest.data[0], &dest.data[1], &dest.data[2], &dest.data[3], &dest.data[4], &dest.data[5], &n) != 6)
+		return false;
+
+	if (addr[n] == '/') {
+		char *endptr;
+		unsigned long l = strtoul(addr+n+1, &endptr, 10);
+
+		if (endptr == addr+n+1 || *endptr || l > len)
+			return false;
+
+		len = l;
+	}
+	else if (addr[n]) {
+		return false;
+	}
+
+	size_t i;
+	for (i = 0; i < sizeof(dest.data); i++) {
+		unsigned bits = len > 8*i ? len - 8*i : 0;
+		rule->dest_mask.data[i] = bits >= 8 ? 0xff : (uint8_t)(0xff00 >> bits);
+		rule->dest.data[i] = dest.data[i] & rule->dest_mask.data[i];
+	}
+
+	rule->match |= FILTER_MATCH_DEST;
+	return true;
+}
+
 /** Handles the start of a peer group configuration */
 void fastd_config_peer_group_push(fastd_parser_state_t *state, const char *name) {
 	fastd_peer_group_t *group = fastd_new0(fastd_peer_group_t);
@@ -255,7 +320,7 @@ static void read_peer_dir(fastd_peer_group_t *group, const char *dir) {
 				continue;
 			}
 
-			fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+			fastd_peer_t *peer = fastd_peer_new();
 			peer->name = fastd_strdup(result->d_name);
 			peer->config_source_dir = dir;
 
@@ -563,6 +628,15 @@ void fastd_configure(int argc, char *const argv[]) {
 
 /** Performs some basic checks on the configuration */
 static void config_check_base(void) {
+	if (conf.filter_rules && conf.mode != MODE_TAP)
+		exit_error("config error: filter rules are only supported in TAP mode");
+
+	if (conf.neighbor_proxy && conf.mode != MODE_TAP)
+		exit_error("config error: the neighbor proxy is only supported in TAP mode");
+
+	if (fastd_relay_mode() && !conf.forward)
+		exit_error("config error: relay mode requires forwarding to be enabled");
+
 	if (fastd_use_android_integration()) {
 		if (conf.mode != MODE_TUN)
 			exit_error("In Android integration mode only TUN interfaces are supported");
@@ -576,7 +650,7 @@ static void config_check_base(void) {
 void fastd_config_check(void) {
 	config_check_base();
 
-	if (!VECTOR_LEN(ctx.peers) && !has_peer_group_peer_dirs(conf.peer_group) && !fastd_allow_verify())
+	if (!ctx.n_peers && !has_peer_group_peer_dirs(conf.peer_group) && !fastd_allow_verify())
 		exit_error("config error: neither fixed peers nor peer dirs have been configured");
 
 	if (!conf.peer_group->methods) {
@@ -586,11 +660,16 @@ void fastd_config_check(void) {
 
 	configure_user();
 	configure_methods();
+
+	if (conf.calibrate_crypto) {
+		fastd_cipher_calibrate();
+		fastd_mac_calibrate();
+	}
 }
 
 /** Determines if the configuration will never create more than a single interface */
 bool fastd_config_single_iface(void) {
-	if (conf.mode == MODE_TAP)
+	if (conf.mode == MODE_TAP || conf.tun_shared)
 		return true;
 
 	if (has_peer_group_peer_dirs(conf.peer_group))
@@ -599,7 +678,7 @@ bool fastd_config_single_iface(void) {
 	if (fastd_allow_verify())
 		return false;
 
-	return (VECTOR_LEN(ctx.peers) == 1);
+	return (ctx.n_peers == 1);
 }
 
 /** Determines of all interfaces are persistent (i.e. don't need to be created and destroyed dynamically) */
@@ -607,7 +686,7 @@ bool fastd_config_persistent_ifaces(void) {
 	if (fastd_use_android_integration())
 		return true;
 
-	if (conf.mode == MODE_TAP)
+	if (conf.mode == MODE_TAP || conf.tun_shared)
 		return true;
 
 	if (!conf.iface_persist)
@@ -643,9 +722,9 @@ static void configure_peers(bool dirs_only) {
 	ctx.has_floating = false;
 	ctx.max_mtu = conf.mtu;
 
-	ssize_t i;
-	for (i = VECTOR_LEN(ctx.peers)-1; i >= 0; i--) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+	fastd_peer_t *peer, *prev;
+	for (peer = ctx.peers_tail; peer; peer = prev) {
+		prev = peer->prev;
 
 		if (peer->config_state == CONFIG_STATIC) {
 			/* The peer hasn't been touched since the last run of configure_peers(), so its definition must have disappeared */
@@ -686,10 +765,8 @@ void fastd_configure_peers(void) {
 
 /** Refreshes the peer configurations from the configured peer dirs */
 void fastd_config_load_peer_dirs(bool dirs_only) {
-	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
-
+	fastd_peer_t *peer;
+	for (peer = ctx.peers; peer; peer = peer->next) {
 		if (fastd_peer_is_dynamic(peer))
 			continue;
 
@@ -713,6 +790,12 @@ void fastd_config_release(void) {
 		conf.bind_addrs = next;
 	}
 
+	while (conf.filter_rules) {
+		fastd_filter_rule_t *next = conf.filter_rules->next;
+		free(conf.filter_rules);
+		conf.filter_rules = next;
+	}
+
 	free_peer_group(conf.peer_group);
 
 	destroy_methods();
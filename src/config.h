@@ -33,12 +33,14 @@
 #pragma once
 
 #include "fastd.h"
+#include "filter.h"
 
 
 /** State of the config parser */
 struct fastd_parser_state {
 	fastd_peer_group_t *peer_group;	/**< The current peer group */
 	fastd_peer_t *peer;	/**< The peer currently being loaded */
+	fastd_filter_rule_t *filter_rule;	/**< The filter rule currently being parsed */
 
 	const char *const filename;	/**< The filename of the currently parsed file */
 	const int depth;		/**< The include depth */
@@ -51,6 +53,9 @@ bool fastd_config_ifname(fastd_peer_t *peer, const char *ifname);
 void fastd_config_cipher(const char *name, const char *impl);
 void fastd_config_mac(const char *name, const char *impl);
 void fastd_config_bind_address(const fastd_peer_address_t *address, const char *bindtodev, bool default_v4, bool default_v6);
+void fastd_config_peer_route(fastd_peer_t *peer, sa_family_t af, const void *addr, unsigned len);
+fastd_filter_rule_t * fastd_config_filter(fastd_filter_action_t action, unsigned limit);
+bool fastd_config_filter_dest(fastd_filter_rule_t *rule, const char *addr);
 void fastd_config_release(void);
 void fastd_config_handle_options(int argc, char *const argv[]);
 void fastd_config_verify(void);
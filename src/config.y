@@ -64,15 +64,19 @@
 %token <addr6> TOK_ADDR6
 %token <addr6_scoped> TOK_ADDR6_SCOPED
 
+%token TOK_ADAPTIVE
 %token TOK_ADDRESSES
 %token TOK_ANY
 %token TOK_AS
 %token TOK_ASYNC
 %token TOK_AUTO
 %token TOK_BIND
+%token TOK_BROADCAST
+%token TOK_CALIBRATE
 %token TOK_CAPABILITIES
 %token TOK_CIPHER
 %token TOK_CONNECT
+%token TOK_CRYPTO
 %token TOK_DEBUG
 %token TOK_DEBUG2
 %token TOK_DEFAULT
@@ -82,21 +86,27 @@
 %token TOK_EARLY
 %token TOK_ERROR
 %token TOK_ESTABLISH
+%token TOK_ETHERTYPE
 %token TOK_FATAL
+%token TOK_FILTER
 %token TOK_FLOAT
 %token TOK_FORCE
 %token TOK_FORWARD
 %token TOK_FROM
 %token TOK_GROUP
+%token TOK_HANDSHAKE
 %token TOK_HANDSHAKES
 %token TOK_HIDE
 %token TOK_INCLUDE
 %token TOK_INFO
 %token TOK_INTERFACE
+%token TOK_INTERVAL
 %token TOK_IP
 %token TOK_IPV4
 %token TOK_IPV6
+%token TOK_KEEPALIVE
 %token TOK_KEY
+%token TOK_LEARN
 %token TOK_LEVEL
 %token TOK_LIMIT
 %token TOK_LOG
@@ -105,10 +115,13 @@
 %token TOK_METHOD
 %token TOK_MODE
 %token TOK_MTU
+%token TOK_MULTICAST
 %token TOK_MULTITAP
+%token TOK_NEIGHBOR
 %token TOK_NO
 %token TOK_ON
 %token TOK_PACKET
+%token TOK_PASS
 %token TOK_PEER
 %token TOK_PEERS
 %token TOK_PERSIST
@@ -117,17 +130,25 @@
 %token TOK_POST_DOWN
 %token TOK_PRE_UP
 %token TOK_PROTOCOL
+%token TOK_PROXY
+%token TOK_RELAY
 %token TOK_REMOTE
+%token TOK_ROUTE
 %token TOK_SECRET
 %token TOK_SECURE
+%token TOK_SHARED
+%token TOK_SLACK
 %token TOK_SOCKET
 %token TOK_STATUS
 %token TOK_STDERR
 %token TOK_SYNC
 %token TOK_SYSLOG
 %token TOK_TAP
+%token TOK_TCP
+%token TOK_TIMER
 %token TOK_TO
 %token TOK_TUN
+%token TOK_UDP
 %token TOK_UP
 %token TOK_USE
 %token TOK_USER
@@ -183,6 +204,10 @@ statement:	peer_group_statement
 	|	TOK_GROUP group ';'
 	|	TOK_DROP TOK_CAPABILITIES drop_capabilities ';'
 	|	TOK_SECURE TOK_HANDSHAKES secure_handshakes ';'
+	|	TOK_HANDSHAKE TOK_LIMIT handshake_limit ';'
+	|	TOK_TIMER TOK_SLACK timer_slack ';'
+	|	TOK_ROUTE TOK_LEARN route_learn ';'
+	|	TOK_CALIBRATE TOK_CRYPTO calibrate_crypto ';'
 	|	TOK_CIPHER cipher ';'
 	|	TOK_MAC mac ';'
 	|	TOK_LOG log ';'
@@ -200,12 +225,16 @@ statement:	peer_group_statement
 	|	TOK_ON TOK_POST_DOWN on_post_down ';'
 	|	TOK_STATUS TOK_SOCKET status_socket ';'
 	|	TOK_FORWARD forward ';'
+	|	TOK_FILTER filter ';'
+	|	TOK_NEIGHBOR TOK_PROXY neighbor_proxy ';'
 	;
 
 peer_group_statement:
 		TOK_PEER peer '{' peer_conf '}' peer_after
 	|	TOK_PEER TOK_GROUP peer_group '{' peer_group_config '}' peer_group_after
 	|	TOK_PEER TOK_LIMIT peer_limit ';'
+	|	TOK_KEEPALIVE TOK_INTERVAL keepalive_interval ';'
+	|	TOK_KEEPALIVE TOK_ADAPTIVE keepalive_adaptive ';'
 	|	TOK_METHOD method ';'
 	|	TOK_ON TOK_UP on_up ';'
 	|	TOK_ON TOK_DOWN on_down ';'
@@ -258,6 +287,38 @@ secure_handshakes:
 		}
 	;
 
+handshake_limit:
+		TOK_UINT {
+			if ($1 > UINT_MAX) {
+				fastd_config_error(&@$, state, "invalid handshake limit");
+				YYERROR;
+			}
+
+			conf.handshake_limit = $1;
+		}
+	;
+
+timer_slack:	TOK_UINT {
+			if ($1 > 60000) {
+				fastd_config_error(&@$, state, "invalid timer slack");
+				YYERROR;
+			}
+
+			conf.timer_slack = $1;
+		}
+	;
+
+route_learn:	boolean {
+			conf.route_learn = $1;
+		}
+	;
+
+calibrate_crypto:
+		boolean {
+			conf.calibrate_crypto = $1;
+		}
+	;
+
 cipher:		TOK_STRING TOK_USE TOK_STRING {
 			fastd_config_cipher($1->str, $3->str);
 		}
@@ -394,9 +455,11 @@ mtu:		TOK_UINT {
 pmtu:		autobool
 	;
 
-mode:		TOK_TAP		{ conf.mode = MODE_TAP; }
+mode:		TOK_TAP		{ conf.mode = MODE_TAP; conf.tap_relay = false; }
+	|	TOK_TAP TOK_RELAY { conf.mode = MODE_TAP; conf.tap_relay = true; }
 	|	TOK_MULTITAP	{ conf.mode = MODE_MULTITAP; }
-	|	TOK_TUN		{ conf.mode = MODE_TUN; }
+	|	TOK_TUN		{ conf.mode = MODE_TUN; conf.tun_shared = false; }
+	|	TOK_TUN TOK_SHARED { conf.mode = MODE_TUN; conf.tun_shared = true; }
 	;
 
 protocol:	TOK_STRING {
@@ -428,7 +491,7 @@ status_socket:	TOK_STRING {
 	;
 
 peer:		TOK_STRING {
-			state->peer = fastd_new0(fastd_peer_t);
+			state->peer = fastd_peer_new();
 			state->peer->name = fastd_strdup($1->str);
 			state->peer->group = state->peer_group;
 		}
@@ -450,6 +513,7 @@ peer_statement: TOK_REMOTE peer_remote ';'
 	|	TOK_KEY peer_key ';'
 	|	TOK_INTERFACE peer_interface ';'
 	|	TOK_MTU peer_mtu ';'
+	|	TOK_ROUTE peer_route ';'
 	|	TOK_INCLUDE peer_include ';'
 	;
 
@@ -531,6 +595,31 @@ peer_mtu:	TOK_UINT {
 			state->peer->mtu = $1;
 		}
 	;
+
+peer_route:	TOK_ADDR4 {
+			fastd_config_peer_route(state->peer, AF_INET, &$1, 32);
+		}
+	|	TOK_ADDR4 '/' TOK_UINT {
+			if ($3 > 32) {
+				fastd_config_error(&@$, state, "invalid prefix length");
+				YYERROR;
+			}
+
+			fastd_config_peer_route(state->peer, AF_INET, &$1, $3);
+		}
+	|	TOK_ADDR6 {
+			fastd_config_peer_route(state->peer, AF_INET6, &$1, 128);
+		}
+	|	TOK_ADDR6 '/' TOK_UINT {
+			if ($3 > 128) {
+				fastd_config_error(&@$, state, "invalid prefix length");
+				YYERROR;
+			}
+
+			fastd_config_peer_route(state->peer, AF_INET6, &$1, $3);
+		}
+	;
+
 peer_include:	TOK_STRING {
 			if (!fastd_config_read($1->str, state->peer_group, state->peer, state->depth))
 				YYERROR;
@@ -559,6 +648,23 @@ peer_limit:	TOK_UINT {
 		}
 	;
 
+keepalive_interval:
+		TOK_UINT {
+			if (!$1 || $1 > KEEPALIVE_MAX_INTERVAL/1000) {
+				fastd_config_error(&@$, state, "invalid keepalive interval");
+				YYERROR;
+			}
+
+			state->peer_group->keepalive_interval = 1000*$1;
+		}
+	;
+
+keepalive_adaptive:
+		boolean {
+			state->peer_group->keepalive_adaptive = $1 ? FASTD_TRISTATE_TRUE : FASTD_TRISTATE_FALSE;
+		}
+	;
+
 method:		TOK_STRING {
 			fastd_config_method(state->peer_group, $1->str);
 		}
@@ -603,9 +709,79 @@ on_verify:	sync TOK_STRING {
 forward:	boolean		{ conf.forward = $1; }
 	;
 
+neighbor_proxy:	boolean		{ conf.neighbor_proxy = $1; }
+	;
+
+filter:		filter_action filter_matches
+	;
+
+filter_action:	TOK_PASS {
+			state->filter_rule = fastd_config_filter(FILTER_PASS, 0);
+		}
+	|	TOK_DROP {
+			state->filter_rule = fastd_config_filter(FILTER_DROP, 0);
+		}
+	|	TOK_LIMIT TOK_UINT {
+			if (!$2 || $2 > 1000000) {
+				fastd_config_error(&@$, state, "invalid filter limit");
+				YYERROR;
+			}
+
+			state->filter_rule = fastd_config_filter(FILTER_LIMIT, $2);
+		}
+	;
+
+filter_matches:	filter_matches filter_match
+	|
+	;
+
+filter_match:	TOK_ETHERTYPE TOK_UINT {
+			if ($2 > 0xffff) {
+				fastd_config_error(&@$, state, "invalid EtherType");
+				YYERROR;
+			}
+
+			state->filter_rule->match |= FILTER_MATCH_ETHERTYPE;
+			state->filter_rule->ethertype = $2;
+		}
+	|	TOK_TO TOK_STRING {
+			if (!fastd_config_filter_dest(state->filter_rule, $2->str)) {
+				fastd_config_error(&@$, state, "invalid MAC address");
+				YYERROR;
+			}
+		}
+	|	TOK_TO TOK_MULTICAST {
+			fastd_config_filter_dest(state->filter_rule, "01:00:00:00:00:00/8");
+		}
+	|	TOK_TO TOK_BROADCAST {
+			fastd_config_filter_dest(state->filter_rule, "ff:ff:ff:ff:ff:ff");
+		}
+	|	TOK_PROTOCOL TOK_UINT {
+			if ($2 > 255) {
+				fastd_config_error(&@$, state, "invalid IP protocol");
+				YYERROR;
+			}
+
+			state->filter_rule->match |= FILTER_MATCH_IP_PROTO;
+			state->filter_rule->ip_proto = $2;
+		}
+	|	TOK_UDP {
+			state->filter_rule->match |= FILTER_MATCH_IP_PROTO;
+			state->filter_rule->ip_proto = IPPROTO_UDP;
+		}
+	|	TOK_TCP {
+			state->filter_rule->match |= FILTER_MATCH_IP_PROTO;
+			state->filter_rule->ip_proto = IPPROTO_TCP;
+		}
+	|	port {
+			state->filter_rule->match |= FILTER_MATCH_PORT;
+			state->filter_rule->port = $1;
+		}
+	;
+
 
 include:	TOK_PEER TOK_STRING maybe_as {
-			fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+			fastd_peer_t *peer = fastd_peer_new();
 			peer->name = fastd_strdup(fastd_string_stack_get($3));
 
 			if (!fastd_config_read($2->str, state->peer_group, peer, state->depth))
@@ -45,6 +45,32 @@
 /** The SSSE3 bit in the CPUID return value */
 #define CPUID_SSSE3	((uint64_t)1 << 41)
 
+/** The SSE4.1 bit in the CPUID return value */
+#define CPUID_SSE41	((uint64_t)1 << 51)
+
+/** The AES bit in the CPUID return value */
+#define CPUID_AES	((uint64_t)1 << 57)
+
+/** The OSXSAVE bit in the CPUID return value */
+#define CPUID_OSXSAVE	((uint64_t)1 << 59)
+
+/** The AVX bit in the CPUID return value */
+#define CPUID_AVX	((uint64_t)1 << 60)
+
+
+/** The AVX2 bit in the CPUID extended features return value */
+#define CPUID_EXT_AVX2	((uint64_t)1 << 5)
+
+/** The SHA bit in the CPUID extended features return value */
+#define CPUID_EXT_SHA	((uint64_t)1 << 29)
+
+
+/** The SSE state bit in the XCR0 register */
+#define XCR0_SSE	((uint64_t)1 << 1)
+
+/** The AVX state bit in the XCR0 register */
+#define XCR0_AVX	((uint64_t)1 << 2)
+
 
 /** Returns the ECX and EDX return values of CPUID function 1 as a single uint64 */
 static inline uint64_t fastd_cpuid(void) {
@@ -65,4 +91,42 @@ static inline uint64_t fastd_cpuid(void) {
 	return ((uint64_t)cx) << 32 | (uint32_t)dx;
 }
 
+/**
+   Returns the EBX and ECX return values of CPUID function 7 (subfunction 0) as a single uint64
+
+   0 is returned when the CPU doesn't support function 7.
+*/
+static inline uint64_t fastd_cpuid_ext(void) {
+	unsigned long ax, bx, cx, dx;
+
+	__asm__ __volatile__ ("mov %%"REG_PFX"bx, %%"REG_PFX"si \n\t"
+			      "cpuid \n\t"
+			      "xchg %%"REG_PFX"bx, %%"REG_PFX"si \n\t"
+			      : "=a" (ax), "=S" (bx), "=c" (cx), "=d" (dx) : "a" (0), "c" (0));
+
+	if ((uint32_t)ax < 7)
+		return 0;
+
+	__asm__ __volatile__ ("mov %%"REG_PFX"bx, %%"REG_PFX"si \n\t"
+			      "cpuid \n\t"
+			      "xchg %%"REG_PFX"bx, %%"REG_PFX"si \n\t"
+			      : "=a" (ax), "=S" (bx), "=c" (cx), "=d" (dx) : "a" (7), "c" (0));
+
+	return ((uint64_t)cx) << 32 | (uint32_t)bx;
+}
+
 #undef REG_PFX
+
+
+/**
+   Returns the XCR0 register, which tells which register states are saved by the OS
+
+   Must only be called when fastd_cpuid() has reported CPUID_OSXSAVE.
+*/
+static inline uint64_t fastd_xgetbv(void) {
+	uint32_t ax, dx;
+
+	__asm__ __volatile__ ("xgetbv" : "=a" (ax), "=d" (dx) : "c" (0));
+
+	return ((uint64_t)dx) << 32 | ax;
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Common functions of the cipher and MAC implementation lists
+*/
+
+
+#include "crypto.h"
+
+#include <time.h>
+
+
+/** Returns the current monotonic time in nanoseconds */
+static inline int64_t calibrate_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (1000000000*(int64_t)ts.tv_sec) + ts.tv_nsec;
+}
+
+/**
+   Measures the throughput of a crypto implementation
+
+   \e run is called repeatedly for at least CALIBRATE_TIME nanoseconds; each call processes
+   \e len bytes and returns false if the implementation doesn't work.
+
+   \return the throughput in MB/s, or 0 if \e run has failed
+*/
+size_t fastd_calibrate_time(bool (*run)(void *arg), void *arg, size_t len) {
+	uint64_t bytes = 0;
+	bool ok = true;
+
+	int64_t start = calibrate_now(), elapsed;
+	do {
+		size_t k;
+		for (k = 0; k < 16; k++) {
+			if (!run(arg)) {
+				ok = false;
+				break;
+			}
+
+			bytes += len;
+		}
+
+		elapsed = calibrate_now() - start;
+	} while (ok && elapsed < CALIBRATE_TIME);
+
+	if (!ok || elapsed <= 0)
+		return 0;
+
+	return 1000*bytes/elapsed;
+}
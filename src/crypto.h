@@ -38,6 +38,21 @@
 #include <string.h>
 
 
+/** The number of blocks processed per call when calibrating cipher and MAC implementations */
+#define CALIBRATE_BLOCKS 96
+
+/** The minimum time to spend benchmarking a single implementation during calibration (in nanoseconds) */
+#define CALIBRATE_TIME 5000000
+
+/**
+   The size of the chunks in which the fused cipher/MAC paths of the methods process packets
+
+   The chunk size must be a multiple of 1024 bytes (the UHASH L1 block size); 4096 bytes of input and output
+   fit into the L1 cache of all relevant CPUs.
+*/
+#define STREAM_CHUNK_SIZE 4096
+
+
 /** Contains information about a cipher algorithm */
 struct fastd_cipher_info {
 	size_t key_length;		/**< The key length used by the cipher */
@@ -53,11 +68,25 @@ struct fastd_cipher {
 	fastd_cipher_state_t * (*init)(const uint8_t *key);
 	/** Encrypts or decrypts data */
 	bool (*crypt)(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv);
+	/** Encrypts or decrypts multiple independent buffers with individual IVs at once (optional, see fastd_cipher_crypt_batch()) */
+	bool (*crypt_batch)(const fastd_cipher_state_t *state, fastd_block128_t *const *out, const fastd_block128_t *const *in, const size_t *len, const uint8_t *const *iv, size_t n);
+	/** Encrypts or decrypts data starting at the given offset of the cipher stream, which must be a multiple of STREAM_CHUNK_SIZE (optional) */
+	bool (*crypt_offset)(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv, size_t offset);
 	/** Frees a cipher context */
 	void (*free)(fastd_cipher_state_t *state);
 };
 
 
+/**
+   The intermediate state of an incremental MAC computation
+
+   Must be zero-initialized before the first call to \e digest_update.
+*/
+struct fastd_mac_stream {
+	fastd_block128_t v[2];		/**< Implementation-specific intermediate values */
+	size_t length;			/**< The number of bytes processed so far */
+};
+
 /** Contains information about a message authentication code algorithm */
 struct fastd_mac_info {
 	size_t key_length;		/**< The key length used by the MAC */
@@ -72,17 +101,33 @@ struct fastd_mac {
 	fastd_mac_state_t * (*init)(const uint8_t *key);
 	/** Computes the MAC of data blocks */
 	bool (*digest)(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length);
+	/** Computes the MACs of multiple independent buffers at once (optional, see fastd_mac_digest_batch()) */
+	bool (*digest_batch)(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *const *in, const size_t *length, size_t n);
+	/** Adds data blocks to an incremental MAC computation; all but the last call must pass multiples of STREAM_CHUNK_SIZE (optional) */
+	bool (*digest_update)(const fastd_mac_state_t *state, fastd_mac_stream_t *stream, const fastd_block128_t *in, size_t length);
+	/** Finishes an incremental MAC computation (must be provided if \e digest_update is) */
+	bool (*digest_final)(const fastd_mac_state_t *state, fastd_block128_t *out, fastd_mac_stream_t *stream);
 	/** Frees a MAC context */
 	void (*free)(fastd_mac_state_t *state);
 };
 
 
+/** Measures the throughput of a crypto implementation in MB/s, or returns 0 if it doesn't work */
+size_t fastd_calibrate_time(bool (*run)(void *arg), void *arg, size_t len);
+
+
 /** Initializes the list of cipher implementations */
 void fastd_cipher_init(void);
 
 /** Configures a cipher to use a specific implementation */
 bool fastd_cipher_config(const char *name, const char *impl);
 
+/** Checks if the implementation of a cipher has been chosen explicitly in the configuration */
+bool fastd_cipher_is_configured(const char *name);
+
+/** Benchmarks the implementations of all ciphers used by the configured methods and chooses the fastest ones */
+void fastd_cipher_calibrate(void);
+
 
 /** Returns information about the cipher with the specified name if there is an implementation available */
 const fastd_cipher_info_t * fastd_cipher_info_get_by_name(const char *name);
@@ -97,6 +142,12 @@ void fastd_mac_init(void);
 /** Configures a MAC to use a specific implementation */
 bool fastd_mac_config(const char *name, const char *impl);
 
+/** Checks if the implementation of a MAC has been chosen explicitly in the configuration */
+bool fastd_mac_is_configured(const char *name);
+
+/** Benchmarks the implementations of all MACs used by the configured methods and chooses the fastest ones */
+void fastd_mac_calibrate(void);
+
 
 /** Returns information about the MAC with the specified name if there is an implementation available */
 const fastd_mac_info_t * fastd_mac_info_get_by_name(const char *name);
@@ -105,6 +156,50 @@ const fastd_mac_info_t * fastd_mac_info_get_by_name(const char *name);
 const fastd_mac_t * fastd_mac_get(const fastd_mac_info_t *info);
 
 
+/**
+   Encrypts or decrypts multiple independent buffers
+
+   Uses the batch entry point of the cipher implementation if it provides one, and
+   falls back to calling \e crypt for each buffer otherwise.
+*/
+static inline bool fastd_cipher_crypt_batch(const fastd_cipher_t *cipher, const fastd_cipher_state_t *state, fastd_block128_t *const *out, const fastd_block128_t *const *in, const size_t *len, const uint8_t *const *iv, size_t n) {
+	if (cipher->crypt_batch)
+		return cipher->crypt_batch(state, out, in, len, iv, n);
+
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (!cipher->crypt(state, out[i], in[i], len[i], iv[i]))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+   Computes the MACs of multiple independent buffers
+
+   Uses the batch entry point of the MAC implementation if it provides one, and
+   falls back to calling \e digest for each buffer otherwise.
+*/
+static inline bool fastd_mac_digest_batch(const fastd_mac_t *mac, const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *const *in, const size_t *length, size_t n) {
+	if (mac->digest_batch)
+		return mac->digest_batch(state, out, in, length, n);
+
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (!mac->digest(state, &out[i], in[i], length[i]))
+			return false;
+	}
+
+	return true;
+}
+
+
+/** Checks if a cipher and a MAC implementation can be used to process data in chunks */
+static inline bool fastd_crypto_can_stream(const fastd_cipher_t *cipher, const fastd_mac_t *mac) {
+	return (cipher->crypt_offset && mac->digest_update);
+}
+
 /** Sets a range of memory to zero, ensuring the operation can't be optimized out by the compiler */
 static inline void secure_memzero(void *s, size_t n) {
 	memset(s, 0, n);
@@ -145,3 +240,15 @@ static inline void xor(fastd_block128_t *x, const fastd_block128_t *a, const fas
 static inline void xor_a(fastd_block128_t *x, const fastd_block128_t *a) {
 	xor(x, x, a);
 }
+
+/** Adds \a n to a 128bit big-endian counter block (as used by the CTR mode), ignoring overflows of the lower 64 bits */
+static inline void ctr_add(fastd_block128_t *out, const uint8_t *iv, uint64_t n) {
+	memcpy(out, iv, sizeof(fastd_block128_t));
+
+	size_t i;
+	for (i = sizeof(fastd_block128_t)-1; i >= sizeof(fastd_block128_t)/2; i--) {
+		n += out->b[i];
+		out->b[i] = n;
+		n >>= 8;
+	}
+}
@@ -0,0 +1,53 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   AES-NI-based aes128-ctr implementation for newer x86 systems
+*/
+
+
+#include "aes128_ctr_aesni.h"
+#include "../../../../cpuid.h"
+
+
+/** Checks if the runtime platform can support the AES-NI implementation */
+static bool aes128_ctr_available(void) {
+	static const uint64_t REQ = CPUID_FXSR|CPUID_SSSE3|CPUID_AES;
+
+	return ((fastd_cpuid()&REQ) == REQ);
+}
+
+/** The aesni aes128-ctr implementation */
+const fastd_cipher_t fastd_cipher_aes128_ctr_aesni = {
+	.available = aes128_ctr_available,
+
+	.init = fastd_aes128_ctr_aesni_init,
+	.crypt = fastd_aes128_ctr_aesni_crypt,
+	.crypt_batch = fastd_aes128_ctr_aesni_crypt_batch,
+	.crypt_offset = fastd_aes128_ctr_aesni_crypt_offset,
+	.free = fastd_aes128_ctr_aesni_free,
+};
@@ -0,0 +1,246 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   AES-NI-based aes128-ctr implementation for newer x86 systems: implementation
+*/
+
+
+#include "aes128_ctr_aesni.h"
+#include "../../../../alloc.h"
+
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+
+/** The number of counter blocks encrypted in parallel */
+#define PARALLEL_BLOCKS 8
+
+
+/** The cipher state containing the expanded key */
+struct __attribute__((aligned(16))) fastd_cipher_state {
+	__m128i rk[11];			/**< The AES round keys */
+};
+
+
+/** _mm_shuffle_epi8 parameter to reverse the bytes of a __m128i */
+static const __v16qi BYTESWAP_SHUFFLE = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+
+/** Reverses the order of the bytes of a __m128i */
+static inline __m128i byteswap(__m128i v) {
+	return _mm_shuffle_epi8(v, (__m128i)BYTESWAP_SHUFFLE);
+}
+
+
+/** Computes the next round key from the previous one and the result of _mm_aeskeygenassist_si128() */
+static inline __m128i expand_key_step(__m128i key, __m128i keygened) {
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3, 3, 3, 3));
+
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+
+	return _mm_xor_si128(key, keygened);
+}
+
+/** Computes the next round key (the round constant must be a compile-time constant) */
+#define EXPAND_KEY(key, rcon) expand_key_step(key, _mm_aeskeygenassist_si128(key, rcon))
+
+
+/** Initializes the cipher state, expanding the key once */
+fastd_cipher_state_t * fastd_aes128_ctr_aesni_init(const uint8_t *key) {
+	fastd_cipher_state_t *state = fastd_new_aligned(fastd_cipher_state_t, 16);
+
+	state->rk[0] = _mm_loadu_si128((const __m128i *)key);
+	state->rk[1] = EXPAND_KEY(state->rk[0], 0x01);
+	state->rk[2] = EXPAND_KEY(state->rk[1], 0x02);
+	state->rk[3] = EXPAND_KEY(state->rk[2], 0x04);
+	state->rk[4] = EXPAND_KEY(state->rk[3], 0x08);
+	state->rk[5] = EXPAND_KEY(state->rk[4], 0x10);
+	state->rk[6] = EXPAND_KEY(state->rk[5], 0x20);
+	state->rk[7] = EXPAND_KEY(state->rk[6], 0x40);
+	state->rk[8] = EXPAND_KEY(state->rk[7], 0x80);
+	state->rk[9] = EXPAND_KEY(state->rk[8], 0x1b);
+	state->rk[10] = EXPAND_KEY(state->rk[9], 0x36);
+
+	return state;
+}
+
+/**
+   XORs data with the aes128-ctr cipher stream
+
+   The counter is kept in little-endian byte order, so it can be incremented using _mm_add_epi64().
+   The low 64 bits never overflow for the packet sizes used by fastd. PARALLEL_BLOCKS counter blocks are
+   encrypted per iteration to keep the AES units of the CPU busy.
+*/
+static void ctr_crypt(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, __m128i ctr) {
+	const __m128i *rk = state->rk;
+	const __m128i one = _mm_set_epi64x(0, 1);
+
+	size_t i, j;
+
+	for (; len >= PARALLEL_BLOCKS*sizeof(fastd_block128_t); len -= PARALLEL_BLOCKS*sizeof(fastd_block128_t)) {
+		__m128i b[PARALLEL_BLOCKS];
+
+		for (j = 0; j < PARALLEL_BLOCKS; j++) {
+			b[j] = _mm_xor_si128(byteswap(ctr), rk[0]);
+			ctr = _mm_add_epi64(ctr, one);
+		}
+
+		for (i = 1; i < 10; i++) {
+			for (j = 0; j < PARALLEL_BLOCKS; j++)
+				b[j] = _mm_aesenc_si128(b[j], rk[i]);
+		}
+
+		for (j = 0; j < PARALLEL_BLOCKS; j++) {
+			b[j] = _mm_aesenclast_si128(b[j], rk[10]);
+			_mm_storeu_si128((__m128i *)&out[j], _mm_xor_si128(b[j], _mm_loadu_si128((const __m128i *)&in[j])));
+		}
+
+		in += PARALLEL_BLOCKS;
+		out += PARALLEL_BLOCKS;
+	}
+
+	while (len) {
+		__m128i b = _mm_xor_si128(byteswap(ctr), rk[0]);
+		ctr = _mm_add_epi64(ctr, one);
+
+		for (i = 1; i < 10; i++)
+			b = _mm_aesenc_si128(b, rk[i]);
+
+		b = _mm_aesenclast_si128(b, rk[10]);
+
+		if (len < sizeof(fastd_block128_t)) {
+			fastd_block128_t tmp;
+			memcpy(&tmp, in, len);
+			_mm_storeu_si128((__m128i *)&tmp, _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)&tmp)));
+			memcpy(out, &tmp, len);
+
+			break;
+		}
+
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)in)));
+
+		in++;
+		out++;
+		len -= sizeof(fastd_block128_t);
+	}
+}
+
+/** XORs data with the aes128-ctr cipher stream, using the IV as a 128bit big-endian counter */
+bool fastd_aes128_ctr_aesni_crypt(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv) {
+	ctr_crypt(state, out, in, len, byteswap(_mm_loadu_si128((const __m128i *)iv)));
+	return true;
+}
+
+/** XORs data with the aes128-ctr cipher stream, starting at a given offset */
+bool fastd_aes128_ctr_aesni_crypt_offset(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv, size_t offset) {
+	__m128i ctr = byteswap(_mm_loadu_si128((const __m128i *)iv));
+	ctr = _mm_add_epi64(ctr, _mm_set_epi64x(0, offset / sizeof(fastd_block128_t)));
+
+	ctr_crypt(state, out, in, len, ctr);
+	return true;
+}
+
+/** Encrypts up to PARALLEL_BLOCKS prepared counter blocks and XORs them into the given (possibly partial) data blocks */
+static inline void ctr_crypt_blocks(const __m128i *rk, __m128i *b, fastd_block128_t *const *out, const fastd_block128_t *const *in, const size_t *len, size_t n) {
+	size_t i, j;
+
+	for (i = 1; i < 10; i++) {
+		for (j = 0; j < n; j++)
+			b[j] = _mm_aesenc_si128(b[j], rk[i]);
+	}
+
+	for (j = 0; j < n; j++) {
+		b[j] = _mm_aesenclast_si128(b[j], rk[10]);
+
+		if (len[j] < sizeof(fastd_block128_t)) {
+			fastd_block128_t tmp;
+			memcpy(&tmp, in[j], len[j]);
+			_mm_storeu_si128((__m128i *)&tmp, _mm_xor_si128(b[j], _mm_loadu_si128((const __m128i *)&tmp)));
+			memcpy(out[j], &tmp, len[j]);
+		}
+		else {
+			_mm_storeu_si128((__m128i *)out[j], _mm_xor_si128(b[j], _mm_loadu_si128((const __m128i *)in[j])));
+		}
+	}
+}
+
+/**
+   XORs multiple independent buffers with the aes128-ctr cipher stream
+
+   The blocks of all buffers are fed into the AES units together, so short buffers
+   (like the single-block GMAC tags) are still processed PARALLEL_BLOCKS at a time.
+*/
+bool fastd_aes128_ctr_aesni_crypt_batch(const fastd_cipher_state_t *state, fastd_block128_t *const *out, const fastd_block128_t *const *in, const size_t *len, const uint8_t *const *iv, size_t n) {
+	const __m128i *rk = state->rk;
+	const __m128i one = _mm_set_epi64x(0, 1);
+
+	__m128i b[PARALLEL_BLOCKS];
+	fastd_block128_t *block_out[PARALLEL_BLOCKS];
+	const fastd_block128_t *block_in[PARALLEL_BLOCKS];
+	size_t block_len[PARALLEL_BLOCKS];
+
+	size_t i, k = 0;
+
+	for (i = 0; i < n; i++) {
+		__m128i ctr = byteswap(_mm_loadu_si128((const __m128i *)iv[i]));
+
+		fastd_block128_t *o = out[i];
+		const fastd_block128_t *p = in[i];
+		size_t l = len[i];
+
+		while (l) {
+			b[k] = _mm_xor_si128(byteswap(ctr), rk[0]);
+			ctr = _mm_add_epi64(ctr, one);
+
+			block_out[k] = o++;
+			block_in[k] = p++;
+			block_len[k] = (l < sizeof(fastd_block128_t)) ? l : sizeof(fastd_block128_t);
+			l -= block_len[k];
+
+			if (++k == PARALLEL_BLOCKS) {
+				ctr_crypt_blocks(rk, b, block_out, block_in, block_len, k);
+				k = 0;
+			}
+		}
+	}
+
+	if (k)
+		ctr_crypt_blocks(rk, b, block_out, block_in, block_len, k);
+
+	return true;
+}
+
+/** Frees the cipher state */
+void fastd_aes128_ctr_aesni_free(fastd_cipher_state_t *state) {
+	if (state) {
+		secure_memzero(state, sizeof(*state));
+		free(state);
+	}
+}
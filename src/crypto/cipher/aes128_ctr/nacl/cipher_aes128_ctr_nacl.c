@@ -59,6 +59,14 @@ static bool aes128_ctr_crypt(const fastd_cipher_state_t *state, fastd_block128_t
 	return true;
 }
 
+/** XORs data with the aes128-ctr cipher stream, starting at a given offset */
+static bool aes128_ctr_crypt_offset(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv, size_t offset) {
+	fastd_block128_t ctr;
+	ctr_add(&ctr, iv, offset / sizeof(fastd_block128_t));
+
+	return aes128_ctr_crypt(state, out, in, len, ctr.b);
+}
+
 /** Frees the cipher state */
 static void aes128_ctr_free(fastd_cipher_state_t *state) {
 	if (state) {
@@ -72,5 +80,6 @@ static void aes128_ctr_free(fastd_cipher_state_t *state) {
 const fastd_cipher_t fastd_cipher_aes128_ctr_nacl = {
 	.init = aes128_ctr_init,
 	.crypt = aes128_ctr_crypt,
+	.crypt_offset = aes128_ctr_crypt_offset,
 	.free = aes128_ctr_free,
 };
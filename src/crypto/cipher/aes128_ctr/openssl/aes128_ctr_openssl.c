@@ -32,45 +32,146 @@
 
 #include "../../../../alloc.h"
 #include "../../../../crypto.h"
+#include "../../../../log.h"
 
 #include <openssl/evp.h>
+#include <pthread.h>
 
 
 /** The cipher state containing the OpenSSL cipher context */
 struct fastd_cipher_state {
-	EVP_CIPHER_CTX *aes;		/**< The OpenSSL cipher context */
+	EVP_CIPHER_CTX *aes;		/**< The OpenSSL cipher context with the prepared key schedule */
+	pthread_t owner;		/**< The thread the state was created in, which may use \e aes directly */
+	uint64_t id;			/**< A unique identifier of the state, as the address may be reused after the state is freed */
 };
 
+/** A thread-specific copy of the cipher context of a state */
+typedef struct thread_ctx {
+	EVP_CIPHER_CTX *aes;		/**< The copied cipher context */
+	uint64_t id;			/**< The ID of the state \e aes was copied from (0 if none) */
+} thread_ctx_t;
 
-/** Initializes the cipher state */
+
+/** Ensures thread_ctx_key is only created once */
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+
+/** The key of the thread-specific cipher contexts used by threads other than the owner of a cipher state */
+static pthread_key_t thread_ctx_key;
+
+/** Protects next_state_id */
+static pthread_mutex_t state_id_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The ID of the next cipher state to be created */
+static uint64_t next_state_id = 1;
+
+
+/** Frees a thread-specific cipher context when its thread exits */
+static void free_thread_ctx(void *p) {
+	thread_ctx_t *ctx = p;
+
+	EVP_CIPHER_CTX_free(ctx->aes);
+	free(ctx);
+}
+
+/** Creates the key for the thread-specific cipher contexts */
+static void init_thread_ctx_key(void) {
+	if ((errno = pthread_key_create(&thread_ctx_key, free_thread_ctx)) != 0)
+		exit_errno("pthread_key_create");
+}
+
+/**
+   Returns a cipher context with the key schedule of the given state that may be used by the calling thread
+
+   The owner thread of the state uses the state's context directly. Other threads copy the prepared context
+   into a thread-specific context, so concurrent calls never share an EVP_CIPHER_CTX. The copy is only
+   made again when the thread switches to a different state.
+*/
+static EVP_CIPHER_CTX * get_ctx(const fastd_cipher_state_t *state) {
+	if (pthread_equal(state->owner, pthread_self()))
+		return state->aes;
+
+	pthread_once(&thread_ctx_once, init_thread_ctx_key);
+
+	thread_ctx_t *ctx = pthread_getspecific(thread_ctx_key);
+	if (!ctx) {
+		ctx = fastd_new0(thread_ctx_t);
+
+		ctx->aes = EVP_CIPHER_CTX_new();
+		if (!ctx->aes) {
+			free(ctx);
+			return NULL;
+		}
+
+		if ((errno = pthread_setspecific(thread_ctx_key, ctx)) != 0) {
+			free_thread_ctx(ctx);
+			return NULL;
+		}
+	}
+
+	if (ctx->id != state->id) {
+		ctx->id = 0;
+
+		if (!EVP_CIPHER_CTX_copy(ctx->aes, state->aes))
+			return NULL;
+
+		ctx->id = state->id;
+	}
+
+	return ctx->aes;
+}
+
+
+/** Initializes the cipher state, preparing the key schedule */
 static fastd_cipher_state_t * aes128_ctr_init(const uint8_t *key) {
 	fastd_cipher_state_t *state = fastd_new(fastd_cipher_state_t);
 
 	state->aes = EVP_CIPHER_CTX_new();
-	EVP_EncryptInit(state->aes, EVP_aes_128_ctr(), (const unsigned char *)key, NULL);
+	if (!state->aes)
+		exit_error("EVP_CIPHER_CTX_new: unable to allocate cipher context");
+
+	EVP_EncryptInit_ex(state->aes, EVP_aes_128_ctr(), NULL, (const unsigned char *)key, NULL);
+	state->owner = pthread_self();
+
+	pthread_mutex_lock(&state_id_mutex);
+	state->id = next_state_id++;
+	pthread_mutex_unlock(&state_id_mutex);
 
 	return state;
 }
 
-/** XORs data with the aes128-ctr cipher stream */
+/**
+   XORs data with the aes128-ctr cipher stream
+
+   Only the IV is reset for each packet, the key schedule prepared in aes128_ctr_init() is reused. As counter mode
+   doesn't need any padding, EVP_EncryptFinal() isn't necessary.
+*/
 static bool aes128_ctr_crypt(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv) {
-	int clen, clen2;
+	EVP_CIPHER_CTX *aes = get_ctx(state);
+	int clen;
 
-	if (!EVP_EncryptInit(state->aes, NULL, NULL, iv))
+	if (!aes)
 		return false;
 
-	if (!EVP_EncryptUpdate(state->aes, (unsigned char *)out, &clen, (const unsigned char *)in, len))
+	if (!EVP_EncryptInit_ex(aes, NULL, NULL, NULL, iv))
 		return false;
 
-	if (!EVP_EncryptFinal(state->aes, ((unsigned char *)out) + clen, &clen2))
+	if (!EVP_EncryptUpdate(aes, (unsigned char *)out, &clen, (const unsigned char *)in, len))
 		return false;
 
-	if ((size_t)(clen+clen2) != len)
+	if ((size_t)clen != len)
 		return false;
 
 	return true;
 }
 
+/** XORs data with the aes128-ctr cipher stream, starting at a given offset */
+static bool aes128_ctr_crypt_offset(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv, size_t offset) {
+	fastd_block128_t ctr;
+	ctr_add(&ctr, iv, offset / sizeof(fastd_block128_t));
+
+	return aes128_ctr_crypt(state, out, in, len, ctr.b);
+}
+
 /** Frees the cipher state */
 static void aes128_ctr_free(fastd_cipher_state_t *state) {
 	if (state) {
@@ -84,5 +185,6 @@ static void aes128_ctr_free(fastd_cipher_state_t *state) {
 const fastd_cipher_t fastd_cipher_aes128_ctr_openssl = {
 	.init = aes128_ctr_init,
 	.crypt = aes128_ctr_crypt,
+	.crypt_offset = aes128_ctr_crypt_offset,
 	.free = aes128_ctr_free,
 };
@@ -44,6 +44,12 @@ static bool null_memcpy(UNUSED const fastd_cipher_state_t *state, fastd_block128
 	return true;
 }
 
+/** Just copies the input data to the output (the offset is irrelevant for the null cipher) */
+static bool null_memcpy_offset(UNUSED const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, UNUSED const uint8_t *iv, UNUSED size_t offset) {
+	memcpy(out, in, len);
+	return true;
+}
+
 /** Doesn't do anything as the null cipher doesn't use any state */
 static void null_free(UNUSED fastd_cipher_state_t *state) {
 }
@@ -52,5 +58,6 @@ static void null_free(UNUSED fastd_cipher_state_t *state) {
 const fastd_cipher_t fastd_cipher_null_memcpy = {
 	.init = null_init,
 	.crypt = null_memcpy,
+	.crypt_offset = null_memcpy_offset,
 	.free = null_free,
 };
@@ -135,6 +135,30 @@ static bool ghash_digest(const fastd_mac_state_t *state, fastd_block128_t *out,
 	return true;
 }
 
+/** Adds blocks to an incremental GHASH computation */
+static bool ghash_digest_update(const fastd_mac_state_t *state, fastd_mac_stream_t *stream, const fastd_block128_t *in, size_t length) {
+	if (length % sizeof(fastd_block128_t))
+		exit_bug("ghash_digest_update (builtin): invalid length");
+
+	size_t n_blocks = length / sizeof(fastd_block128_t);
+
+	size_t i;
+	for (i = 0; i < n_blocks; i++) {
+		xor_a(&stream->v[0], &in[i]);
+		mulH_a(&stream->v[0], state);
+	}
+
+	stream->length += length;
+
+	return true;
+}
+
+/** Finishes an incremental GHASH computation */
+static bool ghash_digest_final(UNUSED const fastd_mac_state_t *state, fastd_block128_t *out, fastd_mac_stream_t *stream) {
+	*out = stream->v[0];
+	return true;
+}
+
 /** Frees the MAC state */
 static void ghash_free(fastd_mac_state_t *state) {
 	if (state) {
@@ -147,5 +171,7 @@ static void ghash_free(fastd_mac_state_t *state) {
 const fastd_mac_t fastd_mac_ghash_builtin = {
 	.init = ghash_init,
 	.digest = ghash_digest,
+	.digest_update = ghash_digest_update,
+	.digest_final = ghash_digest_final,
 	.free = ghash_free,
 };
@@ -47,5 +47,8 @@ const fastd_mac_t fastd_mac_ghash_pclmulqdq = {
 
 	.init = fastd_ghash_pclmulqdq_init,
 	.digest = fastd_ghash_pclmulqdq_digest,
+	.digest_batch = fastd_ghash_pclmulqdq_digest_batch,
+	.digest_update = fastd_ghash_pclmulqdq_digest_update,
+	.digest_final = fastd_ghash_pclmulqdq_digest_final,
 	.free = fastd_ghash_pclmulqdq_free,
 };
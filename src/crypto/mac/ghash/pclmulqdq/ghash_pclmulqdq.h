@@ -37,4 +37,7 @@
 
 fastd_mac_state_t * fastd_ghash_pclmulqdq_init(const uint8_t *key);
 bool fastd_ghash_pclmulqdq_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length);
+bool fastd_ghash_pclmulqdq_digest_batch(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *const *in, const size_t *length, size_t n);
+bool fastd_ghash_pclmulqdq_digest_update(const fastd_mac_state_t *state, fastd_mac_stream_t *stream, const fastd_block128_t *in, size_t length);
+bool fastd_ghash_pclmulqdq_digest_final(const fastd_mac_state_t *state, fastd_block128_t *out, fastd_mac_stream_t *stream);
 void fastd_ghash_pclmulqdq_free(fastd_mac_state_t *state);
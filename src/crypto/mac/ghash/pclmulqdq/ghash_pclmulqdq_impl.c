@@ -38,6 +38,10 @@
 #include <tmmintrin.h>
 
 
+/** The number of independent GHASH computations interleaved by fastd_ghash_pclmulqdq_digest_batch() */
+#define PARALLEL_STREAMS 4
+
+
 /** An union allowing easy access to a block as a SIMD vector and a fastd_block128_t */
 typedef union vecblock {
 	__m128i v;			/**< __m128i access */
@@ -149,24 +153,94 @@ static __m128i gmul(__m128i v, __m128i h) {
 }
 
 
+/** Multiplies the input blocks into the (byteswapped) GHASH value \a v */
+static __m128i ghash_blocks(const fastd_mac_state_t *state, __m128i v, const fastd_block128_t *in, size_t n_blocks) {
+	size_t i;
+	for (i = 0; i < n_blocks; i++) {
+		__m128i b = ((vecblock_t)in[i]).v;
+		v = _mm_xor_si128(v, byteswap(b));
+		v = gmul(v, state->H.v);
+	}
+
+	return v;
+}
+
 /** Calculates the GHASH of the supplied input blocks */
 bool fastd_ghash_pclmulqdq_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
 	if (length % sizeof(fastd_block128_t))
 		exit_bug("ghash_digest (pclmulqdq): invalid length");
 
-	size_t n_blocks = length / sizeof(fastd_block128_t);
+	vecblock_t v;
+	v.v = byteswap(ghash_blocks(state, _mm_setzero_si128(), in, length / sizeof(fastd_block128_t)));
+	*out = v.b;
 
-	vecblock_t v = {.v = _mm_setzero_si128()};
+	return true;
+}
 
-	size_t i;
-	for (i = 0; i < n_blocks; i++) {
-		__m128i b = ((vecblock_t)in[i]).v;
-		v.v = _mm_xor_si128(v.v, byteswap(b));
-		v.v = gmul(v.v, state->H.v);
+/**
+   Calculates the GHASHes of multiple independent buffers
+
+   The multiplications of up to PARALLEL_STREAMS buffers are interleaved, so the CPU can overlap
+   the latencies of the independent carryless multiplications.
+*/
+bool fastd_ghash_pclmulqdq_digest_batch(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *const *in, const size_t *length, size_t n) {
+	size_t i, j, k;
+
+	for (i = 0; i < n; i++) {
+		if (length[i] % sizeof(fastd_block128_t))
+			exit_bug("ghash_digest_batch (pclmulqdq): invalid length");
 	}
 
-	v.v = byteswap(v.v);
-	*out = v.b;
+	for (i = 0; i < n; i += PARALLEL_STREAMS) {
+		size_t m = (n - i < PARALLEL_STREAMS) ? n - i : PARALLEL_STREAMS;
+
+		__m128i v[PARALLEL_STREAMS];
+		size_t n_blocks[PARALLEL_STREAMS], max_blocks = 0;
+
+		for (j = 0; j < m; j++) {
+			v[j] = _mm_setzero_si128();
+			n_blocks[j] = length[i+j] / sizeof(fastd_block128_t);
+
+			if (n_blocks[j] > max_blocks)
+				max_blocks = n_blocks[j];
+		}
+
+		for (k = 0; k < max_blocks; k++) {
+			for (j = 0; j < m; j++) {
+				if (k >= n_blocks[j])
+					continue;
+
+				__m128i b = ((vecblock_t)in[i+j][k]).v;
+				v[j] = _mm_xor_si128(v[j], byteswap(b));
+				v[j] = gmul(v[j], state->H.v);
+			}
+		}
+
+		for (j = 0; j < m; j++) {
+			vecblock_t r = { .v = byteswap(v[j]) };
+			out[i+j] = r.b;
+		}
+	}
+
+	return true;
+}
+
+/** Adds blocks to an incremental GHASH computation */
+bool fastd_ghash_pclmulqdq_digest_update(const fastd_mac_state_t *state, fastd_mac_stream_t *stream, const fastd_block128_t *in, size_t length) {
+	if (length % sizeof(fastd_block128_t))
+		exit_bug("ghash_digest_update (pclmulqdq): invalid length");
+
+	vecblock_t v = {.b = stream->v[0]};
+	v.v = byteswap(ghash_blocks(state, byteswap(v.v), in, length / sizeof(fastd_block128_t)));
+	stream->v[0] = v.b;
+
+	stream->length += length;
+
+	return true;
+}
 
+/** Finishes an incremental GHASH computation */
+bool fastd_ghash_pclmulqdq_digest_final(UNUSED const fastd_mac_state_t *state, fastd_block128_t *out, fastd_mac_stream_t *stream) {
+	*out = stream->v[0];
 	return true;
 }
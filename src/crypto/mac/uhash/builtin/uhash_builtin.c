@@ -228,6 +228,13 @@ static inline uint64_t l2add(uint64_t Y, uint64_t K, uint64_t m) {
 	return sel(Y2, Y1, s);
 }
 
+/** Adds one L1-HASH result to the L2-HASH values (with all four iterations interleaved) */
+static inline void l2step(uint64_4_t *y, const uint64_t *K, const uint64_4_t *M) {
+	size_t j;
+	for (j = 0; j < 4; j++)
+		y->v[j] = l2add(y->v[j], K[3*j], M->v[j]);
+}
+
 /**
    The L2-HASH function (with all four iterations interleaved)
 
@@ -240,11 +247,9 @@ static uint64_4_t l2hash(const uint64_t *K, const uint64_4_t *M, size_t count) {
 
 	uint64_4_t y = {{1, 1, 1, 1}};
 
-	size_t i, j;
-	for (i = 0; i < count; i++) {
-		for (j = 0; j < 4; j++)
-			y.v[j] = l2add(y.v[j], K[3*j], M[i].v[j]);
-	}
+	size_t i;
+	for (i = 0; i < count; i++)
+		l2step(&y, K, &M[i]);
 
 	return y;
 }
@@ -262,10 +267,21 @@ static uint32_t l3hash(const uint64_t *K1, uint32_t K2, uint64_t M) {
 	return mod_p36(y) ^ K2;
 }
 
+/** Applies the L3-HASH to all four iterations and writes the result */
+static void l3hash_all(const fastd_mac_state_t *state, fastd_block128_t *out, const uint64_4_t *B) {
+	size_t i;
+	for (i = 0; i < 4; i++) {
+		const uint64_t *L3Key1 = state->L3Key1 + 8*i;
+		uint32_t L3Key2 = state->L3Key2[i];
+
+		uint32_t c = l3hash(L3Key1, L3Key2, B->v[i]);
+		out->dw[i] = htobe32(c);
+	}
+}
+
 /** Calculates the UHASH of the supplied blocks */
 static bool uhash_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
 	size_t blocks = max_size_t(block_count(length, 1024), 1);
-	size_t i;
 
 	uint64_4_t A[blocks];
 	l1hash(A, state->L1Key, in, length);
@@ -276,13 +292,77 @@ static bool uhash_digest(const fastd_mac_state_t *state, fastd_block128_t *out,
 	else
 		B = l2hash(state->L2Key, A, blocks);
 
-	for (i = 0; i < 4; i++) {
-		const uint64_t *L3Key1 = state->L3Key1 + 8*i;
-		uint32_t L3Key2 = state->L3Key2[i];
+	l3hash_all(state, out, &B);
 
-		uint32_t c = l3hash(L3Key1, L3Key2, B.v[i]);
-		out->dw[i] = htobe32(c);
+	return true;
+}
+
+/**
+   Adds one L1-HASH result to an incremental UHASH computation
+
+   The first result is stored as it is, as the L2-HASH is only used for messages longer
+   than one L1 block. From the second result on, the L2-HASH values are stored.
+*/
+static void uhash_stream_add(const fastd_mac_state_t *state, fastd_mac_stream_t *stream, const uint64_4_t *A) {
+	size_t count = block_count(stream->length, 1024);
+
+	if (!count) {
+		memcpy(stream->v, A, sizeof(*A));
+		return;
+	}
+
+	if (count >= 0x4000)
+		exit_bug("uhash (builtin): uhash_digest_update: message too long");
+
+	uint64_4_t y;
+
+	if (count == 1) {
+		uint64_4_t A0;
+		memcpy(&A0, stream->v, sizeof(A0));
+
+		y = (uint64_4_t){{1, 1, 1, 1}};
+		l2step(&y, state->L2Key, &A0);
 	}
+	else {
+		memcpy(&y, stream->v, sizeof(y));
+	}
+
+	l2step(&y, state->L2Key, A);
+	memcpy(stream->v, &y, sizeof(y));
+}
+
+/**
+   Adds data to an incremental UHASH computation
+
+   The data of the last call must be padded with zeros to a multiple of 32 bytes.
+*/
+static bool uhash_digest_update(const fastd_mac_state_t *state, fastd_mac_stream_t *stream, const fastd_block128_t *in, size_t length) {
+	if (stream->length % 1024)
+		exit_bug("uhash_digest_update (builtin): invalid length");
+
+	if (!length && stream->length)
+		return true;
+
+	do {
+		size_t blocklen = min_size_t(length, 1024);
+
+		uint64_4_t A = nh(state->L1Key, in->dw, blocklen);
+		uhash_stream_add(state, stream, &A);
+		stream->length += blocklen;
+
+		in += 64;
+		length -= blocklen;
+	} while (length);
+
+	return true;
+}
+
+/** Finishes an incremental UHASH computation */
+static bool uhash_digest_final(const fastd_mac_state_t *state, fastd_block128_t *out, fastd_mac_stream_t *stream) {
+	uint64_4_t B;
+	memcpy(&B, stream->v, sizeof(B));
+
+	l3hash_all(state, out, &B);
 
 	return true;
 }
@@ -299,5 +379,7 @@ static void uhash_free(fastd_mac_state_t *state) {
 const fastd_mac_t fastd_mac_uhash_builtin = {
 	.init = uhash_init,
 	.digest = uhash_digest,
+	.digest_update = uhash_digest_update,
+	.digest_final = uhash_digest_final,
 	.free = uhash_free,
 };
@@ -36,12 +36,17 @@
 
 #include "fastd.h"
 #include "async.h"
+#include "batadv.h"
 #include "config.h"
 #include "crypto.h"
+#include "filter.h"
+#include "handshake.h"
+#include "neighbor.h"
 #include "peer.h"
 #include "peer_group.h"
 #include "peer_hashtable.h"
 #include "poll.h"
+#include "worker.h"
 #include <generated/version.h>
 
 #include <grp.h>
@@ -452,6 +457,9 @@ static inline void init_early(void) {
 	fastd_random_bytes(&seed, sizeof(seed), false);
 	srandom(seed);
 
+	fastd_random_bytes(ctx.hash_key, sizeof(ctx.hash_key), false);
+
+	fastd_sha256_init();
 	fastd_cipher_init();
 	fastd_mac_init();
 }
@@ -518,9 +526,12 @@ static inline void init(int argc, char *argv[]) {
 	init_config(&status_fd);
 
 	fastd_update_time();
-	fastd_task_schedule(&ctx.next_maintenance, TASK_TYPE_MAINTENANCE, ctx.now + MAINTENANCE_INTERVAL);
+	ctx.wakeup_rate_time = ctx.now;
+	fastd_task_schedule(&ctx.next_maintenance, TASK_TYPE_MAINTENANCE, ctx.now + MAINTENANCE_INTERVAL, fastd_timer_slack(MAINTENANCE_INTERVAL));
 
 	fastd_receive_unknown_init();
+	fastd_handshake_init();
+	fastd_handshake_pacer_init();
 
 #ifdef WITH_DYNAMIC_PEERS
 	fastd_sem_init(&ctx.verify_limit, VERIFY_LIMIT);
@@ -544,12 +555,13 @@ static inline void init(int argc, char *argv[]) {
 
 	fastd_status_init();
 	fastd_async_init();
+	fastd_worker_init();
 
 	fastd_socket_bind_all();
 
 	on_pre_up();
 
-	if (conf.mode == MODE_TAP || fastd_use_android_integration()) {
+	if ((conf.mode == MODE_TAP && !conf.tap_relay) || conf.tun_shared || fastd_use_android_integration()) {
 		ctx.iface = fastd_iface_open(NULL);
 		if (!ctx.iface)
 			exit(1); /* An error message has already been printed by fastd_iface_open() */
@@ -560,6 +572,8 @@ static inline void init(int argc, char *argv[]) {
 	write_pid();
 
 	fastd_peer_hashtable_init();
+	fastd_filter_init();
+	fastd_neighbor_init();
 
 	notify_systemd();
 
@@ -640,6 +654,8 @@ static inline void handle_signals(void) {
 
 /** A single iteration of fastd's main loop */
 static inline void run(void) {
+	ctx.wakeups++;
+
 	fastd_task_handle();
 	fastd_poll_handle();
 
@@ -648,8 +664,8 @@ static inline void run(void) {
 
 /** Removes all peers */
 static void delete_peers(void) {
-	while (VECTOR_LEN(ctx.peers))
-		fastd_peer_delete(VECTOR_INDEX(ctx.peers, VECTOR_LEN(ctx.peers)-1));
+	while (ctx.peers_tail)
+		fastd_peer_delete(ctx.peers_tail);
 }
 
 /**
@@ -662,7 +678,10 @@ static void delete_peers(void) {
 static inline void cleanup(void) {
 	pr_info("terminating fastd");
 
+	fastd_worker_free();
+
 	delete_peers();
+	fastd_handshake_pacer_free();
 
 	if (ctx.iface) {
 		on_down(ctx.iface);
@@ -676,12 +695,15 @@ static inline void cleanup(void) {
 	on_post_down();
 
 	fastd_peer_hashtable_free();
+	fastd_filter_free();
+	fastd_neighbor_free();
+	fastd_batadv_free();
 
 	pthread_attr_destroy(&ctx.detached_thread);
 
 	VECTOR_FREE(ctx.async_pids);
-	VECTOR_FREE(ctx.peers);
-	VECTOR_FREE(ctx.eth_addrs);
+	fastd_peer_slab_free();
+	fastd_peer_eth_addr_free();
 
 	free(ctx.protocol_state);
 
@@ -691,7 +713,9 @@ static inline void cleanup(void) {
 	ERR_free_strings();
 #endif
 
+	fastd_handshake_free();
 	fastd_receive_unknown_free();
+	fastd_receive_free();
 
 	close_log();
 	fastd_config_release();
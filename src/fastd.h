@@ -37,7 +37,9 @@
 #pragma once
 
 #include "buffer.h"
+#include "handshake_pacer.h"
 #include "log.h"
+#include "sha256.h"
 #include "poll.h"
 #include "sem.h"
 #include "shell.h"
@@ -96,9 +98,13 @@ struct fastd_protocol {
 
 	/** Handles a received payload packet (performs decryption and validity check, etc.) */
 	void (*handle_recv)(fastd_peer_t *peer, fastd_buffer_t buffer);
+	/** Handles multiple payload packets received from the same peer at once (optional) */
+	void (*handle_recv_batch)(fastd_peer_t *peer, const fastd_buffer_t *buffers, size_t n);
 
 	/** Sends a payload data packet to the given peer */
 	void (*send)(fastd_peer_t *peer, fastd_buffer_t buffer);
+	/** Sends a payload data packet to the given peer, leaving the buffer to the caller so it can be sent to other peers as well; returns false if nothing was sent (optional) */
+	bool (*send_shared)(fastd_peer_t *peer, const fastd_buffer_t buffer);
 
 
 	/** Initializes the protocol state for a peer */
@@ -177,6 +183,7 @@ typedef enum fastd_stat_type {
 	STAT_RX_REORDERED,			/**< Reception statistics (reordered) */
 	STAT_RX_BATADV_MCAST,		/**< Reception statistics (BATMAN-adv multicast packets */
 	STAT_RX_BATADV_UCAST,		/**< Reception statistics (BATMAN-adv multicast packets */
+	STAT_RX_BATADV_DUPLICATE,		/**< Reception statistics (BATMAN-adv broadcast packets not forwarded as they have already been sent to all peers) */
 	STAT_TX,				/**< Transmission statistics (OK) */
 	STAT_TX_DROPPED,			/**< Transmission statistics (dropped because of full queues) */
 	STAT_TX_ERROR,				/**< Transmission statistics (other errors) */
@@ -200,6 +207,36 @@ struct fastd_handshake_timeout {
 	fastd_timeout_t timeout;		/**< Timeout until handshakes from this address are ignored */
 };
 
+/** A token bucket limiting the rate of handshakes accepted from a source prefix */
+struct fastd_handshake_bucket {
+	fastd_peer_address_t prefix;		/**< The masked source address (with the port set to 0) */
+	fastd_timeout_t refilled;		/**< The last time tokens were added to the bucket */
+	unsigned tokens;			/**< The number of handshakes that may still be accepted */
+};
+
+/** A handshake cookie received from another peer */
+struct fastd_handshake_cookie {
+	fastd_peer_address_t address;		/**< The address the cookie was received from */
+	fastd_timeout_t timeout;		/**< Timeout until the cookie is sent with initial handshakes */
+	fastd_timeout_t retry_timeout;		/**< Timeout until another cookie from this address may trigger a new handshake */
+	uint8_t cookie[HANDSHAKE_COOKIE_BYTES];	/**< The cookie */
+
+	fastd_peer_address_t init_address;	/**< The address the last initial handshake was sent to */
+	fastd_timeout_t init_timeout;		/**< Timeout until a cookie reply from \e init_address is accepted */
+};
+
+/** An open-addressing hashtable of peers (see peer_hashtable.c) */
+struct fastd_peer_hashtable {
+	uint32_t seed;				/**< The hash seed */
+	size_t size;				/**< The number of buckets (a power of 2) */
+	size_t used;				/**< The number of entries */
+	fastd_peer_hashtable_bucket_t *buckets;	/**< The buckets */
+
+	size_t old_size;			/**< The number of buckets of the table that is being migrated */
+	size_t migrated;			/**< The number of buckets of the old table that have already been migrated */
+	fastd_peer_hashtable_bucket_t *old_buckets; /**< The buckets of the old table while it is being migrated (or NULL) */
+};
+
 
 /** The static configuration of \em fastd */
 struct fastd_config {
@@ -218,12 +255,20 @@ struct fastd_config {
 
 	uint16_t mtu;				/**< The configured MTU */
 	fastd_mode_t mode;			/**< The configured mode of operation */
+	bool tun_shared;			/**< Specifies if a single TUN interface is shared by all peers in TUN mode */
+	bool tap_relay;				/**< Specifies if no TAP interface is created in TAP mode, so packets are only forwarded between peers */
+	bool route_learn;			/**< Specifies if routes are learned from the source addresses of received packets */
 
 #ifdef USE_PACKET_MARK
 	uint32_t packet_mark;			/**< The configured packet mark (or 0) */
 #endif
 	bool forward;				/**< Specifies if packet forwarding is enable */
+	fastd_filter_rule_t *filter_rules;	/**< The configured filter rules for flooded packets in TAP mode */
+	bool neighbor_proxy;			/**< Specifies if ARP requests and neighbor solicitations are answered from a cache in TAP mode */
 	bool secure_handshakes;			/**< Can be set to false to support connections with fastd versions before v11 */
+	unsigned handshake_limit;		/**< The maximum number of handshakes initiated or processed per second; 0 for no limit */
+	int timer_slack;			/**< The maximum time (in milliseconds) tasks may be delayed by to reduce the number of wakeups */
+	bool calibrate_crypto;			/**< Benchmarks the available cipher and MAC implementations at startup and chooses the fastest ones */
 
 	fastd_drop_caps_t drop_caps;		/**< Specifies if and when to drop capabilities */
 
@@ -292,7 +337,33 @@ struct fastd_context {
 	fastd_iface_t *iface;			/**< The default tunnel interface */
 
 	uint64_t next_peer_id;			/**< An monotonously increasing ID peers are identified with in some components */
-	VECTOR(fastd_peer_t *) peers;		/**< The currectly active peers */
+	VECTOR(fastd_peer_t *) peer_slabs;	/**< The chunks of PEER_SLAB_CHUNK peers the peer structures are allocated from */
+	fastd_peer_t *peer_slab_free;		/**< The list of unused peer structures in the peer slab */
+
+	size_t n_peers;				/**< The number of currently active peers */
+	fastd_peer_t *peers;			/**< The list of currently active peers, in the order they have been added */
+	fastd_peer_t *peers_tail;		/**< The last element of the peers list */
+
+	size_t n_established;			/**< The number of established peers */
+	fastd_peer_t *established_peers;	/**< The list of established peers */
+
+	fastd_route_node_t *routes4;		/**< The IPv4 route table used in TUN mode with a shared interface */
+	fastd_route_node_t *routes6;		/**< The IPv6 route table used in TUN mode with a shared interface */
+	size_t n_routes;			/**< The number of routes in the route tables */
+	size_t n_learned_routes;		/**< The number of learned routes in the route tables */
+	uint64_t route_unroutable;		/**< The number of packets dropped as there was no route or the peer wasn't connected */
+
+	size_t n_filters;			/**< The number of compiled filter rules */
+	fastd_filter_t *filters;		/**< The compiled filter rules for flooded packets in TAP mode */
+	unsigned filter_match;			/**< The fields any of the filter rules matches on */
+
+	uint32_t neighbor_seed;			/**< The hash seed used for the neighbor cache */
+	fastd_neighbor_t *neighbors;		/**< The neighbor cache of the ARP/ND proxy (NEIGHBOR_CACHE_SIZE entries) */
+	uint64_t neighbor_hits;			/**< The number of requests answered from the neighbor cache */
+	uint64_t neighbor_misses;		/**< The number of requests that could not be answered from the neighbor cache */
+
+	uint32_t batadv_bcast_seed;		/**< The hash seed used for the BATMAN-adv broadcast cache */
+	fastd_batadv_bcast_t *batadv_bcasts;	/**< The BATMAN-adv broadcasts recently sent to all peers (BATADV_BCAST_CACHE_SIZE entries, allocated on first use) */
 
 #ifdef WITH_DYNAMIC_PEERS
 	fastd_sem_t verify_limit;		/**< Keeps track of the number of verifier threads */
@@ -312,20 +383,39 @@ struct fastd_context {
 	bool has_floating;			/**< Specifies if any of the configured peers have floating remotes */
 	uint16_t max_mtu;			/**< The maximum MTU of all peer-specific interfaces */
 
-	uint32_t peer_addr_ht_seed;		/**< The hash seed used for peer_addr_ht */
-	size_t peer_addr_ht_size;		/**< The number of hash buckets in the peer address hashtable */
-	size_t peer_addr_ht_used;		/**< The current number of entries in the peer address hashtable */
-	VECTOR(fastd_peer_t *) *peer_addr_ht;	/**< An array of hash buckets for the peer hash table */
+	uint64_t hash_key[2];			/**< The secret key of the keyed hash used for peer addresses */
+
+	fastd_peer_hashtable_t peer_addr_ht;	/**< The hashtable mapping current peer addresses to their peers */
+	fastd_peer_hashtable_t peer_owner_ht;	/**< The hashtable mapping statically configured remote addresses to their peers */
 
+#ifdef WITH_TASK_WHEEL
+	fastd_timer_wheel_t task_queue;		/**< Timer wheel of scheduled tasks */
+#else
 	fastd_pqueue_t *task_queue;		/**< Priority queue of scheduled tasks */
+#endif
 	fastd_task_t next_maintenance;		/**< Schedules the next maintenance call */
 
+	uint64_t wakeups;			/**< The number of main loop iterations */
+	uint64_t wakeup_rate_count;		/**< The value of \e wakeups at the last wakeup rate update */
+	fastd_timeout_t wakeup_rate_time;	/**< The time of the last wakeup rate update */
+	double wakeup_rate;			/**< The number of main loop iterations per second between the last two maintenance runs */
+
 	VECTOR(pid_t) async_pids;		/**< PIDs of asynchronously executed commands which still have to be reaped */
 	fastd_poll_fd_t async_rfd;		/**< The read side of the pipe used to send data from other threads to the main thread */
 	int async_wfd;				/**< The write side of the pipe used to send data from other threads to the main thread */
 
 	pthread_attr_t detached_thread;		/**< pthread_attr_t for creating detached threads */
 
+	pthread_t worker_threads[WORKER_THREADS]; /**< The worker threads */
+	pthread_mutex_t worker_mutex;		/**< Protects the worker queue */
+	pthread_cond_t worker_cond;		/**< Is signaled when jobs are added to the worker queue */
+	fastd_worker_job_t *worker_queue;	/**< The jobs waiting to be computed by the worker threads */
+	fastd_worker_job_t **worker_queue_tail;	/**< The \e next field of the last queued job */
+	bool worker_stop;			/**< Tells the worker threads to terminate */
+	size_t worker_pending;			/**< The number of jobs queued or being computed (only accessed by the main thread) */
+	uint64_t handshake_computations;	/**< The number of shared handshake keys computed by the worker threads */
+	uint64_t handshake_cpu_time;		/**< The CPU time used to compute shared handshake keys (in microseconds) */
+
 #ifdef __ANDROID__
 	int android_ctrl_sock_fd;		/**< The unix domain socket for communicating with Android GUI */
 #endif
@@ -340,11 +430,44 @@ struct fastd_context {
 
 	fastd_stats_t stats;			/**< Traffic statistics */
 
-	VECTOR(fastd_peer_eth_addr_t) eth_addrs; /**< Sorted vector of all known ethernet addresses with associated peers and timeouts */
+	uint32_t eth_addr_seed;			/**< The hash seed used for eth_addr_slots */
+	size_t eth_addr_size;			/**< The number of allocated entries in eth_addr_entries */
+	size_t eth_addr_used;			/**< The number of known ethernet addresses */
+	uint32_t eth_addr_free;			/**< The first unused entry of eth_addr_entries (0 if there is none) */
+	fastd_peer_eth_addr_t *eth_addr_entries; /**< The pool of ethernet address entries with associated peers and timeouts (entry 0 is never used) */
+	size_t eth_addr_slots_size;		/**< The number of slots in eth_addr_slots (a power of 2) */
+	uint32_t *eth_addr_slots;		/**< An open-addressing hashtable of indices into eth_addr_entries (0 marks empty slots) */
+	int64_t eth_addr_wheel_tick;		/**< The last expiry wheel tick that has been processed */
+	uint32_t eth_addr_wheel[ETH_ADDR_WHEEL_SLOTS]; /**< The expiry wheel; each slot is the head of a list of entries */
 
 	uint32_t unknown_handshake_seed;	/**< Hash seed for the unknown handshake hashtables */
 	fastd_handshake_timeout_t *unknown_handshakes[UNKNOWN_TABLES]; /**< Hash tables unknown addresses handshakes have been sent to */
 
+	fastd_timeout_t handshake_load_window;	/**< The start of the current handshake rate measurement interval */
+	size_t handshake_load_count;		/**< The number of handshakes received in the current measurement interval */
+	fastd_timeout_t handshake_load_timeout;	/**< Timeout until handshake cookies are required from initiators */
+	uint32_t handshake_cookie_secret[2][FASTD_HMACSHA256_KEY_WORDS]; /**< The current and previous secret handshake cookies are derived from */
+	fastd_timeout_t handshake_cookie_secret_timeout; /**< Timeout until the handshake cookie secret is changed */
+	uint32_t handshake_hash_seed;		/**< Hash seed for the handshake token buckets and received cookies */
+	fastd_handshake_bucket_t *handshake_buckets; /**< Hash table of handshake token buckets indexed by source prefix */
+	fastd_handshake_cookie_t *handshake_cookies; /**< Hash table of handshake cookies received from other peers */
+
+	fastd_handshake_pacer_queue_t handshake_pacer_queues[HANDSHAKE_PRIORITY_MAX]; /**< The handshakes waiting for the handshake pacer, by priority */
+	size_t handshake_pacer_queued;		/**< The total number of handshakes waiting for the handshake pacer */
+	unsigned handshake_pacer_tokens;	/**< The number of handshakes the handshake pacer may currently run without delay */
+	fastd_timeout_t handshake_pacer_refilled; /**< The last time tokens were added to the handshake pacer */
+	fastd_task_t handshake_pacer_task;	/**< Runs queued handshakes when new tokens become available */
+	uint64_t handshake_pacer_delayed;	/**< The number of handshakes that have been delayed by the handshake pacer */
+	uint64_t handshake_pacer_dropped;	/**< The number of handshakes that have been dropped by the handshake pacer */
+
+	uint64_t keepalives_sent;		/**< The number of keepalives that have been sent */
+	uint64_t keepalives_suppressed;		/**< The number of keepalives that have been postponed because payload was received from the peer */
+
+	uint64_t fanout_packets;		/**< The number of payload packets that have been sent to all peers */
+	uint64_t fanout_sends;			/**< The number of encrypted packets the fanned-out packets have resulted in */
+	uint64_t fanout_time;			/**< The total time spent encrypting and sending fanned-out packets (in ns) */
+	uint64_t forward_cut_through;		/**< The number of received packets that have been forwarded without writing them to the TAP interface */
+
 	fastd_protocol_state_t *protocol_state;	/**< Protocol-specific state */
 };
 
@@ -366,6 +489,7 @@ void fastd_send_data(fastd_buffer_t buffer, fastd_peer_t *source, fastd_peer_t *
 void fastd_receive_unknown_init(void);
 void fastd_receive_unknown_free(void);
 void fastd_receive(fastd_socket_t *sock);
+void fastd_receive_free(void);
 void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reordered);
 
 void fastd_close_all_fds(void);
@@ -560,6 +684,22 @@ static inline void fastd_timeout_advance(fastd_timeout_t *a, fastd_timeout_t v)
 		*a = v;
 }
 
+/**
+   Returns the slack for a task scheduled \e delay milliseconds in the future
+
+   The slack is limited to a quarter of the delay, so short timeouts are only
+   delayed a little.
+*/
+static inline int fastd_timer_slack(int64_t delay) {
+	if (delay <= 0)
+		return 0;
+
+	if (delay/4 < conf.timer_slack)
+		return delay/4;
+
+	return conf.timer_slack;
+}
+
 /** Updates the current time */
 static inline void fastd_update_time(void) {
 	struct timespec ts;
@@ -577,6 +717,11 @@ static inline bool fastd_allow_verify(void) {
 #endif
 }
 
+/** Returns true if fastd runs as a relay without a TAP interface */
+static inline bool fastd_relay_mode(void) {
+	return conf.mode == MODE_TAP && conf.tap_relay;
+}
+
 /** Returns true if android integration is enabled */
 static inline bool fastd_use_android_integration(void) {
 #ifdef __ANDROID__
@@ -0,0 +1,275 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Filtering of flooded payload packets in TAP mode
+*/
+
+
+#include "filter.h"
+
+
+/** The fields of a packet filter rules can match on */
+typedef struct filter_packet {
+	uint64_t dest;				/**< The destination MAC address (in the lower 48 bits) */
+	uint16_t ethertype;			/**< The EtherType */
+	int ip_proto;				/**< The IP protocol, or -1 if the packet is not an IP packet */
+	int port;				/**< The UDP or TCP destination port, or -1 if the packet doesn't have one */
+} filter_packet_t;
+
+
+/** Converts a MAC address to an integer */
+static inline uint64_t eth_addr_to_uint(fastd_eth_addr_t addr) {
+	uint64_t ret = 0;
+
+	size_t i;
+	for (i = 0; i < sizeof(addr.data); i++)
+		ret = (ret << 8) | addr.data[i];
+
+	return ret;
+}
+
+/** Reads a 16-bit big endian value from a buffer */
+static inline uint16_t read_u16(const uint8_t *data) {
+	return (data[0] << 8) | data[1];
+}
+
+/** Returns the offset of the upper-layer header of an IPv4 packet, or 0 if there is none (or the packet is a non-initial fragment) */
+static size_t parse_ipv4(const uint8_t *data, size_t len, filter_packet_t *packet) {
+	if (len < 20 || (data[0] >> 4) != 4)
+		return 0;
+
+	size_t hdrlen = 4 * (data[0] & 0x0f);
+	if (hdrlen < 20)
+		return 0;
+
+	packet->ip_proto = data[9];
+
+	if (read_u16(data + 6) & 0x1fff)
+		return 0;
+
+	return hdrlen;
+}
+
+/** Returns the offset of the upper-layer header of an IPv6 packet, or 0 if there is none (or the packet is a non-initial fragment) */
+static size_t parse_ipv6(const uint8_t *data, size_t len, filter_packet_t *packet) {
+	if (len < 40 || (data[0] >> 4) != 6)
+		return 0;
+
+	uint8_t next = data[6];
+	size_t offset = 40;
+
+	size_t i;
+	for (i = 0; i < 4; i++) {
+		switch (next) {
+		case 0:		/* Hop-by-Hop Options */
+		case 43:	/* Routing */
+		case 60:	/* Destination Options */
+			if (offset + 8 > len)
+				return 0;
+
+			next = data[offset];
+			offset += 8 * (data[offset+1] + 1);
+			continue;
+
+		case 44:	/* Fragment */
+			if (offset + 8 > len)
+				return 0;
+
+			next = data[offset];
+
+			if (read_u16(data + offset + 2) & 0xfff8) {
+				packet->ip_proto = next;
+				return 0;
+			}
+
+			offset += 8;
+			continue;
+		}
+
+		break;
+	}
+
+	packet->ip_proto = next;
+	return offset;
+}
+
+/** Extracts the fields needed by the configured rules from a packet */
+static void parse_packet(const fastd_buffer_t buffer, filter_packet_t *packet) {
+	const uint8_t *data = buffer.data;
+	size_t len = buffer.len;
+
+	*packet = (filter_packet_t){
+		.dest = eth_addr_to_uint(fastd_buffer_dest_address(buffer)),
+		.ethertype = read_u16(data + offsetof(fastd_eth_header_t, proto)),
+		.ip_proto = -1,
+		.port = -1,
+	};
+
+	size_t offset = sizeof(fastd_eth_header_t);
+
+	if ((packet->ethertype == 0x8100 || packet->ethertype == 0x88a8) && len >= offset + 4) {
+		packet->ethertype = read_u16(data + offset + 2);
+		offset += 4;
+	}
+
+	if (!(ctx.filter_match & (FILTER_MATCH_IP_PROTO|FILTER_MATCH_PORT)))
+		return;
+
+	size_t l4;
+
+	switch (packet->ethertype) {
+	case 0x0800:
+		l4 = parse_ipv4(data + offset, len - offset, packet);
+		break;
+
+	case 0x86dd:
+		l4 = parse_ipv6(data + offset, len - offset, packet);
+		break;
+
+	default:
+		return;
+	}
+
+	if (!l4)
+		return;
+
+	offset += l4;
+
+	if ((packet->ip_proto == IPPROTO_UDP || packet->ip_proto == IPPROTO_TCP) && len >= offset + 4)
+		packet->port = read_u16(data + offset + 2);
+}
+
+/** Checks if a packet matches a rule */
+static inline bool filter_matches(const fastd_filter_t *filter, const filter_packet_t *packet) {
+	if ((filter->match & FILTER_MATCH_ETHERTYPE) && packet->ethertype != filter->ethertype)
+		return false;
+
+	if ((filter->match & FILTER_MATCH_DEST) && (packet->dest & filter->dest_mask) != filter->dest)
+		return false;
+
+	if ((filter->match & FILTER_MATCH_IP_PROTO) && packet->ip_proto != filter->ip_proto)
+		return false;
+
+	if ((filter->match & FILTER_MATCH_PORT) && packet->port != filter->port)
+		return false;
+
+	return true;
+}
+
+/** Takes a token from the token bucket of a FILTER_LIMIT rule, returns false if the bucket is empty */
+static bool take_token(fastd_filter_t *filter) {
+	int64_t tokens = (ctx.now - filter->refilled) * filter->limit / 1000;
+
+	if (filter->tokens + tokens >= filter->limit) {
+		filter->refilled = ctx.now;
+		filter->tokens = filter->limit;
+	}
+	else if (tokens > 0) {
+		filter->refilled += tokens * 1000 / filter->limit;
+		filter->tokens += tokens;
+	}
+
+	if (!filter->tokens)
+		return false;
+
+	filter->tokens--;
+	return true;
+}
+
+
+/** Compiles the configured filter rules */
+void fastd_filter_init(void) {
+	const fastd_filter_rule_t *rule;
+
+	ctx.n_filters = 0;
+	for (rule = conf.filter_rules; rule; rule = rule->next)
+		ctx.n_filters++;
+
+	if (!ctx.n_filters)
+		return;
+
+	ctx.filters = fastd_new0_array(ctx.n_filters, fastd_filter_t);
+	ctx.filter_match = 0;
+
+	fastd_filter_t *filter = ctx.filters;
+	for (rule = conf.filter_rules; rule; rule = rule->next, filter++) {
+		filter->match = rule->match;
+		filter->dest_mask = eth_addr_to_uint(rule->dest_mask);
+		filter->dest = eth_addr_to_uint(rule->dest) & filter->dest_mask;
+		filter->ethertype = rule->ethertype;
+		filter->ip_proto = rule->ip_proto;
+		filter->port = rule->port;
+
+		filter->action = rule->action;
+		filter->limit = rule->limit;
+		filter->tokens = rule->limit;
+		filter->refilled = ctx.now;
+
+		ctx.filter_match |= rule->match;
+	}
+}
+
+/** Frees the compiled filter rules */
+void fastd_filter_free(void) {
+	free(ctx.filters);
+	ctx.filters = NULL;
+	ctx.n_filters = 0;
+}
+
+/** Checks a packet against the filter rules, returns false if the packet must be dropped */
+bool fastd_filter_packet(const fastd_buffer_t buffer) {
+	filter_packet_t packet;
+	parse_packet(buffer, &packet);
+
+	size_t i;
+	for (i = 0; i < ctx.n_filters; i++) {
+		fastd_filter_t *filter = &ctx.filters[i];
+
+		if (!filter_matches(filter, &packet))
+			continue;
+
+		filter->hits++;
+
+		switch (filter->action) {
+		case FILTER_PASS:
+			return true;
+
+		case FILTER_LIMIT:
+			if (take_token(filter))
+				return true;
+
+			/* fall-through */
+
+		case FILTER_DROP:
+			filter->dropped++;
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,104 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Filtering of flooded payload packets in TAP mode
+
+   The configured filter rules are compiled into an array when fastd starts. Every
+   packet that would be sent to all peers (multicast and broadcast packets as well
+   as unicast packets to unknown destinations) is checked against the rules in
+   order; the first matching rule decides if the packet is dropped, passed, or
+   passed subject to a rate limit. Packets not matching any rule are passed.
+*/
+
+#pragma once
+
+#include "fastd.h"
+
+
+/** The action of a filter rule */
+typedef enum fastd_filter_action {
+	FILTER_PASS,			/**< Matching packets are sent to all peers */
+	FILTER_DROP,			/**< Matching packets are dropped */
+	FILTER_LIMIT,			/**< Matching packets are sent to all peers up to a given rate, excess packets are dropped */
+} fastd_filter_action_t;
+
+/** The fields a filter rule matches on */
+typedef enum fastd_filter_match {
+	FILTER_MATCH_ETHERTYPE = (1 << 0),	/**< The EtherType (after a VLAN tag, if any) */
+	FILTER_MATCH_DEST = (1 << 1),		/**< The (masked) destination MAC address */
+	FILTER_MATCH_IP_PROTO = (1 << 2),	/**< The IPv4 protocol or IPv6 upper-layer header */
+	FILTER_MATCH_PORT = (1 << 3),		/**< The UDP or TCP destination port */
+} fastd_filter_match_t;
+
+/** A filter rule as given in the configuration */
+struct fastd_filter_rule {
+	fastd_filter_rule_t *next;		/**< The next rule */
+
+	fastd_filter_action_t action;		/**< The action taken for matching packets */
+	unsigned limit;				/**< The maximum number of packets per second passed by a FILTER_LIMIT rule */
+
+	unsigned match;				/**< The fields the rule matches on (a combination of fastd_filter_match_t values) */
+	uint16_t ethertype;			/**< The EtherType to match */
+	fastd_eth_addr_t dest;			/**< The destination MAC address to match */
+	fastd_eth_addr_t dest_mask;		/**< The bits of the destination MAC address to compare */
+	uint8_t ip_proto;			/**< The IP protocol to match */
+	uint16_t port;				/**< The UDP or TCP destination port to match */
+};
+
+/** A compiled filter rule with its rate limit state and counters */
+struct fastd_filter {
+	unsigned match;				/**< The fields the rule matches on (a combination of fastd_filter_match_t values) */
+	uint64_t dest;				/**< The masked destination MAC address to match (in the lower 48 bits) */
+	uint64_t dest_mask;			/**< The mask applied to destination MAC addresses */
+	uint16_t ethertype;			/**< The EtherType to match */
+	uint8_t ip_proto;			/**< The IP protocol to match */
+	uint16_t port;				/**< The UDP or TCP destination port to match */
+
+	fastd_filter_action_t action;		/**< The action taken for matching packets */
+	unsigned limit;				/**< The maximum number of packets per second passed by a FILTER_LIMIT rule */
+	unsigned tokens;			/**< The number of packets a FILTER_LIMIT rule may currently pass */
+	fastd_timeout_t refilled;		/**< The last time tokens were added */
+
+	uint64_t hits;				/**< The number of packets that have matched the rule */
+	uint64_t dropped;			/**< The number of matching packets that have been dropped */
+};
+
+
+void fastd_filter_init(void);
+void fastd_filter_free(void);
+
+bool fastd_filter_packet(const fastd_buffer_t buffer);
+
+
+/** Checks if a packet may be sent to all peers */
+static inline bool fastd_filter_flood(const fastd_buffer_t buffer) {
+	if (!ctx.n_filters)
+		return true;
+
+	return fastd_filter_packet(buffer);
+}
@@ -31,9 +31,12 @@
 
 
 #include "handshake.h"
+#include "crypto.h"
+#include "hash.h"
 #include "method.h"
 #include "peer.h"
 #include "peer_group.h"
+#include "peer_hashtable.h"
 #include <generated/version.h>
 
 
@@ -55,6 +58,7 @@ static const char *const RECORD_TYPES[RECORD_MAX] = {
 	"version name",
 	"method list",
 	"TLV message authentication code",
+	"cookie",
 };
 
 
@@ -223,9 +227,57 @@ static fastd_handshake_buffer_t new_handshake(uint8_t type, bool little_endian,
 	return buffer;
 }
 
+/** Initializes the handshake cookie state and the handshake token buckets */
+void fastd_handshake_init(void) {
+	ctx.handshake_load_window = ctx.now;
+	ctx.handshake_load_timeout = ctx.now;
+
+	fastd_random_bytes(ctx.handshake_cookie_secret, sizeof(ctx.handshake_cookie_secret), false);
+	ctx.handshake_cookie_secret_timeout = ctx.now + HANDSHAKE_COOKIE_SECRET_LIFETIME;
+
+	fastd_random_bytes(&ctx.handshake_hash_seed, sizeof(ctx.handshake_hash_seed), false);
+
+	ctx.handshake_buckets = fastd_new0_array(HANDSHAKE_BUCKETS, fastd_handshake_bucket_t);
+	ctx.handshake_cookies = fastd_new0_array(HANDSHAKE_COOKIES, fastd_handshake_cookie_t);
+}
+
+/** Frees the handshake cookie state and the handshake token buckets */
+void fastd_handshake_free(void) {
+	secure_memzero(ctx.handshake_cookie_secret, sizeof(ctx.handshake_cookie_secret));
+
+	free(ctx.handshake_buckets);
+	free(ctx.handshake_cookies);
+}
+
+/** Returns the entry of the received cookie hash table for a given address */
+static inline fastd_handshake_cookie_t * cookie_entry(const fastd_peer_address_t *addr) {
+	uint32_t hash = ctx.handshake_hash_seed;
+	fastd_peer_address_hash(&hash, addr);
+	fastd_hash_final(&hash);
+
+	return &ctx.handshake_cookies[hash % HANDSHAKE_COOKIES];
+}
+
+/** Checks if a cookie table entry contains a cookie for the given address that can still be used */
+static inline bool has_valid_cookie(const fastd_handshake_cookie_t *cookie, const fastd_peer_address_t *addr) {
+	return !fastd_timed_out(cookie->timeout) && fastd_peer_address_equal(&cookie->address, addr);
+}
+
 /** Allocates and initializes a new initial handshake packet */
-fastd_handshake_buffer_t fastd_handshake_new_init(size_t tail_space) {
-	return new_handshake(1, true, 0, NULL, conf.secure_handshakes ? NULL : conf.peer_group->methods, tail_space);
+fastd_handshake_buffer_t fastd_handshake_new_init(const fastd_peer_address_t *remote_addr, size_t tail_space) {
+	fastd_handshake_cookie_t *cookie = cookie_entry(remote_addr);
+	bool send_cookie = has_valid_cookie(cookie, remote_addr);
+
+	cookie->init_address = *remote_addr;
+	cookie->init_timeout = ctx.now + HANDSHAKE_COOKIE_REPLY_TIMEOUT;
+
+	fastd_handshake_buffer_t buffer = new_handshake(1, true, 0, NULL, conf.secure_handshakes ? NULL : conf.peer_group->methods,
+							tail_space + (send_cookie ? 4+HANDSHAKE_COOKIE_BYTES : 0));
+
+	if (send_cookie)
+		fastd_handshake_add(&buffer, RECORD_COOKIE, HANDSHAKE_COOKIE_BYTES, cookie->cookie);
+
+	return buffer;
 }
 
 /** Allocates and initializes a new reply handshake packet */
@@ -302,6 +354,233 @@ void fastd_handshake_send_error(fastd_socket_t *sock, const fastd_peer_address_t
 	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
 }
 
+/** Changes the secret handshake cookies are derived from when it has expired */
+static void update_cookie_secret(void) {
+	if (!fastd_timed_out(ctx.handshake_cookie_secret_timeout))
+		return;
+
+	memcpy(ctx.handshake_cookie_secret[1], ctx.handshake_cookie_secret[0], sizeof(ctx.handshake_cookie_secret[0]));
+	fastd_random_bytes(ctx.handshake_cookie_secret[0], sizeof(ctx.handshake_cookie_secret[0]), false);
+
+	ctx.handshake_cookie_secret_timeout = ctx.now + HANDSHAKE_COOKIE_SECRET_LIFETIME;
+}
+
+/** Derives the handshake cookie for an address from a secret */
+static void make_cookie(uint8_t cookie[HANDSHAKE_COOKIE_BYTES], const uint32_t secret[FASTD_HMACSHA256_KEY_WORDS], const fastd_peer_address_t *addr) {
+	uint32_t data[FASTD_SHA256_BLOCK_WORDS] = {};
+	uint8_t *ptr = (uint8_t *)data;
+	size_t len;
+
+	switch (addr->sa.sa_family) {
+	case AF_INET:
+		memcpy(ptr, &addr->in.sin_port, 2);
+		memcpy(ptr+2, &addr->in.sin_addr, 4);
+		len = 6;
+		break;
+
+	case AF_INET6:
+		memcpy(ptr, &addr->in6.sin6_port, 2);
+		memcpy(ptr+2, &addr->in6.sin6_addr, 16);
+		len = 18;
+		break;
+
+	default:
+		exit_bug("make_cookie: unknown address family");
+	}
+
+	fastd_sha256_t hmac;
+	fastd_hmacsha256(&hmac, secret, data, len);
+	memcpy(cookie, hmac.b, HANDSHAKE_COOKIE_BYTES);
+}
+
+/** Checks if a handshake contains a valid cookie for the address it was received from */
+static bool verify_cookie(const fastd_peer_address_t *remote_addr, const fastd_handshake_t *handshake) {
+	if (handshake->records[RECORD_COOKIE].length != HANDSHAKE_COOKIE_BYTES)
+		return false;
+
+	size_t i;
+	for (i = 0; i < 2; i++) {
+		uint8_t cookie[HANDSHAKE_COOKIE_BYTES];
+		make_cookie(cookie, ctx.handshake_cookie_secret[i], remote_addr);
+
+		if (secure_memequal(cookie, handshake->records[RECORD_COOKIE].data, HANDSHAKE_COOKIE_BYTES))
+			return true;
+	}
+
+	return false;
+}
+
+/** Replies to an initial handshake with a cookie the initiator must repeat the handshake with */
+static void send_cookie(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const fastd_handshake_t *handshake) {
+	pr_debug("sending handshake cookie to %I", remote_addr);
+
+	fastd_handshake_buffer_t buffer = {
+		.buffer = fastd_buffer_alloc(sizeof(fastd_handshake_packet_t), 0, 2*5 + 4+HANDSHAKE_COOKIE_BYTES /* handshake type, reply code and cookie */),
+		.little_endian = handshake->little_endian
+	};
+	fastd_handshake_packet_t *reply = buffer.buffer.data;
+
+	reply->rsv = 0;
+	reply->tlv_len = 0;
+
+	fastd_handshake_add_uint8(&buffer, RECORD_HANDSHAKE_TYPE, handshake->type+1);
+	fastd_handshake_add_uint8(&buffer, RECORD_REPLY_CODE, REPLY_COOKIE);
+	make_cookie(fastd_handshake_extend(&buffer, RECORD_COOKIE, HANDSHAKE_COOKIE_BYTES), ctx.handshake_cookie_secret[0], remote_addr);
+
+	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
+}
+
+/**
+   Stores a cookie received from a peer and repeats the handshake with it
+
+   Cookie replies aren't authenticated, so they are only accepted in response to an initial handshake
+   that is still in flight to the sending address, and a cookie that is still valid is never replaced.
+   Otherwise, anyone able to spoof the address of a peer could keep replacing the peer's cookie.
+*/
+static void handle_cookie(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const fastd_handshake_t *handshake) {
+	if (!peer) {
+		pr_debug("ignoring handshake cookie from unknown address %I", remote_addr);
+		return;
+	}
+
+	if (handshake->type != 2 || handshake->records[RECORD_COOKIE].length != HANDSHAKE_COOKIE_BYTES) {
+		pr_debug("received invalid handshake cookie from %P[%I]", peer, remote_addr);
+		return;
+	}
+
+	fastd_handshake_cookie_t *cookie = cookie_entry(remote_addr);
+	if (fastd_timed_out(cookie->init_timeout) || !fastd_peer_address_equal(&cookie->init_address, remote_addr)) {
+		pr_debug("ignoring unsolicited handshake cookie from %P[%I]", peer, remote_addr);
+		return;
+	}
+
+	if (has_valid_cookie(cookie, remote_addr)) {
+		pr_debug("ignoring handshake cookie from %P[%I] (already have a valid cookie)", peer, remote_addr);
+		return;
+	}
+
+	if (fastd_peer_address_equal(&cookie->address, remote_addr) && !fastd_timed_out(cookie->retry_timeout)) {
+		pr_debug("ignoring repeated handshake cookie from %P[%I]", peer, remote_addr);
+		return;
+	}
+
+	cookie->init_timeout = ctx.now;
+
+	cookie->address = *remote_addr;
+	cookie->timeout = ctx.now + HANDSHAKE_COOKIE_SECRET_LIFETIME;
+	cookie->retry_timeout = ctx.now + HANDSHAKE_COOKIE_RETRY_INTERVAL;
+	memcpy(cookie->cookie, handshake->records[RECORD_COOKIE].data, HANDSHAKE_COOKIE_BYTES);
+
+	pr_verbose("%P[%I] requires a handshake cookie, repeating handshake", peer, remote_addr);
+	conf.protocol->handshake_init(sock, local_addr, remote_addr, peer);
+}
+
+/** Returns the source prefix handshakes from an address are accounted to */
+static fastd_peer_address_t get_bucket_prefix(const fastd_peer_address_t *addr) {
+	fastd_peer_address_t prefix = {};
+	prefix.sa.sa_family = addr->sa.sa_family;
+
+	switch (addr->sa.sa_family) {
+	case AF_INET:
+		prefix.in.sin_addr.s_addr = addr->in.sin_addr.s_addr & htonl(0xffffffffu << (32 - HANDSHAKE_BUCKET_PREFIX4));
+		break;
+
+	case AF_INET6: {
+		size_t i;
+		for (i = 0; i < 16; i++) {
+			unsigned bits = 0;
+			if (8*i < HANDSHAKE_BUCKET_PREFIX6)
+				bits = min_size_t(HANDSHAKE_BUCKET_PREFIX6 - 8*i, 8);
+
+			prefix.in6.sin6_addr.s6_addr[i] = addr->in6.sin6_addr.s6_addr[i] & (uint8_t)(0xff00 >> bits);
+		}
+
+		if (IN6_IS_ADDR_LINKLOCAL(&addr->in6.sin6_addr))
+			prefix.in6.sin6_scope_id = addr->in6.sin6_scope_id;
+
+		break;
+	}
+
+	default:
+		exit_bug("get_bucket_prefix: unknown address family");
+	}
+
+	return prefix;
+}
+
+/** Takes a token from the token bucket of the source prefix of an address, returns false if the bucket is empty */
+static bool take_bucket_token(const fastd_peer_address_t *addr) {
+	fastd_peer_address_t prefix = get_bucket_prefix(addr);
+
+	uint32_t hash = ctx.handshake_hash_seed;
+	fastd_peer_address_hash(&hash, &prefix);
+	fastd_hash_final(&hash);
+
+	fastd_handshake_bucket_t *bucket = &ctx.handshake_buckets[hash % HANDSHAKE_BUCKETS];
+
+	if (!fastd_peer_address_equal(&bucket->prefix, &prefix)) {
+		bucket->prefix = prefix;
+		bucket->refilled = ctx.now;
+		bucket->tokens = HANDSHAKE_BUCKET_BURST;
+	}
+	else {
+		int64_t tokens = (ctx.now - bucket->refilled) * HANDSHAKE_BUCKET_RATE / 1000;
+
+		if (bucket->tokens + tokens >= HANDSHAKE_BUCKET_BURST) {
+			bucket->refilled = ctx.now;
+			bucket->tokens = HANDSHAKE_BUCKET_BURST;
+		}
+		else if (tokens > 0) {
+			bucket->refilled += tokens * 1000 / HANDSHAKE_BUCKET_RATE;
+			bucket->tokens += tokens;
+		}
+	}
+
+	if (!bucket->tokens)
+		return false;
+
+	bucket->tokens--;
+	return true;
+}
+
+/**
+   Measures the handshake rate and decides if a received handshake may be handled
+
+   When the handshake rate exceeds HANDSHAKE_LOAD_THRESHOLD, initial handshakes are
+   rate-limited per source prefix and only handled when they contain a valid cookie;
+   other initiators get a cookie reply instead, which can be generated without
+   any public-key operations.
+*/
+static bool check_load(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const fastd_handshake_t *handshake) {
+	if (ctx.now - ctx.handshake_load_window >= 1000) {
+		ctx.handshake_load_window = ctx.now;
+		ctx.handshake_load_count = 0;
+	}
+
+	if (++ctx.handshake_load_count > HANDSHAKE_LOAD_THRESHOLD) {
+		if (fastd_timed_out(ctx.handshake_load_timeout))
+			pr_warn("more than %u handshakes per second received, requiring handshake cookies", (unsigned)HANDSHAKE_LOAD_THRESHOLD);
+
+		ctx.handshake_load_timeout = ctx.now + HANDSHAKE_LOAD_HOLD;
+	}
+
+	if (fastd_timed_out(ctx.handshake_load_timeout) || handshake->type != 1)
+		return true;
+
+	if (!take_bucket_token(remote_addr)) {
+		pr_debug("ignoring handshake from %I (handshake rate limit exceeded)", remote_addr);
+		return false;
+	}
+
+	update_cookie_secret();
+
+	if (verify_cookie(remote_addr, handshake))
+		return true;
+
+	send_cookie(sock, local_addr, remote_addr, peer, handshake);
+	return false;
+}
+
 /** Parses the TLV records of a handshake */
 static inline fastd_handshake_t parse_tlvs(const fastd_buffer_t *buffer) {
 	fastd_handshake_t handshake = {};
@@ -390,6 +669,11 @@ static inline bool check_records(fastd_socket_t *sock, const fastd_peer_address_
 			return false;
 		}
 
+		if (as_uint8(&handshake->records[RECORD_REPLY_CODE]) == REPLY_COOKIE) {
+			handle_cookie(sock, local_addr, remote_addr, peer, handshake);
+			return false;
+		}
+
 		if (as_uint8(&handshake->records[RECORD_REPLY_CODE]) != REPLY_SUCCESS) {
 			print_error_reply(peer, remote_addr, handshake);
 			return false;
@@ -453,8 +737,8 @@ const fastd_method_info_t * fastd_handshake_get_method(const fastd_peer_t *peer,
 	return get_method_by_name(methods, (const char *)handshake->records[RECORD_METHOD_NAME].data, handshake->records[RECORD_METHOD_NAME].length);
 }
 
-/** Handles a handshake packet */
-void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer) {
+/** Handles a handshake packet, optionally skipping the load checks */
+static void handle_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer, bool resumed) {
 	char *peer_version = NULL;
 
 	fastd_handshake_t handshake = parse_tlvs(&buffer);
@@ -471,6 +755,9 @@ void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *lo
 
 	handshake.type = as_uint8(&handshake.records[RECORD_HANDSHAKE_TYPE]);
 
+	if (!resumed && !check_load(sock, local_addr, remote_addr, peer, &handshake))
+		goto end_free;
+
 	if (!check_records(sock, local_addr, remote_addr, peer, &handshake))
 		goto end_free;
 
@@ -485,3 +772,13 @@ void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *lo
 	free(peer_version);
 	fastd_buffer_free(buffer);
 }
+
+/** Handles a handshake packet */
+void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer) {
+	handle_handshake(sock, local_addr, remote_addr, peer, buffer, false);
+}
+
+/** Handles a handshake packet again after its processing has been deferred (the load checks have already been passed) */
+void fastd_handshake_resume(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer) {
+	handle_handshake(sock, local_addr, remote_addr, peer, buffer, true);
+}
@@ -57,6 +57,7 @@ typedef enum fastd_handshake_record_type {
 	RECORD_VERSION_NAME,		/**< The fastd version */
 	RECORD_METHOD_LIST,		/**< Zero-separated list of supported methods */
 	RECORD_TLV_MAC,			/**< Message authentication code of the TLV records */
+	RECORD_COOKIE,			/**< Handshake cookie proving ownership of the sender address */
 	RECORD_MAX,			/**< (Number of defined record types) */
 } fastd_handshake_record_type_t;
 
@@ -65,6 +66,7 @@ typedef enum fastd_reply_code {
 	REPLY_SUCCESS = 0,		/**< The handshake was sucessfull */
 	REPLY_MANDATORY_MISSING,	/**< A required TLV field is missing */
 	REPLY_UNACCEPTABLE_VALUE,	/**< A TLV field has an invalid value */
+	REPLY_COOKIE,			/**< The handshake must be repeated with the given cookie */
 	REPLY_MAX,			/**< (Number of defined reply codes */
 } fastd_reply_code_t;
 
@@ -99,13 +101,17 @@ struct fastd_handshake_buffer {
 };
 
 
-fastd_handshake_buffer_t fastd_handshake_new_init(size_t tail_space);
+void fastd_handshake_init(void);
+void fastd_handshake_free(void);
+
+fastd_handshake_buffer_t fastd_handshake_new_init(const fastd_peer_address_t *remote_addr, size_t tail_space);
 fastd_handshake_buffer_t fastd_handshake_new_reply(uint8_t type, bool little_endian, uint16_t mtu, const fastd_method_info_t *method, const fastd_string_stack_t *methods, size_t tail_space);
 
 void fastd_handshake_send_error(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const fastd_handshake_t *handshake, uint8_t reply_code, uint16_t error_detail);
 bool fastd_handshake_check_mtu(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const fastd_handshake_t *handshake);
 const fastd_method_info_t * fastd_handshake_get_method(const fastd_peer_t *peer, const fastd_handshake_t *handshake);
 void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer);
+void fastd_handshake_resume(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer);
 
 
 /** Returns the TLV data of a handshake packet in a given buffer */
@@ -0,0 +1,224 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Handshake pacing
+
+   The pacer is a token bucket refilled with \e conf.handshake_limit tokens per
+   second, holding up to one second's worth of tokens. Handshakes that find the
+   bucket empty are queued and run from a task as tokens become available,
+   always taking the highest priority queue first. When the queue is full, the
+   newest entry of the lowest priority is dropped.
+*/
+
+
+#include "handshake_pacer.h"
+#include "fastd.h"
+
+
+/** Adds the tokens that have accumulated since the last refill */
+static void refill(void) {
+	int64_t tokens = (ctx.now - ctx.handshake_pacer_refilled) * conf.handshake_limit / 1000;
+
+	if (ctx.handshake_pacer_tokens + tokens >= conf.handshake_limit) {
+		ctx.handshake_pacer_refilled = ctx.now;
+		ctx.handshake_pacer_tokens = conf.handshake_limit;
+	}
+	else if (tokens > 0) {
+		ctx.handshake_pacer_refilled += tokens * 1000 / conf.handshake_limit;
+		ctx.handshake_pacer_tokens += tokens;
+	}
+}
+
+/** Schedules the pacer task for the time the next token becomes available */
+static void schedule(void) {
+	if (fastd_task_scheduled(&ctx.handshake_pacer_task))
+		return;
+
+	fastd_timeout_t timeout = ctx.handshake_pacer_refilled + (1000 + conf.handshake_limit - 1) / conf.handshake_limit;
+	fastd_task_schedule(&ctx.handshake_pacer_task, TASK_TYPE_HANDSHAKE_PACER, timeout, 0);
+}
+
+/** Appends an entry to the queue of its priority */
+static void enqueue(fastd_handshake_pacer_entry_t *entry) {
+	fastd_handshake_pacer_queue_t *queue = &ctx.handshake_pacer_queues[entry->priority];
+
+	entry->prev = queue->tail;
+	entry->next = NULL;
+	entry->queued = true;
+
+	if (queue->tail)
+		queue->tail->next = entry;
+	else
+		queue->head = entry;
+
+	queue->tail = entry;
+	queue->len++;
+	ctx.handshake_pacer_queued++;
+}
+
+/** Removes an entry from its queue */
+static void dequeue(fastd_handshake_pacer_entry_t *entry) {
+	fastd_handshake_pacer_queue_t *queue = &ctx.handshake_pacer_queues[entry->priority];
+
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		queue->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		queue->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+	entry->queued = false;
+
+	queue->len--;
+	ctx.handshake_pacer_queued--;
+}
+
+/** Drops an entry that can't be run */
+static void drop(fastd_handshake_pacer_entry_t *entry) {
+	ctx.handshake_pacer_dropped++;
+	entry->drop(entry);
+}
+
+/** Runs an entry, consuming a token */
+static void run(fastd_handshake_pacer_entry_t *entry) {
+	if (conf.handshake_limit)
+		ctx.handshake_pacer_tokens--;
+
+	entry->run(entry);
+}
+
+/**
+   Makes room in the queue for an entry of the given priority
+
+   \return false if all queued entries have the same or a higher priority
+*/
+static bool make_room(fastd_handshake_priority_t priority) {
+	if (ctx.handshake_pacer_queued < HANDSHAKE_PACER_QUEUE_LIMIT)
+		return true;
+
+	int i;
+	for (i = HANDSHAKE_PRIORITY_MAX-1; i > (int)priority; i--) {
+		fastd_handshake_pacer_entry_t *victim = ctx.handshake_pacer_queues[i].tail;
+		if (!victim)
+			continue;
+
+		dequeue(victim);
+		drop(victim);
+		return true;
+	}
+
+	return false;
+}
+
+
+/** Initializes the handshake pacer */
+void fastd_handshake_pacer_init(void) {
+	ctx.handshake_pacer_refilled = ctx.now;
+	ctx.handshake_pacer_tokens = conf.handshake_limit;
+}
+
+/** Drops all queued handshakes */
+void fastd_handshake_pacer_free(void) {
+	int i;
+	for (i = 0; i < HANDSHAKE_PRIORITY_MAX; i++) {
+		fastd_handshake_pacer_entry_t *entry;
+		while ((entry = ctx.handshake_pacer_queues[i].head)) {
+			dequeue(entry);
+			entry->drop(entry);
+		}
+	}
+
+	fastd_task_unschedule(&ctx.handshake_pacer_task);
+}
+
+/**
+   Runs a handshake if the handshake limit permits it, or queues it otherwise
+
+   The entry's priority, timeout and callbacks must be set. Submitting an entry
+   that is already queued has no effect.
+*/
+void fastd_handshake_pacer_submit(fastd_handshake_pacer_entry_t *entry) {
+	if (entry->queued)
+		return;
+
+	if (!conf.handshake_limit) {
+		run(entry);
+		return;
+	}
+
+	refill();
+
+	if (!ctx.handshake_pacer_queued && ctx.handshake_pacer_tokens) {
+		run(entry);
+		return;
+	}
+
+	if (!make_room(entry->priority)) {
+		drop(entry);
+		return;
+	}
+
+	ctx.handshake_pacer_delayed++;
+	enqueue(entry);
+	schedule();
+}
+
+/** Removes a handshake from the queue without running it */
+void fastd_handshake_pacer_cancel(fastd_handshake_pacer_entry_t *entry) {
+	if (entry->queued)
+		dequeue(entry);
+}
+
+/** Runs queued handshakes as permitted by the handshake limit */
+void fastd_handshake_pacer_handle_task(void) {
+	refill();
+
+	int i = 0;
+	while (ctx.handshake_pacer_tokens && ctx.handshake_pacer_queued) {
+		while (!ctx.handshake_pacer_queues[i].head)
+			i++;
+
+		fastd_handshake_pacer_entry_t *entry = ctx.handshake_pacer_queues[i].head;
+		dequeue(entry);
+
+		if (fastd_timed_out(entry->timeout))
+			drop(entry);
+		else
+			run(entry);
+
+		/* running an entry may have queued new ones */
+		i = 0;
+	}
+
+	if (ctx.handshake_pacer_queued)
+		schedule();
+}
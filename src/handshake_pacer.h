@@ -0,0 +1,77 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Handshake pacing
+
+   The handshake pacer limits the number of handshakes initiated and the number
+   of received handshakes processed per second. Handshakes exceeding the limit
+   are queued by priority, so refreshes of established sessions aren't delayed
+   by a burst of new connections (for example after a restart).
+*/
+
+#pragma once
+
+#include "types.h"
+
+
+/** A handshake waiting for the handshake pacer */
+struct fastd_handshake_pacer_entry {
+	fastd_handshake_pacer_entry_t *prev;		/**< The previous entry in the queue */
+	fastd_handshake_pacer_entry_t *next;		/**< The next entry in the queue */
+	bool queued;					/**< true if the entry is currently queued */
+
+	fastd_handshake_priority_t priority;		/**< The priority of the handshake */
+	fastd_timeout_t timeout;			/**< The entry is dropped if it can't be run before this timeout */
+
+	/** Performs the handshake; the entry has been removed from the queue when it is called */
+	void (*run)(fastd_handshake_pacer_entry_t *entry);
+
+	/** Is called instead of run when the entry is dropped from the queue */
+	void (*drop)(fastd_handshake_pacer_entry_t *entry);
+};
+
+/** A queue of handshakes with the same priority */
+struct fastd_handshake_pacer_queue {
+	fastd_handshake_pacer_entry_t *head;		/**< The first entry of the queue */
+	fastd_handshake_pacer_entry_t *tail;		/**< The last entry of the queue */
+	size_t len;					/**< The number of entries in the queue */
+};
+
+
+void fastd_handshake_pacer_init(void);
+void fastd_handshake_pacer_free(void);
+
+void fastd_handshake_pacer_submit(fastd_handshake_pacer_entry_t *entry);
+void fastd_handshake_pacer_cancel(fastd_handshake_pacer_entry_t *entry);
+void fastd_handshake_pacer_handle_task(void);
+
+
+/** Checks if a handshake is waiting in the handshake pacer queue */
+static inline bool fastd_handshake_pacer_queued(const fastd_handshake_pacer_entry_t *entry) {
+	return entry->queued;
+}
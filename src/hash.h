@@ -55,3 +55,68 @@ static inline void fastd_hash_final(uint32_t *hash) {
 	*hash ^= (*hash >> 11);
 	*hash += (*hash << 15);
 }
+
+
+/** Left-rotation of a 64bit value */
+static inline uint64_t fastd_hash_rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64-r));
+}
+
+/** Reads up to 8 bytes as a little-endian integer */
+static inline uint64_t fastd_hash_load_le64(const uint8_t *p, size_t len) {
+	uint64_t v = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		v |= (uint64_t)p[i] << (8*i);
+
+	return v;
+}
+
+/** A single SipHash round */
+#define FASTD_SIPROUND(v0, v1, v2, v3) do {						\
+		v0 += v1; v1 = fastd_hash_rotl64(v1, 13); v1 ^= v0; v0 = fastd_hash_rotl64(v0, 32); \
+		v2 += v3; v3 = fastd_hash_rotl64(v3, 16); v3 ^= v2;			\
+		v0 += v3; v3 = fastd_hash_rotl64(v3, 21); v3 ^= v0;			\
+		v2 += v1; v1 = fastd_hash_rotl64(v1, 17); v1 ^= v2; v2 = fastd_hash_rotl64(v2, 32); \
+	} while (0)
+
+/**
+   Computes the SipHash-1-3 of a buffer with a 128bit key
+
+   SipHash is a keyed hash function; as long as the key is secret, an attacker
+   can't predict which inputs collide.
+
+   \sa https://131002.net/siphash/
+*/
+static inline uint64_t fastd_siphash13(const uint64_t key[2], const void *data, size_t len) {
+	const uint8_t *in = data;
+	uint64_t v0 = key[0] ^ UINT64_C(0x736f6d6570736575);
+	uint64_t v1 = key[1] ^ UINT64_C(0x646f72616e646f6d);
+	uint64_t v2 = key[0] ^ UINT64_C(0x6c7967656e657261);
+	uint64_t v3 = key[1] ^ UINT64_C(0x7465646279746573);
+	size_t left = len;
+
+	for (; left >= 8; in += 8, left -= 8) {
+		uint64_t m = fastd_hash_load_le64(in, 8);
+
+		v3 ^= m;
+		FASTD_SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	uint64_t b = ((uint64_t)len << 56) | fastd_hash_load_le64(in, left);
+
+	v3 ^= b;
+	FASTD_SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	FASTD_SIPROUND(v0, v1, v2, v3);
+	FASTD_SIPROUND(v0, v1, v2, v3);
+	FASTD_SIPROUND(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef FASTD_SIPROUND
@@ -549,7 +549,7 @@ fastd_iface_t * fastd_iface_open(fastd_peer_t *peer) {
 			}
 		}
 		else {
-			pr_error("invalid TUN/TAP device name: `%%n' and `%%k' patterns can't be used in TAP mode");
+			pr_error("invalid TUN/TAP device name: `%%n' and `%%k' patterns can't be used in TAP mode or with a shared TUN interface");
 			return NULL;
 		}
 	}
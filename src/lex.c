@@ -60,15 +60,19 @@ typedef struct keyword {
    The keyword list must be sorted so binary search can work.
 */
 static const keyword_t keywords[] = {
+	{ "adaptive", TOK_ADAPTIVE },
 	{ "addresses", TOK_ADDRESSES },
 	{ "any", TOK_ANY },
 	{ "as", TOK_AS },
 	{ "async", TOK_ASYNC },
 	{ "auto", TOK_AUTO },
 	{ "bind", TOK_BIND },
+	{ "broadcast", TOK_BROADCAST },
+	{ "calibrate", TOK_CALIBRATE },
 	{ "capabilities", TOK_CAPABILITIES },
 	{ "cipher", TOK_CIPHER },
 	{ "connect", TOK_CONNECT },
+	{ "crypto", TOK_CRYPTO },
 	{ "debug", TOK_DEBUG },
 	{ "debug2", TOK_DEBUG2 },
 	{ "default", TOK_DEFAULT },
@@ -78,21 +82,27 @@ static const keyword_t keywords[] = {
 	{ "early", TOK_EARLY },
 	{ "error", TOK_ERROR },
 	{ "establish", TOK_ESTABLISH },
+	{ "ethertype", TOK_ETHERTYPE },
 	{ "fatal", TOK_FATAL },
+	{ "filter", TOK_FILTER },
 	{ "float", TOK_FLOAT },
 	{ "force", TOK_FORCE },
 	{ "forward", TOK_FORWARD },
 	{ "from", TOK_FROM },
 	{ "group", TOK_GROUP },
+	{ "handshake", TOK_HANDSHAKE },
 	{ "handshakes", TOK_HANDSHAKES },
 	{ "hide", TOK_HIDE },
 	{ "include", TOK_INCLUDE },
 	{ "info", TOK_INFO },
 	{ "interface", TOK_INTERFACE },
+	{ "interval", TOK_INTERVAL },
 	{ "ip", TOK_IP },
 	{ "ipv4", TOK_IPV4 },
 	{ "ipv6", TOK_IPV6 },
+	{ "keepalive", TOK_KEEPALIVE },
 	{ "key", TOK_KEY },
+	{ "learn", TOK_LEARN },
 	{ "level", TOK_LEVEL },
 	{ "limit", TOK_LIMIT },
 	{ "log", TOK_LOG },
@@ -101,10 +111,13 @@ static const keyword_t keywords[] = {
 	{ "method", TOK_METHOD },
 	{ "mode", TOK_MODE },
 	{ "mtu", TOK_MTU },
+	{ "multicast", TOK_MULTICAST },
 	{ "multitap", TOK_MULTITAP },
+	{ "neighbor", TOK_NEIGHBOR },
 	{ "no", TOK_NO },
 	{ "on", TOK_ON },
 	{ "packet", TOK_PACKET },
+	{ "pass", TOK_PASS },
 	{ "peer", TOK_PEER },
 	{ "peers", TOK_PEERS },
 	{ "persist", TOK_PERSIST },
@@ -113,17 +126,25 @@ static const keyword_t keywords[] = {
 	{ "post-down", TOK_POST_DOWN },
 	{ "pre-up", TOK_PRE_UP },
 	{ "protocol", TOK_PROTOCOL },
+	{ "proxy", TOK_PROXY },
+	{ "relay", TOK_RELAY },
 	{ "remote", TOK_REMOTE },
+	{ "route", TOK_ROUTE },
 	{ "secret", TOK_SECRET },
 	{ "secure", TOK_SECURE },
+	{ "shared", TOK_SHARED },
+	{ "slack", TOK_SLACK },
 	{ "socket", TOK_SOCKET },
 	{ "status", TOK_STATUS },
 	{ "stderr", TOK_STDERR },
 	{ "sync", TOK_SYNC },
 	{ "syslog", TOK_SYSLOG },
 	{ "tap", TOK_TAP },
+	{ "tcp", TOK_TCP },
+	{ "timer", TOK_TIMER },
 	{ "to", TOK_TO },
 	{ "tun", TOK_TUN },
+	{ "udp", TOK_UDP },
 	{ "up", TOK_UP },
 	{ "use", TOK_USE },
 	{ "user", TOK_USER },
@@ -500,6 +521,12 @@ int fastd_lex(YYSTYPE *yylval, YYLTYPE *yylloc, fastd_lex_t *lex) {
 				continue;
 			}
 
+			if (current(lex) >= '0' && current(lex) <= '9') {
+				/* prefix length */
+				consume(lex, false);
+				return '/';
+			}
+
 			if (current(lex) != '/')
 				return syntax_error(yylval, lex);
 
@@ -74,10 +74,22 @@ struct fastd_method_provider {
 	/** Marks a session as superseded after a refresh */
 	void (*session_superseded)(fastd_method_session_state_t *session);
 
-	/** Encrypts a packet for a given session, adding method-specific headers */
+	/** Encrypts a packet for a given session, adding method-specific headers (consumes the input buffer on success; optional if encrypt_shared is given) */
 	bool (*encrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in);
+	/**
+	   Encrypts a packet for a given session, leaving the input buffer to the caller (optional)
+
+	   Only the head and tail space of the input buffer may be modified, and only by zero padding, so
+	   the same buffer can be encrypted for multiple peers one after another.
+	*/
+	bool (*encrypt_shared)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in);
 	/** Decrypts a packet for a given session, stripping method-specific headers */
 	bool (*decrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered);
+
+	/** Encrypts multiple packets for a given session at once (optional, see fastd_method_encrypt_batch()) */
+	void (*encrypt_batch)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, const fastd_buffer_t *in, bool *ok, size_t n);
+	/** Decrypts multiple packets for a given session at once (optional, see fastd_method_decrypt_batch()) */
+	void (*decrypt_batch)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, const fastd_buffer_t *in, bool *reordered, bool *ok, size_t n);
 };
 
 
@@ -85,6 +97,76 @@ struct fastd_method_provider {
 bool fastd_method_create_by_name(const char *name, const fastd_method_provider_t **provider, fastd_method_t **method);
 
 
+/**
+   Encrypts a packet for a given session
+
+   Like the \e encrypt function of the provider, the input buffer is consumed if the packet is
+   encrypted successfully.
+*/
+static inline bool fastd_method_encrypt(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
+	if (!provider->encrypt_shared)
+		return provider->encrypt(peer, session, out, in);
+
+	if (!provider->encrypt_shared(peer, session, out, in))
+		return false;
+
+	fastd_buffer_free(in);
+	return true;
+}
+
+/**
+   Encrypts a packet for a given session without consuming the input buffer
+
+   Providers without an \e encrypt_shared entry point are handled by encrypting a copy of the
+   input buffer.
+*/
+static inline bool fastd_method_encrypt_shared(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, const fastd_buffer_t in) {
+	if (provider->encrypt_shared)
+		return provider->encrypt_shared(peer, session, out, in);
+
+	fastd_buffer_t copy = fastd_buffer_dup(in, conf.min_encrypt_head_space, conf.min_encrypt_tail_space);
+	if (provider->encrypt(peer, session, out, copy))
+		return true;
+
+	fastd_buffer_free(copy);
+	return false;
+}
+
+/**
+   Encrypts multiple packets for a given session
+
+   For each packet, \e ok is set like the return value of the \e encrypt function of the provider.
+   Providers without a batch entry point are handled by calling \e encrypt for each packet.
+*/
+static inline void fastd_method_encrypt_batch(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, const fastd_buffer_t *in, bool *ok, size_t n) {
+	if (provider->encrypt_batch) {
+		provider->encrypt_batch(peer, session, out, in, ok, n);
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < n; i++)
+		ok[i] = fastd_method_encrypt(provider, peer, session, &out[i], in[i]);
+}
+
+/**
+   Decrypts multiple packets for a given session
+
+   For each packet, \e ok is set like the return value of the \e decrypt function of the provider.
+   Providers without a batch entry point are handled by calling \e decrypt for each packet.
+*/
+static inline void fastd_method_decrypt_batch(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, const fastd_buffer_t *in, bool *reordered, bool *ok, size_t n) {
+	if (provider->decrypt_batch) {
+		provider->decrypt_batch(peer, session, out, in, reordered, ok, n);
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < n; i++)
+		ok[i] = provider->decrypt(peer, session, &out[i], in[i], &reordered[i]);
+}
+
+
 /** Finds the fastd_method_info_t for a configured method */
 static inline const fastd_method_info_t * fastd_method_get_by_name(const char *name) {
 	size_t i;
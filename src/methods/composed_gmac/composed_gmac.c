@@ -205,6 +205,70 @@ static inline void put_size(fastd_block128_t *out, size_t len) {
 	out->b[7] = len << 3;
 }
 
+/**
+   Encrypts the payload and computes its GHASH in a single pass
+
+   The payload is processed in chunks of STREAM_CHUNK_SIZE bytes, so every chunk of ciphertext
+   is authenticated while it is still in the cache. The size block is appended after the last chunk.
+*/
+static bool encrypt_stream(fastd_method_session_state_t *session, fastd_block128_t *tag, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *nonce) {
+	size_t n_blocks = block_count(len, sizeof(fastd_block128_t));
+	size_t aligned_len = n_blocks*sizeof(fastd_block128_t);
+	size_t offset = 0;
+
+	fastd_mac_stream_t stream = {};
+
+	do {
+		size_t chunk = min_size_t(aligned_len - offset, STREAM_CHUNK_SIZE);
+		fastd_block128_t *chunk_out = out + offset/sizeof(fastd_block128_t);
+
+		if (!session->cipher->crypt_offset(session->cipher_state, chunk_out, in + offset/sizeof(fastd_block128_t), chunk, nonce, offset))
+			return false;
+
+		offset += chunk;
+
+		if (offset == aligned_len) {
+			memset(((uint8_t *)out)+len, 0, aligned_len-len);
+			put_size(&out[n_blocks], len);
+
+			chunk += sizeof(fastd_block128_t);
+		}
+
+		if (!session->ghash->digest_update(session->ghash_state, &stream, chunk_out, chunk))
+			return false;
+	} while (offset < aligned_len);
+
+	return session->ghash->digest_final(session->ghash_state, tag, &stream);
+}
+
+/**
+   Authenticates and decrypts the payload in a single pass
+
+   The input must already be padded and followed by the size block; \a len is the length of the
+   payload rounded up to whole blocks.
+*/
+static bool decrypt_stream(fastd_method_session_state_t *session, fastd_block128_t *tag, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *nonce) {
+	size_t offset = 0;
+
+	fastd_mac_stream_t stream = {};
+
+	do {
+		size_t chunk = min_size_t(len - offset, STREAM_CHUNK_SIZE);
+		const fastd_block128_t *chunk_in = in + offset/sizeof(fastd_block128_t);
+		size_t mac_chunk = (offset + chunk == len) ? chunk + sizeof(fastd_block128_t) : chunk;
+
+		if (!session->ghash->digest_update(session->ghash_state, &stream, chunk_in, mac_chunk))
+			return false;
+
+		if (!session->cipher->crypt_offset(session->cipher_state, out + offset/sizeof(fastd_block128_t), chunk_in, chunk, nonce, offset))
+			return false;
+
+		offset += chunk;
+	} while (offset < len);
+
+	return session->ghash->digest_final(session->ghash_state, tag, &stream);
+}
+
 /** Encrypts and authenticates a packet */
 static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
 	size_t tail_len = alignto(in.len, sizeof(fastd_block128_t))-in.len;
@@ -228,16 +292,21 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 		uint8_t nonce[session->method->cipher_info->iv_length ?: 1] __attribute__((aligned(8)));
 		fastd_method_expand_nonce(nonce, session->common.send_nonce, session->method->cipher_info->iv_length);
 
-		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
-	}
+		if (fastd_crypto_can_stream(session->cipher, session->ghash)) {
+			ok = encrypt_stream(session, &tag, outblocks+1, inblocks, in.len, nonce);
+		}
+		else {
+			ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
 
-	if (ok) {
-		if (tail_len)
-			memset(out->data+out->len, 0, tail_len);
+			if (ok) {
+				if (tail_len)
+					memset(out->data+out->len, 0, tail_len);
 
-		put_size(&outblocks[n_blocks+1], in.len);
+				put_size(&outblocks[n_blocks+1], in.len);
 
-		ok = session->ghash->digest(session->ghash_state, &tag, outblocks+1, (n_blocks+1)*sizeof(fastd_block128_t));
+				ok = session->ghash->digest(session->ghash_state, &tag, outblocks+1, (n_blocks+1)*sizeof(fastd_block128_t));
+			}
+		}
 	}
 
 	if (!ok) {
@@ -247,8 +316,6 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 
 	xor_a(&outblocks[0], &tag);
 
-	fastd_buffer_free(in);
-
 	fastd_method_put_common_header(out, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
@@ -289,16 +356,25 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 
 	bool ok = session->gmac_cipher->crypt(session->gmac_cipher_state, outblocks, inblocks, sizeof(fastd_block128_t), gmac_nonce);
 
-	if (ok)
-		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks+1, (n_blocks-1)*sizeof(fastd_block128_t), nonce);
-
-	if (ok) {
+	if (ok && fastd_crypto_can_stream(session->cipher, session->ghash)) {
 		if (tail_len)
 			memset(in.data+in.len, 0, tail_len);
 
 		put_size(&inblocks[n_blocks], in.len-sizeof(fastd_block128_t));
 
-		ok = session->ghash->digest(session->ghash_state, &tag, inblocks+1, n_blocks*sizeof(fastd_block128_t));
+		ok = decrypt_stream(session, &tag, outblocks+1, inblocks+1, (n_blocks-1)*sizeof(fastd_block128_t), nonce);
+	}
+	else if (ok) {
+		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks+1, (n_blocks-1)*sizeof(fastd_block128_t), nonce);
+
+		if (ok) {
+			if (tail_len)
+				memset(in.data+in.len, 0, tail_len);
+
+			put_size(&inblocks[n_blocks], in.len-sizeof(fastd_block128_t));
+
+			ok = session->ghash->digest(session->ghash_state, &tag, inblocks+1, n_blocks*sizeof(fastd_block128_t));
+		}
 	}
 
 	if (!ok || !block_equal(&tag, &outblocks[0])) {
@@ -322,6 +398,121 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	return true;
 }
 
+/**
+   Verifies and decrypts multiple packets
+
+   The packets are passed to the cipher and GHASH implementations together, so implementations
+   supporting batch operations can process multiple packets in parallel.
+*/
+static void method_decrypt_batch(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, const fastd_buffer_t *in, bool *reordered, bool *ok, size_t n) {
+	size_t i, j, m = 0;
+
+	for (i = 0; i < n; i++)
+		ok[i] = false;
+
+	if (!n || !method_session_is_valid(session))
+		return;
+
+	size_t nonce_len = session->method->cipher_info->iv_length, gmac_nonce_len = session->method->gmac_cipher_info->iv_length;
+
+	uint8_t in_nonces[n][COMMON_NONCEBYTES];
+	uint8_t nonces[n][alignto(nonce_len ?: 1, 8)] __attribute__((aligned(8)));
+	uint8_t gmac_nonces[n][alignto(gmac_nonce_len ?: 1, 8)] __attribute__((aligned(8)));
+
+	size_t index[n];
+	fastd_buffer_t in_bufs[n];
+	fastd_block128_t tags[n];
+
+	fastd_block128_t *tag_out[n], *data_out[n];
+	const fastd_block128_t *tag_in[n], *data_in[n], *ghash_in[n];
+	const uint8_t *nonce_ptrs[n], *gmac_nonce_ptrs[n];
+	size_t tag_len[n], data_len[n], ghash_len[n];
+
+	for (i = 0; i < n; i++) {
+		fastd_buffer_t buf = in[i];
+
+		if (buf.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
+			continue;
+
+		uint8_t flags;
+		int64_t age;
+		if (!fastd_method_handle_common_header(&session->common, &buf, in_nonces[i], &flags, &age))
+			continue;
+
+		if (flags)
+			continue;
+
+		fastd_method_expand_nonce(nonces[m], in_nonces[i], nonce_len);
+		fastd_method_expand_nonce(gmac_nonces[m], in_nonces[i], gmac_nonce_len);
+
+		size_t tail_len = alignto(buf.len, sizeof(fastd_block128_t))-buf.len;
+		out[i] = fastd_buffer_alloc(buf.len, 0, tail_len);
+
+		int n_blocks = block_count(buf.len, sizeof(fastd_block128_t));
+
+		fastd_block128_t *inblocks = buf.data;
+		fastd_block128_t *outblocks = out[i].data;
+
+		tag_out[m] = outblocks;
+		tag_in[m] = inblocks;
+		tag_len[m] = sizeof(fastd_block128_t);
+		gmac_nonce_ptrs[m] = gmac_nonces[m];
+
+		data_out[m] = outblocks+1;
+		data_in[m] = inblocks+1;
+		data_len[m] = (n_blocks-1)*sizeof(fastd_block128_t);
+		nonce_ptrs[m] = nonces[m];
+
+		/* the padding is not part of the ciphertext, so it can be prepared before decryption */
+		if (tail_len)
+			memset(buf.data+buf.len, 0, tail_len);
+
+		put_size(&inblocks[n_blocks], buf.len-sizeof(fastd_block128_t));
+
+		ghash_in[m] = inblocks+1;
+		ghash_len[m] = n_blocks*sizeof(fastd_block128_t);
+
+		index[m] = i;
+		in_bufs[m] = buf;
+		m++;
+	}
+
+	if (!m)
+		return;
+
+	bool crypt_ok = fastd_cipher_crypt_batch(session->gmac_cipher, session->gmac_cipher_state, tag_out, tag_in, tag_len, gmac_nonce_ptrs, m)
+		&& fastd_cipher_crypt_batch(session->cipher, session->cipher_state, data_out, data_in, data_len, nonce_ptrs, m)
+		&& fastd_mac_digest_batch(session->ghash, session->ghash_state, tags, ghash_in, ghash_len, m);
+
+	for (j = 0; j < m; j++) {
+		i = index[j];
+
+		if (!crypt_ok || !block_equal(&tags[j], tag_out[j])) {
+			fastd_buffer_free(out[i]);
+			continue;
+		}
+
+		fastd_buffer_push_head(&out[i], sizeof(fastd_block128_t));
+
+		/* the receive state may have changed since the header check because of earlier packets of the batch */
+		fastd_tristate_t reorder_check = FASTD_TRISTATE_UNDEF;
+		int64_t age;
+		if (fastd_method_is_nonce_valid(&session->common, in_nonces[i], &age))
+			reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonces[i], age);
+
+		if (reorder_check.set) {
+			reordered[i] = reorder_check.state;
+		}
+		else {
+			fastd_buffer_free(out[i]);
+			out[i] = fastd_buffer_alloc(0, 0, 0);
+		}
+
+		fastd_buffer_free(in_bufs[j]);
+		ok[i] = true;
+	}
+}
+
 
 /** The composed-gmac method provider */
 const fastd_method_provider_t fastd_method_composed_gmac = {
@@ -343,6 +534,7 @@ const fastd_method_provider_t fastd_method_composed_gmac = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
+	.encrypt_shared = method_encrypt,
 	.decrypt = method_decrypt,
+	.decrypt_batch = method_decrypt_batch,
 };
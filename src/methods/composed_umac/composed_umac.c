@@ -174,6 +174,67 @@ static void method_session_free(fastd_method_session_state_t *session) {
 	}
 }
 
+/**
+   Encrypts the payload and computes its UHASH in a single pass
+
+   The payload is processed in chunks of STREAM_CHUNK_SIZE bytes, so every chunk of ciphertext
+   is authenticated while it is still in the cache. The last chunk is padded with \a tail_len zero bytes.
+*/
+static bool encrypt_stream(fastd_method_session_state_t *session, fastd_block128_t *tag, fastd_block128_t *out, const fastd_block128_t *in, size_t len, size_t tail_len, const uint8_t *nonce) {
+	size_t aligned_len = block_count(len, sizeof(fastd_block128_t))*sizeof(fastd_block128_t);
+	size_t offset = 0;
+
+	fastd_mac_stream_t stream = {};
+
+	do {
+		size_t chunk = min_size_t(aligned_len - offset, STREAM_CHUNK_SIZE);
+		size_t mac_chunk = chunk;
+		fastd_block128_t *chunk_out = out + offset/sizeof(fastd_block128_t);
+
+		if (!session->cipher->crypt_offset(session->cipher_state, chunk_out, in + offset/sizeof(fastd_block128_t), chunk, nonce, offset))
+			return false;
+
+		if (offset + chunk == aligned_len) {
+			memset(((uint8_t *)out)+len, 0, tail_len);
+			mac_chunk = len - offset;
+		}
+
+		if (!session->uhash->digest_update(session->uhash_state, &stream, chunk_out, mac_chunk))
+			return false;
+
+		offset += chunk;
+	} while (offset < aligned_len);
+
+	return session->uhash->digest_final(session->uhash_state, tag, &stream);
+}
+
+/**
+   Authenticates and decrypts the payload in a single pass
+
+   The input must already be padded with zeros for the UHASH.
+*/
+static bool decrypt_stream(fastd_method_session_state_t *session, fastd_block128_t *tag, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *nonce) {
+	size_t aligned_len = block_count(len, sizeof(fastd_block128_t))*sizeof(fastd_block128_t);
+	size_t offset = 0;
+
+	fastd_mac_stream_t stream = {};
+
+	do {
+		size_t chunk = min_size_t(aligned_len - offset, STREAM_CHUNK_SIZE);
+		const fastd_block128_t *chunk_in = in + offset/sizeof(fastd_block128_t);
+
+		if (!session->uhash->digest_update(session->uhash_state, &stream, chunk_in, min_size_t(len - offset, STREAM_CHUNK_SIZE)))
+			return false;
+
+		if (!session->cipher->crypt_offset(session->cipher_state, out + offset/sizeof(fastd_block128_t), chunk_in, chunk, nonce, offset))
+			return false;
+
+		offset += chunk;
+	} while (offset < aligned_len);
+
+	return session->uhash->digest_final(session->uhash_state, tag, &stream);
+}
+
 /** Encrypts and authenticates a packet */
 static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
 	size_t tail_len = in.len ? alignto(in.len, 2 * sizeof(fastd_block128_t))-in.len : (2 * sizeof(fastd_block128_t));
@@ -195,14 +256,19 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 		uint8_t nonce[session->method->cipher_info->iv_length ?: 1] __attribute__((aligned(8)));
 		fastd_method_expand_nonce(nonce, session->common.send_nonce, session->method->cipher_info->iv_length);
 
-		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
-	}
+		if (fastd_crypto_can_stream(session->cipher, session->uhash)) {
+			ok = encrypt_stream(session, &tag, outblocks+1, inblocks, in.len, tail_len, nonce);
+		}
+		else {
+			ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
 
-	if (ok) {
-		if (tail_len)
-			memset(out->data+out->len, 0, tail_len);
+			if (ok) {
+				if (tail_len)
+					memset(out->data+out->len, 0, tail_len);
 
-		ok = session->uhash->digest(session->uhash_state, &tag, outblocks+1, out->len - sizeof(fastd_block128_t));
+				ok = session->uhash->digest(session->uhash_state, &tag, outblocks+1, out->len - sizeof(fastd_block128_t));
+			}
+		}
 	}
 
 	if (!ok) {
@@ -212,8 +278,6 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 
 	xor_a(&outblocks[0], &tag);
 
-	fastd_buffer_free(in);
-
 	fastd_method_put_common_header(out, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
@@ -255,14 +319,21 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 
 	bool ok = session->umac_cipher->crypt(session->umac_cipher_state, outblocks, inblocks, sizeof(fastd_block128_t), umac_nonce);
 
-	if (ok)
-		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks+1, (n_blocks-1)*sizeof(fastd_block128_t), nonce);
-
-	if (ok) {
+	if (ok && fastd_crypto_can_stream(session->cipher, session->uhash)) {
 		if (tail_len)
 			memset(in.data+in.len, 0, tail_len);
 
-		ok = session->uhash->digest(session->uhash_state, &tag, inblocks+1, in_len);
+		ok = decrypt_stream(session, &tag, outblocks+1, inblocks+1, in_len, nonce);
+	}
+	else if (ok) {
+		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks+1, (n_blocks-1)*sizeof(fastd_block128_t), nonce);
+
+		if (ok) {
+			if (tail_len)
+				memset(in.data+in.len, 0, tail_len);
+
+			ok = session->uhash->digest(session->uhash_state, &tag, inblocks+1, in_len);
+		}
 	}
 
 	if (!ok || !block_equal(&tag, &outblocks[0])) {
@@ -307,6 +378,6 @@ const fastd_method_provider_t fastd_method_composed_umac = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
+	.encrypt_shared = method_encrypt,
 	.decrypt = method_decrypt,
 };
@@ -172,8 +172,6 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 	fastd_buffer_push_head(out, KEYBYTES);
 	fastd_buffer_pull_head_from(out, tag, TAGBYTES);
 
-	fastd_buffer_free(in);
-
 	fastd_method_put_common_header(out, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
@@ -268,6 +266,6 @@ const fastd_method_provider_t fastd_method_generic_poly1305 = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
+	.encrypt_shared = method_encrypt,
 	.decrypt = method_decrypt,
 };
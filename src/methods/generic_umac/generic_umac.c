@@ -178,8 +178,6 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 
 	xor_a(&outblocks[0], &tag);
 
-	fastd_buffer_free(in);
-
 	fastd_method_put_common_header(out, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
@@ -266,6 +264,6 @@ const fastd_method_provider_t fastd_method_generic_umac = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
+	.encrypt_shared = method_encrypt,
 	.decrypt = method_decrypt,
 };
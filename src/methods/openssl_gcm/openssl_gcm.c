@@ -0,0 +1,268 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   openssl-gcm method provider
+
+   openssl-gcm implements the aes128-gcm method using OpenSSL's AES-GCM implementation,
+   which combines encryption and authentication in a single pass. The packet format is
+   identical to the one generated by the generic-gmac provider.
+*/
+
+
+#include "../../crypto.h"
+#include "../../method.h"
+#include "../common.h"
+
+#include <openssl/evp.h>
+
+
+/** The length of the GCM IVs (the common nonce followed by zero bytes) */
+#define GCM_IVBYTES 12
+
+
+/** A specific method provided by this provider */
+struct fastd_method {
+	const EVP_CIPHER *cipher;			/**< The OpenSSL cipher */
+	size_t key_length;				/**< The key length used by the cipher */
+};
+
+/** The method-specific session state */
+struct fastd_method_session_state {
+	fastd_method_common_t common;			/**< The common method state */
+
+	const fastd_method_t *method;			/**< The specific method used */
+
+	EVP_CIPHER_CTX *encrypt_ctx;			/**< The cipher context used for encryption, containing the prepared key schedule */
+	EVP_CIPHER_CTX *decrypt_ctx;			/**< The cipher context used for decryption, containing the prepared key schedule */
+};
+
+
+/**
+   Instanciates a method using a name of the pattern "aes128-gcm"
+
+   When an implementation of the aes128-ctr cipher or the ghash MAC has been chosen explicitly,
+   the method is left to the generic-gmac provider, which uses the configured implementations.
+*/
+static bool method_create_by_name(const char *name, fastd_method_t **method) {
+	if (strcmp(name, "aes128-gcm"))
+		return false;
+
+	if (fastd_cipher_is_configured("aes128-ctr") || fastd_mac_is_configured("ghash")) {
+		pr_verbose("not using OpenSSL's AES-GCM implementation for method `%s' (cipher or MAC implementation configured explicitly)", name);
+		return false;
+	}
+
+	pr_verbose("using OpenSSL's AES-GCM implementation for method `%s'", name);
+
+	*method = fastd_new(fastd_method_t);
+	(*method)->cipher = EVP_aes_128_gcm();
+	(*method)->key_length = 16;
+
+	return true;
+}
+
+/** Frees a method */
+static void method_destroy(fastd_method_t *method) {
+	free(method);
+}
+
+/** Returns the key length used by a method */
+static size_t method_key_length(const fastd_method_t *method) {
+	return method->key_length;
+}
+
+/** Initializes a session */
+static fastd_method_session_state_t * method_session_init(const fastd_method_t *method, const uint8_t *secret, bool initiator) {
+	fastd_method_session_state_t *session = fastd_new(fastd_method_session_state_t);
+
+	fastd_method_common_init(&session->common, initiator);
+	session->method = method;
+
+	session->encrypt_ctx = EVP_CIPHER_CTX_new();
+	session->decrypt_ctx = EVP_CIPHER_CTX_new();
+
+	if (!session->encrypt_ctx || !session->decrypt_ctx
+	    || !EVP_EncryptInit_ex(session->encrypt_ctx, method->cipher, NULL, secret, NULL)
+	    || !EVP_DecryptInit_ex(session->decrypt_ctx, method->cipher, NULL, secret, NULL)) {
+		EVP_CIPHER_CTX_free(session->encrypt_ctx);
+		EVP_CIPHER_CTX_free(session->decrypt_ctx);
+		free(session);
+
+		return NULL;
+	}
+
+	return session;
+}
+
+/** Checks if the session is currently valid */
+static bool method_session_is_valid(fastd_method_session_state_t *session) {
+	return (session && fastd_method_session_common_is_valid(&session->common));
+}
+
+/** Checks if this side is the initator of the session */
+static bool method_session_is_initiator(fastd_method_session_state_t *session) {
+	return fastd_method_session_common_is_initiator(&session->common);
+}
+
+/** Checks if the session should be refreshed */
+static bool method_session_want_refresh(fastd_method_session_state_t *session) {
+	return fastd_method_session_common_want_refresh(&session->common);
+}
+
+/** Marks the session as superseded */
+static void method_session_superseded(fastd_method_session_state_t *session) {
+	fastd_method_session_common_superseded(&session->common);
+}
+
+/** Frees the session state */
+static void method_session_free(fastd_method_session_state_t *session) {
+	if (session) {
+		EVP_CIPHER_CTX_free(session->encrypt_ctx);
+		EVP_CIPHER_CTX_free(session->decrypt_ctx);
+
+		free(session);
+	}
+}
+
+/**
+   Builds the GCM IV for a nonce
+
+   The resulting initial counter block is the same as the one used by generic-gmac with the aes128-ctr cipher.
+*/
+static inline void make_iv(uint8_t iv[GCM_IVBYTES], const uint8_t nonce[COMMON_NONCEBYTES]) {
+	memset(iv, 0, GCM_IVBYTES);
+	memcpy(iv, nonce, COMMON_NONCEBYTES);
+}
+
+
+/** Encrypts and authenticates a packet */
+static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
+	*out = fastd_buffer_alloc(sizeof(fastd_block128_t)+in.len, alignto(COMMON_HEADBYTES, 16), 0);
+
+	uint8_t iv[GCM_IVBYTES];
+	make_iv(iv, session->common.send_nonce);
+
+	uint8_t *tag = out->data;
+	uint8_t *data = tag + sizeof(fastd_block128_t);
+	int clen, flen;
+
+	bool ok = EVP_EncryptInit_ex(session->encrypt_ctx, NULL, NULL, NULL, iv)
+		&& EVP_EncryptUpdate(session->encrypt_ctx, data, &clen, in.data, in.len)
+		&& EVP_EncryptFinal_ex(session->encrypt_ctx, data+clen, &flen)
+		&& (size_t)(clen+flen) == in.len
+		&& EVP_CIPHER_CTX_ctrl(session->encrypt_ctx, EVP_CTRL_GCM_GET_TAG, sizeof(fastd_block128_t), tag);
+
+	if (!ok) {
+		fastd_buffer_free(*out);
+		return false;
+	}
+
+	fastd_method_put_common_header(out, session->common.send_nonce, 0);
+	fastd_method_increment_nonce(&session->common);
+
+	return true;
+}
+
+/** Verifies and decrypts a packet */
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
+	if (in.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
+		return false;
+
+	if (!method_session_is_valid(session))
+		return false;
+
+	uint8_t in_nonce[COMMON_NONCEBYTES];
+	uint8_t flags;
+	int64_t age;
+	if (!fastd_method_handle_common_header(&session->common, &in, in_nonce, &flags, &age))
+		return false;
+
+	if (flags)
+		return false;
+
+	uint8_t iv[GCM_IVBYTES];
+	make_iv(iv, in_nonce);
+
+	fastd_block128_t tag;
+	memcpy(&tag, in.data, sizeof(fastd_block128_t));
+
+	const uint8_t *data = in.data + sizeof(fastd_block128_t);
+	size_t data_len = in.len - sizeof(fastd_block128_t);
+
+	*out = fastd_buffer_alloc(data_len, 0, 0);
+	int clen, flen;
+
+	bool ok = EVP_DecryptInit_ex(session->decrypt_ctx, NULL, NULL, NULL, iv)
+		&& EVP_DecryptUpdate(session->decrypt_ctx, out->data, &clen, data, data_len)
+		&& EVP_CIPHER_CTX_ctrl(session->decrypt_ctx, EVP_CTRL_GCM_SET_TAG, sizeof(fastd_block128_t), tag.b)
+		&& EVP_DecryptFinal_ex(session->decrypt_ctx, (uint8_t *)out->data+clen, &flen) > 0
+		&& (size_t)(clen+flen) == data_len;
+
+	if (!ok) {
+		fastd_buffer_free(*out);
+		return false;
+	}
+
+	fastd_buffer_free(in);
+
+	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	if (reorder_check.set) {
+		*reordered = reorder_check.state;
+	}
+	else {
+		fastd_buffer_free(*out);
+		*out = fastd_buffer_alloc(0, 0, 0);
+	}
+
+	return true;
+}
+
+
+/** The openssl-gcm method provider */
+const fastd_method_provider_t fastd_method_openssl_gcm = {
+	.max_overhead = COMMON_HEADBYTES + sizeof(fastd_block128_t),
+	.min_encrypt_head_space = 0,
+	.min_decrypt_head_space = 0,
+	.min_encrypt_tail_space = 0,
+	.min_decrypt_tail_space = 0,
+
+	.create_by_name = method_create_by_name,
+	.destroy = method_destroy,
+
+	.key_length = method_key_length,
+
+	.session_init = method_session_init,
+	.session_is_valid = method_session_is_valid,
+	.session_is_initiator = method_session_is_initiator,
+	.session_want_refresh = method_session_want_refresh,
+	.session_superseded = method_session_superseded,
+	.session_free = method_session_free,
+
+	.encrypt_shared = method_encrypt,
+	.decrypt = method_decrypt,
+};
@@ -157,8 +157,6 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 
 	crypto_secretbox_xsalsa20poly1305(out->data, in.data, in.len, nonce, session->key);
 
-	fastd_buffer_free(in);
-
 	fastd_buffer_push_head(out, crypto_secretbox_xsalsa20poly1305_BOXZEROBYTES);
 	put_header(out, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
@@ -238,6 +236,6 @@ const fastd_method_provider_t fastd_method_xsalsa20_poly1305 = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
+	.encrypt_shared = method_encrypt,
 	.decrypt = method_decrypt,
 };
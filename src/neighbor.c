@@ -0,0 +1,380 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   ARP and IPv6 neighbor discovery proxy for TAP mode
+
+   The neighbor cache is a direct-mapped hashtable; a new mapping simply replaces
+   the entry occupying its slot.
+*/
+
+
+#include "neighbor.h"
+#include "hash.h"
+#include "peer.h"
+
+
+/** The length of an ARP packet for IPv4 over ethernet (including the ethernet header) */
+#define ARP_LEN (sizeof(fastd_eth_header_t) + 28)
+
+/** The minimum length of an ethernet frame (without FCS); shorter replies are padded */
+#define ETH_MIN_LEN 60
+
+/** The offset of the IPv6 header in an untagged ethernet frame */
+#define IPV6_OFFSET sizeof(fastd_eth_header_t)
+
+/** The offset of the ICMPv6 header of a neighbor discovery packet in an untagged ethernet frame */
+#define ICMP6_OFFSET (IPV6_OFFSET + 40)
+
+/** The length of a neighbor solicitation or advertisement without options */
+#define ND_LEN 24
+
+/** The length of a neighbor advertisement with a target link-layer address option */
+#define NA_LEN (ND_LEN + 8)
+
+
+/** The unspecified address */
+static const uint8_t zero_addr[16] = {};
+
+
+/** Returns the EtherType of an ethernet frame */
+static inline uint16_t get_ethertype(const fastd_buffer_t buffer) {
+	const uint8_t *data = buffer.data + offsetof(fastd_eth_header_t, proto);
+	return (data[0] << 8) | data[1];
+}
+
+/** Returns the cache slot for an IP address */
+static fastd_neighbor_t * get_slot(sa_family_t af, const uint8_t *addr) {
+	uint32_t hash = ctx.neighbor_seed;
+	fastd_hash(&hash, addr, af == AF_INET ? 4 : 16);
+	fastd_hash_final(&hash);
+
+	return &ctx.neighbors[hash % NEIGHBOR_CACHE_SIZE];
+}
+
+/** Checks if a cache entry is valid for an IP address */
+static inline bool entry_matches(const fastd_neighbor_t *entry, sa_family_t af, const uint8_t *addr) {
+	if (fastd_timed_out(entry->timeout) || entry->af != af)
+		return false;
+
+	return memcmp(entry->addr, addr, af == AF_INET ? 4 : 16) == 0;
+}
+
+/** Adds a mapping of an IP address to a MAC address to the cache (or refreshes an existing entry) */
+static void learn(sa_family_t af, const uint8_t *addr, fastd_eth_addr_t mac, bool router) {
+	if (!fastd_eth_addr_is_unicast(mac))
+		return;
+
+	fastd_neighbor_t *entry = get_slot(af, addr);
+
+	if (!entry_matches(entry, af, addr)) {
+		memset(entry, 0, sizeof(*entry));
+		entry->af = af;
+		memcpy(entry->addr, addr, af == AF_INET ? 4 : 16);
+	}
+
+	entry->mac = mac;
+	entry->router = router;
+	entry->timeout = ctx.now + ETH_ADDR_STALE_TIME;
+}
+
+/**
+   Looks up the MAC address of an IP address
+
+   Only entries whose MAC address has been learned on a peer other than \e source
+   are returned; requests for addresses on the local side and on the side of the
+   requesting peer are answered by the hosts themselves. Returns false if the
+   request can't be answered from the cache.
+*/
+static bool lookup(sa_family_t af, const uint8_t *addr, const fastd_peer_t *source, fastd_neighbor_t *ret) {
+	fastd_neighbor_t *entry = get_slot(af, addr);
+
+	if (!entry_matches(entry, af, addr)) {
+		ctx.neighbor_misses++;
+		return false;
+	}
+
+	fastd_peer_t *owner;
+	if (!fastd_peer_find_by_eth_addr(entry->mac, &owner)) {
+		/* The MAC address has timed out or its peer has gone away */
+		entry->timeout = 0;
+		ctx.neighbor_misses++;
+		return false;
+	}
+
+	if (!owner || owner == source)
+		return false;
+
+	ctx.neighbor_hits++;
+	*ret = *entry;
+	return true;
+}
+
+/** Sends a generated reply to the peer a request was received from, or writes it to the TAP interface */
+static void send_reply(fastd_buffer_t reply, fastd_peer_t *source) {
+	if (source) {
+		conf.protocol->send(source, reply);
+		return;
+	}
+
+	fastd_iface_write(ctx.iface, reply);
+	fastd_buffer_free(reply);
+}
+
+/** Allocates a reply frame of the given length with the given ethernet header */
+static fastd_buffer_t alloc_reply(size_t len, fastd_eth_addr_t dest, fastd_eth_addr_t source, uint16_t ethertype) {
+	fastd_buffer_t reply = fastd_buffer_alloc(len < ETH_MIN_LEN ? ETH_MIN_LEN : len, conf.min_encrypt_head_space, conf.min_encrypt_tail_space);
+	memset(reply.data, 0, reply.len);
+
+	fastd_eth_header_t *eth = reply.data;
+	eth->dest = dest;
+	eth->source = source;
+	eth->proto = htons(ethertype);
+
+	return reply;
+}
+
+
+/** Returns the ARP packet of an ethernet frame if it is an ARP packet for IPv4 over ethernet, or NULL */
+static const uint8_t * get_arp(const fastd_buffer_t buffer) {
+	if (buffer.len < ARP_LEN || get_ethertype(buffer) != 0x0806)
+		return NULL;
+
+	static const uint8_t arp_header[6] = { 0x00, 0x01, 0x08, 0x00, 6, 4 };
+	const uint8_t *arp = buffer.data + sizeof(fastd_eth_header_t);
+
+	if (memcmp(arp, arp_header, sizeof(arp_header)) != 0)
+		return NULL;
+
+	return arp;
+}
+
+/** Learns the sender's address mapping from ARP replies and gratuitous ARP requests */
+static void snoop_arp(const uint8_t *arp) {
+	uint16_t op = (arp[6] << 8) | arp[7];
+	const uint8_t *spa = arp + 14, *tpa = arp + 24;
+
+	if (op != 2 && !(op == 1 && memcmp(spa, tpa, 4) == 0))
+		return;
+
+	if (memcmp(spa, zero_addr, 4) == 0)
+		return;
+
+	fastd_eth_addr_t sha;
+	memcpy(sha.data, arp + 8, sizeof(sha.data));
+
+	learn(AF_INET, spa, sha, false);
+}
+
+/** Answers an ARP request from the cache */
+static bool proxy_arp(const uint8_t *arp, fastd_peer_t *source) {
+	uint16_t op = (arp[6] << 8) | arp[7];
+	const uint8_t *sha = arp + 8, *spa = arp + 14, *tpa = arp + 24;
+
+	/* Gratuitous ARP and address probes must reach the other hosts */
+	if (op != 1 || memcmp(spa, tpa, 4) == 0 || memcmp(spa, zero_addr, 4) == 0)
+		return false;
+
+	fastd_neighbor_t neighbor;
+	if (!lookup(AF_INET, tpa, source, &neighbor))
+		return false;
+
+	fastd_eth_addr_t requester;
+	memcpy(requester.data, sha, sizeof(requester.data));
+
+	fastd_buffer_t reply = alloc_reply(ARP_LEN, requester, neighbor.mac, 0x0806);
+	uint8_t *reply_arp = reply.data + sizeof(fastd_eth_header_t);
+
+	memcpy(reply_arp, arp, 6);
+	reply_arp[6] = 0;
+	reply_arp[7] = 2;
+	memcpy(reply_arp + 8, neighbor.mac.data, 6);
+	memcpy(reply_arp + 14, tpa, 4);
+	memcpy(reply_arp + 18, sha, 6);
+	memcpy(reply_arp + 24, spa, 4);
+
+	pr_debug2("answering ARP request with %E", &neighbor.mac);
+
+	send_reply(reply, source);
+	return true;
+}
+
+
+/** Returns the ICMPv6 header of an ethernet frame if it is a neighbor discovery packet of the given type, or NULL */
+static const uint8_t * get_nd(const fastd_buffer_t buffer, uint8_t type) {
+	if (buffer.len < ICMP6_OFFSET + ND_LEN || get_ethertype(buffer) != 0x86dd)
+		return NULL;
+
+	const uint8_t *ip6 = buffer.data + IPV6_OFFSET;
+	const uint8_t *icmp6 = buffer.data + ICMP6_OFFSET;
+
+	/* Neighbor discovery packets never have extension headers and always have a hop limit of 255 */
+	if ((ip6[0] >> 4) != 6 || ip6[6] != IPPROTO_ICMPV6 || ip6[7] != 255)
+		return NULL;
+
+	if (icmp6[0] != type || icmp6[1] != 0)
+		return NULL;
+
+	size_t len = (ip6[4] << 8) | ip6[5];
+	if (len < ND_LEN || ICMP6_OFFSET + len > buffer.len)
+		return NULL;
+
+	/* Multicast targets are invalid */
+	if (icmp6[8] == 0xff)
+		return NULL;
+
+	return icmp6;
+}
+
+/** Learns the target's address mapping from neighbor advertisements */
+static void snoop_na(const fastd_buffer_t buffer, const uint8_t *icmp6) {
+	const uint8_t *ip6 = buffer.data + IPV6_OFFSET;
+	size_t len = (ip6[4] << 8) | ip6[5];
+
+	fastd_eth_addr_t mac = fastd_buffer_source_address(buffer);
+
+	size_t offset = ND_LEN;
+	while (offset + 8 <= len) {
+		size_t optlen = 8 * icmp6[offset+1];
+		if (!optlen || offset + optlen > len)
+			return;
+
+		/* Target link-layer address */
+		if (icmp6[offset] == 2 && optlen == 8) {
+			memcpy(mac.data, icmp6 + offset + 2, sizeof(mac.data));
+			break;
+		}
+
+		offset += optlen;
+	}
+
+	learn(AF_INET6, icmp6 + 8, mac, icmp6[4] & 0x80);
+}
+
+/** Computes the ICMPv6 checksum of a packet */
+static uint16_t icmp6_checksum(const uint8_t *src, const uint8_t *dest, const uint8_t *data, size_t len) {
+	uint32_t sum = len + IPPROTO_ICMPV6;
+
+	size_t i;
+	for (i = 0; i < 16; i += 2)
+		sum += ((src[i] << 8) | src[i+1]) + ((dest[i] << 8) | dest[i+1]);
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (data[i] << 8) | data[i+1];
+
+	if (len % 2)
+		sum += data[len-1] << 8;
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+/** Answers a neighbor solicitation from the cache */
+static bool proxy_ns(const fastd_buffer_t buffer, const uint8_t *icmp6, fastd_peer_t *source) {
+	const uint8_t *ip6 = buffer.data + IPV6_OFFSET;
+	const uint8_t *src = ip6 + 8;
+
+	/* Duplicate address detection must reach the other hosts */
+	if (memcmp(src, zero_addr, 16) == 0)
+		return false;
+
+	fastd_neighbor_t neighbor;
+	if (!lookup(AF_INET6, icmp6 + 8, source, &neighbor))
+		return false;
+
+	fastd_buffer_t reply = alloc_reply(ICMP6_OFFSET + NA_LEN, fastd_buffer_source_address(buffer), neighbor.mac, 0x86dd);
+	uint8_t *reply_ip6 = reply.data + IPV6_OFFSET;
+	uint8_t *reply_icmp6 = reply.data + ICMP6_OFFSET;
+
+	reply_ip6[0] = 0x60;
+	reply_ip6[4] = 0;
+	reply_ip6[5] = NA_LEN;
+	reply_ip6[6] = IPPROTO_ICMPV6;
+	reply_ip6[7] = 255;
+	memcpy(reply_ip6 + 8, neighbor.addr, 16);
+	memcpy(reply_ip6 + 24, src, 16);
+
+	reply_icmp6[0] = 136;
+	reply_icmp6[4] = (neighbor.router ? 0x80 : 0) | 0x40 | 0x20; /* Router, Solicited, Override */
+	memcpy(reply_icmp6 + 8, neighbor.addr, 16);
+	reply_icmp6[24] = 2;
+	reply_icmp6[25] = 1;
+	memcpy(reply_icmp6 + 26, neighbor.mac.data, 6);
+
+	uint16_t checksum = icmp6_checksum(reply_ip6 + 8, reply_ip6 + 24, reply_icmp6, NA_LEN);
+	reply_icmp6[2] = checksum >> 8;
+	reply_icmp6[3] = checksum;
+
+	pr_debug2("answering neighbor solicitation with %E", &neighbor.mac);
+
+	send_reply(reply, source);
+	return true;
+}
+
+
+/** Allocates the neighbor cache */
+void fastd_neighbor_init(void) {
+	if (!conf.neighbor_proxy)
+		return;
+
+	fastd_random_bytes(&ctx.neighbor_seed, sizeof(ctx.neighbor_seed), false);
+	ctx.neighbors = fastd_new0_array(NEIGHBOR_CACHE_SIZE, fastd_neighbor_t);
+}
+
+/** Frees the neighbor cache */
+void fastd_neighbor_free(void) {
+	free(ctx.neighbors);
+	ctx.neighbors = NULL;
+}
+
+/** Learns IP to MAC address mappings from ARP replies and neighbor advertisements */
+void fastd_neighbor_snoop_packet(const fastd_buffer_t buffer) {
+	const uint8_t *arp = get_arp(buffer);
+	if (arp) {
+		snoop_arp(arp);
+		return;
+	}
+
+	const uint8_t *icmp6 = get_nd(buffer, 136);
+	if (icmp6)
+		snoop_na(buffer, icmp6);
+}
+
+/** Answers ARP requests and neighbor solicitations from the neighbor cache */
+bool fastd_neighbor_proxy_packet(const fastd_buffer_t buffer, fastd_peer_t *source) {
+	const uint8_t *arp = get_arp(buffer);
+	if (arp)
+		return proxy_arp(arp, source);
+
+	const uint8_t *icmp6 = get_nd(buffer, 135);
+	if (icmp6)
+		return proxy_ns(buffer, icmp6, source);
+
+	return false;
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   ARP and IPv6 neighbor discovery proxy for TAP mode
+
+   ARP replies and neighbor advertisements seen on the TAP interface or received
+   from peers are snooped into a cache of IP to MAC address mappings. When an ARP
+   request or neighbor solicitation would be sent to all peers and the answer is
+   known, a reply is generated locally instead. A cache entry is only used as long
+   as its MAC address is known to belong to another peer in the table of learned
+   MAC addresses, so entries become invalid together with the learned addresses.
+*/
+
+#pragma once
+
+#include "fastd.h"
+
+
+/** An entry of the neighbor cache */
+struct fastd_neighbor {
+	fastd_timeout_t timeout;		/**< Timeout until the entry is considered stale */
+	sa_family_t af;				/**< The address family of the IP address */
+	bool router;				/**< For IPv6 addresses, specifies if the neighbor has announced itself as a router */
+	uint8_t addr[16];			/**< The IP address (only the first 4 bytes are used for IPv4) */
+	fastd_eth_addr_t mac;			/**< The MAC address */
+};
+
+
+void fastd_neighbor_init(void);
+void fastd_neighbor_free(void);
+
+void fastd_neighbor_snoop_packet(const fastd_buffer_t buffer);
+bool fastd_neighbor_proxy_packet(const fastd_buffer_t buffer, fastd_peer_t *source);
+
+
+/** Learns IP to MAC address mappings from a packet, if the neighbor proxy is enabled */
+static inline void fastd_neighbor_snoop(const fastd_buffer_t buffer) {
+	if (conf.neighbor_proxy)
+		fastd_neighbor_snoop_packet(buffer);
+}
+
+/**
+   Answers an ARP request or neighbor solicitation from the neighbor cache, if the neighbor proxy is enabled
+
+   Returns true if the request has been answered and must not be sent to other peers.
+*/
+static inline bool fastd_neighbor_proxy(const fastd_buffer_t buffer, fastd_peer_t *source) {
+	if (!conf.neighbor_proxy)
+		return false;
+
+	return fastd_neighbor_proxy_packet(buffer, source);
+}
@@ -132,7 +132,7 @@ static void option_config(const char *arg) {
 
 /** Handles the --config-peer option */
 static void option_config_peer(const char *arg) {
-	fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+	fastd_peer_t *peer = fastd_peer_new();
 
 	if(!fastd_config_read(arg, conf.peer_group, peer, 0))
 		exit(1);
@@ -33,6 +33,7 @@
 #include "peer_group.h"
 #include "peer_hashtable.h"
 #include "poll.h"
+#include "route.h"
 
 #include <arpa/inet.h>
 #include <net/if.h>
@@ -148,48 +149,147 @@ static inline void on_disestablish(const fastd_peer_t *peer) {
 	fastd_peer_exec_shell_command(on_disestablish, peer, &peer->local_address, &peer->address, false);
 }
 
-/** Compares two peers by their peer ID */
-static int peer_id_cmp(fastd_peer_t *const *a, fastd_peer_t *const *b) {
-	if ((*a)->id == (*b)->id)
-		return 0;
-	else if ((*a)->id < (*b)->id)
-		return -1;
-	else
-		return 1;
+/** Allocates a new chunk of the peer slab and adds its entries to the free list */
+static void grow_peer_slab(void) {
+	size_t chunk = VECTOR_LEN(ctx.peer_slabs);
+	fastd_peer_t *peers = fastd_alloc_aligned(PEER_SLAB_CHUNK*sizeof(fastd_peer_t), __alignof__(fastd_peer_t));
+	VECTOR_ADD(ctx.peer_slabs, peers);
+
+	size_t i;
+	for (i = PEER_SLAB_CHUNK; i > 0; i--) {
+		fastd_peer_t *peer = &peers[i-1];
+
+		peer->slab_index = chunk*PEER_SLAB_CHUNK + i-1;
+		peer->next = ctx.peer_slab_free;
+		ctx.peer_slab_free = peer;
+	}
 }
 
-/** Finds the entry for a peer with a specified ID in the array \e ctx.peers */
-static fastd_peer_t ** peer_p_find_by_id(uint64_t id) {
-	fastd_peer_t key = {.id = id};
-	fastd_peer_t *const keyp = &key;
+/**
+   Allocates a zeroed peer structure from the peer slab
+
+   The peer must be freed using fastd_peer_free().
+*/
+fastd_peer_t * fastd_peer_new(void) {
+	if (!ctx.peer_slab_free)
+		grow_peer_slab();
+
+	fastd_peer_t *peer = ctx.peer_slab_free;
+	ctx.peer_slab_free = peer->next;
 
-	return VECTOR_BSEARCH(&keyp, ctx.peers, peer_id_cmp);
+	uint32_t slab_index = peer->slab_index;
+	memset(peer, 0, sizeof(*peer));
+	peer->slab_index = slab_index;
+
+	return peer;
 }
 
-/** Finds the index of a peer with a specified ID in the array \e ctx.peers */
-static size_t peer_index_find_by_id(uint64_t id) {
-	fastd_peer_t **ret = peer_p_find_by_id(id);
+/** Returns the peer slab entry with the given index (or NULL if the slab doesn't contain as many entries) */
+static inline fastd_peer_t * peer_slab_entry(size_t index) {
+	if (index >= VECTOR_LEN(ctx.peer_slabs)*PEER_SLAB_CHUNK)
+		return NULL;
 
-	if (!ret)
-		exit_bug("peer_index_find_by_id: not found");
+	return &VECTOR_INDEX(ctx.peer_slabs, index/PEER_SLAB_CHUNK)[index%PEER_SLAB_CHUNK];
+}
 
-	return ret - VECTOR_DATA(ctx.peers);
+/** Returns a peer structure to the peer slab */
+static void release_peer(fastd_peer_t *peer) {
+	if (peer_slab_entry(peer->slab_index) != peer)
+		exit_bug("release_peer: peer not allocated from the peer slab");
+
+	peer->id = 0;
+	peer->next = ctx.peer_slab_free;
+	ctx.peer_slab_free = peer;
 }
 
-/** Finds the index of a peer in the array \e ctx.peers */
-static inline size_t peer_index(fastd_peer_t *peer) {
-	return peer_index_find_by_id(peer->id);
+/** Frees the peer slab after all peers have been deleted */
+void fastd_peer_slab_free(void) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.peer_slabs); i++)
+		free(VECTOR_INDEX(ctx.peer_slabs, i));
+
+	VECTOR_FREE(ctx.peer_slabs);
+	ctx.peer_slab_free = NULL;
 }
 
-/** Finds a peer with a specified ID */
+/**
+   Finds a peer with a specified ID
+
+   The lower 32 bits of a peer ID are the peer's index in the slab, so no search is necessary.
+*/
 fastd_peer_t * fastd_peer_find_by_id(uint64_t id) {
-	fastd_peer_t **ret = peer_p_find_by_id(id);
+	if (!id)
+		return NULL;
 
-	if (ret)
-		return *ret;
-	else
+	fastd_peer_t *peer = peer_slab_entry((uint32_t)id);
+	if (!peer || peer->id != id)
 		return NULL;
 
+	return peer;
+}
+
+/** Appends a peer to the list of all peers */
+static void link_peer(fastd_peer_t *peer) {
+	peer->prev = ctx.peers_tail;
+	peer->next = NULL;
+
+	if (ctx.peers_tail)
+		ctx.peers_tail->next = peer;
+	else
+		ctx.peers = peer;
+
+	ctx.peers_tail = peer;
+	ctx.n_peers++;
+}
+
+/** Removes a peer from the list of all peers */
+static void unlink_peer(fastd_peer_t *peer) {
+	if (peer->prev)
+		peer->prev->next = peer->next;
+	else
+		ctx.peers = peer->next;
+
+	if (peer->next)
+		peer->next->prev = peer->prev;
+	else
+		ctx.peers_tail = peer->prev;
+
+	peer->prev = peer->next = NULL;
+	ctx.n_peers--;
+}
+
+/** Adds a peer to the list of established peers and updates the established counters of its groups */
+static void link_established(fastd_peer_t *peer) {
+	fastd_peer_group_t *group;
+	for (group = peer->group; group; group = group->parent)
+		group->n_established++;
+
+	peer->established_prev = NULL;
+	peer->established_next = ctx.established_peers;
+
+	if (ctx.established_peers)
+		ctx.established_peers->established_prev = peer;
+
+	ctx.established_peers = peer;
+	ctx.n_established++;
+}
+
+/** Removes a peer from the list of established peers and updates the established counters of its groups */
+static void unlink_established(fastd_peer_t *peer) {
+	fastd_peer_group_t *group;
+	for (group = peer->group; group; group = group->parent)
+		group->n_established--;
+
+	if (peer->established_prev)
+		peer->established_prev->established_next = peer->established_next;
+	else
+		ctx.established_peers = peer->established_next;
+
+	if (peer->established_next)
+		peer->established_next->established_prev = peer->established_prev;
+
+	peer->established_prev = peer->established_next = NULL;
+	ctx.n_established--;
 }
 
 /** Closes and frees a peer's dynamic socket */
@@ -266,7 +366,7 @@ static void schedule_peer_task(fastd_peer_t *peer) {
 	else if (fastd_task_timeout(&peer->task) > timeout) {
 		pr_debug2("Replacing scheduled task for %P", peer);
 		fastd_task_unschedule(&peer->task);
-		fastd_task_schedule(&peer->task, TASK_TYPE_PEER, timeout);
+		fastd_task_schedule(&peer->task, TASK_TYPE_PEER, timeout, fastd_timer_slack(timeout - ctx.now));
 	}
 	else {
 		pr_debug2("Keeping scheduled task for %P", peer);
@@ -290,27 +390,11 @@ static void set_next_handshake_default(fastd_peer_t *peer) {
    @param delay	the delay in milliseconds
 */
 void fastd_peer_schedule_handshake(fastd_peer_t *peer, int delay) {
+	fastd_handshake_pacer_cancel(&peer->handshake_pacer);
 	set_next_handshake(peer, delay);
 	schedule_peer_task(peer);
 }
 
-/** Checks if the peer group \e group1 lies in \e group2 */
-static inline bool is_group_in(const fastd_peer_group_t *group1, const fastd_peer_group_t *group2) {
-	while (group1) {
-		if (group1 == group2)
-			return true;
-
-		group1 = group1->parent;
-	}
-
-	return false;
-}
-
-/** Checks if a peer lies in a peer group */
-static bool is_peer_in_group(const fastd_peer_t *peer, const fastd_peer_group_t *group) {
-	return is_group_in(peer->group, group);
-}
-
 /**
    Resets a peer (internal function)
 
@@ -320,6 +404,7 @@ static bool is_peer_in_group(const fastd_peer_t *peer, const fastd_peer_group_t
 */
 static void reset_peer(fastd_peer_t *peer) {
 	if (fastd_peer_is_established(peer)) {
+		unlink_established(peer);
 		on_disestablish(peer);
 		pr_info("connection with %P disestablished.", peer);
 	}
@@ -328,19 +413,11 @@ static void reset_peer(fastd_peer_t *peer) {
 
 	conf.protocol->reset_peer_state(peer);
 
-	size_t i, deleted = 0;
-	for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
-		if (VECTOR_INDEX(ctx.eth_addrs, i).peer == peer) {
-			deleted++;
-		}
-		else if (deleted) {
-			VECTOR_INDEX(ctx.eth_addrs, i-deleted) = VECTOR_INDEX(ctx.eth_addrs, i);
-		}
-	}
-
-	VECTOR_RESIZE(ctx.eth_addrs, VECTOR_LEN(ctx.eth_addrs)-deleted);
+	fastd_peer_eth_addr_remove_peer(peer);
+	fastd_route_remove_peer(peer, true);
 
 	fastd_task_unschedule(&peer->task);
+	fastd_handshake_pacer_cancel(&peer->handshake_pacer);
 
 	fastd_peer_hashtable_remove(peer);
 
@@ -390,6 +467,29 @@ void fastd_peer_handle_resolve(fastd_peer_t *peer, fastd_remote_t *remote, size_
 		init_handshake(peer);
 }
 
+/** Checks if adaptive keepalives are enabled for a peer */
+static bool keepalive_adaptive(const fastd_peer_t *peer) {
+	const fastd_peer_group_t *group = peer->group;
+
+	while (group->parent && !group->keepalive_adaptive.set)
+		group = group->parent;
+
+	return group->keepalive_adaptive.state;
+}
+
+/** Returns the keepalive interval to use for a peer */
+static unsigned get_keepalive_interval(fastd_peer_t *peer) {
+	unsigned interval = *fastd_peer_group_lookup_peer(peer, keepalive_interval);
+
+	if (!keepalive_adaptive(peer))
+		return interval;
+
+	if (!peer->keepalive_probe)
+		peer->keepalive_probe = interval;
+
+	return peer->keepalive_probe;
+}
+
 /** Initializes a peer */
 static void setup_peer(fastd_peer_t *peer) {
 	if (VECTOR_LEN(peer->remotes) == 0) {
@@ -427,6 +527,7 @@ static void setup_peer(fastd_peer_t *peer) {
 	peer->next_handshake = FASTD_TIMEOUT_INV;
 	peer->reset_timeout = FASTD_TIMEOUT_INV;
 	peer->keepalive_timeout = FASTD_TIMEOUT_INV;
+	peer->keepalive_interval = get_keepalive_interval(peer);
 
 	if (fastd_peer_is_dynamic(peer))
 		peer->reset_timeout = ctx.now;
@@ -438,7 +539,7 @@ static void setup_peer(fastd_peer_t *peer) {
 	if (ctx.iface) {
 		peer->iface = ctx.iface;
 	}
-	else if (conf.iface_persist && !peer->iface && !fastd_peer_is_dynamic(peer)) {
+	else if (conf.iface_persist && !peer->iface && !fastd_peer_is_dynamic(peer) && !fastd_relay_mode()) {
 		peer->iface = fastd_iface_open(peer);
 		if (peer->iface)
 			on_up(peer, true);
@@ -488,10 +589,11 @@ void fastd_peer_free(fastd_peer_t *peer) {
 	}
 
 	VECTOR_FREE(peer->remotes);
+	VECTOR_FREE(peer->routes);
 
 	free(peer->ifname);
 	free(peer->name);
-	free(peer);
+	release_peer(peer);
 }
 
 /** Deletes a peer */
@@ -499,8 +601,10 @@ static void delete_peer(fastd_peer_t *peer) {
 	if (fastd_peer_is_dynamic(peer) || peer->config_source_dir)
 		pr_verbose("deleting peer %P", peer);
 
-	size_t i = peer_index(peer);
-	VECTOR_DELETE(ctx.peers, i);
+	unlink_peer(peer);
+
+	fastd_peer_owner_remove(peer);
+	fastd_route_remove_peer(peer, false);
 
 	conf.protocol->free_peer_state(peer);
 
@@ -633,30 +737,20 @@ bool fastd_peer_claim_address(fastd_peer_t *new_peer, fastd_socket_t *sock, cons
 			fastd_peer_reset(new_peer);
 	}
 	else {
-		size_t i;
-		for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-			fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
-
-			if (peer == new_peer)
-				continue;
+		if (fastd_peer_owner_lookup(remote_addr, new_peer)) {
+			reset_peer_address(new_peer);
+			return false;
+		}
 
-			if (!fastd_peer_is_enabled(peer))
-				continue;
+		fastd_peer_t *peer = fastd_peer_hashtable_lookup(remote_addr);
 
-			if (fastd_peer_owns_address(peer, remote_addr)) {
+		if (peer && peer != new_peer && fastd_peer_is_enabled(peer)) {
+			if (!force && fastd_peer_is_established(peer)) {
 				reset_peer_address(new_peer);
 				return false;
 			}
 
-			if (fastd_peer_address_equal(&peer->address, remote_addr)) {
-				if (!force && fastd_peer_is_established(peer)) {
-					reset_peer_address(new_peer);
-					return false;
-				}
-
-				reset_peer_address(peer);
-				break;
-			}
+			reset_peer_address(peer);
 		}
 	}
 
@@ -691,19 +785,6 @@ void fastd_peer_delete(fastd_peer_t *peer) {
 	delete_peer(peer);
 }
 
-/** Counts how many peers in the given peer group have established a connection */
-static inline size_t count_established_group_peers(const fastd_peer_group_t *group) {
-	size_t i, ret = 0;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
-
-		if (fastd_peer_is_established(peer) && is_peer_in_group(peer, group))
-			ret++;
-	}
-
-	return ret;
-}
-
 /** Checks if a peer may currently establish a connection */
 bool fastd_peer_may_connect(fastd_peer_t *peer) {
 	if (fastd_peer_is_established(peer))
@@ -715,7 +796,7 @@ bool fastd_peer_may_connect(fastd_peer_t *peer) {
 		if (group->max_connections < 0)
 			continue;
 
-		if (count_established_group_peers(group) >= (size_t)group->max_connections)
+		if (group->n_established >= (size_t)group->max_connections)
 			return false;
 	}
 
@@ -747,6 +828,14 @@ static inline bool peer_configs_equal(const fastd_peer_t *peer1, const fastd_pee
 			return false;
 	}
 
+	if (VECTOR_LEN(peer1->routes) != VECTOR_LEN(peer2->routes))
+		return false;
+
+	for (i = 0; i < VECTOR_LEN(peer1->routes); i++) {
+		if (!fastd_route_prefix_equal(&VECTOR_INDEX(peer1->routes, i), &VECTOR_INDEX(peer2->routes, i)))
+			return false;
+	}
+
 	return true;
 }
 
@@ -800,9 +889,11 @@ bool fastd_peer_add(fastd_peer_t *peer) {
 		}
 	}
 
-	peer->id = ctx.next_peer_id++;
+	peer->id = (++ctx.next_peer_id << 32) | peer->slab_index;
 
-	VECTOR_ADD(ctx.peers, peer);
+	link_peer(peer);
+	fastd_peer_owner_insert(peer);
+	fastd_route_add_peer(peer);
 
 	conf.protocol->init_peer_state(peer);
 
@@ -857,7 +948,7 @@ bool fastd_peer_set_established(fastd_peer_t *peer) {
 	if (fastd_peer_is_established(peer))
 		return true;
 
-	if (!peer->iface) {
+	if (!peer->iface && !fastd_relay_mode()) {
 		peer->iface = fastd_iface_open(peer);
 		if (!peer->iface)
 			return false;
@@ -867,6 +958,8 @@ bool fastd_peer_set_established(fastd_peer_t *peer) {
 
 	peer->state = STATE_ESTABLISHED;
 	peer->established = ctx.now;
+	peer->keepalive_interval = get_keepalive_interval(peer);
+	link_established(peer);
 	fastd_peer_seen(peer);
 	fastd_peer_clear_keepalive(peer);
 
@@ -878,58 +971,87 @@ bool fastd_peer_set_established(fastd_peer_t *peer) {
 	return true;
 }
 
-/** Compares two MAC addresses */
-static inline int eth_addr_cmp(const fastd_eth_addr_t *addr1, const fastd_eth_addr_t *addr2) {
-	return memcmp(addr1->data, addr2->data, sizeof(fastd_eth_addr_t));
-}
+/**
+   Checks if a due keepalive may be postponed, returning the new keepalive timeout (or 0 if the keepalive must be sent now)
 
-/** Compares two fastd_peer_eth_addr_t entries by their MAC addresses */
-static int peer_eth_addr_cmp(const fastd_peer_eth_addr_t *addr1, const fastd_peer_eth_addr_t *addr2) {
-	return eth_addr_cmp(&addr1->addr, &addr2->addr);
+   When payload has been received from a peer recently, the connection is obviously alive, so
+   keepalives can be skipped as long as the peer still hears from us often enough not to consider
+   the connection stale. Adaptive keepalives never postpone, as their interval is chosen to keep
+   the peer's NAT mapping alive, which depends on the traffic we send.
+*/
+static fastd_timeout_t keepalive_postponed(const fastd_peer_t *peer) {
+	if (keepalive_adaptive(peer))
+		return 0;
+
+	fastd_timeout_t timeout = fastd_timeout_min(peer->last_data_received + peer->keepalive_interval,
+						    peer->last_sent + KEEPALIVE_MAX_INTERVAL);
+
+	if (fastd_timed_out(timeout))
+		return 0;
+
+	return timeout;
 }
 
-/** Adds a MAC address to the sorted list of addresses associated with a peer (or updates the timeout of an existing entry) */
-void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
-	size_t min = 0, max = VECTOR_LEN(ctx.eth_addrs);
+/**
+   Updates the adaptive keepalive interval when a keepalive is sent
+
+   A keepalive is only sent after nothing has been sent to the peer for a whole keepalive interval. If
+   we have heard from the peer during this time, the connection (and the NAT mapping on the way) has
+   survived the interval. After KEEPALIVE_PROBE_PERIODS such periods the interval is confirmed and
+   the next longer interval is probed, up to KEEPALIVE_MAX_INTERVAL.
+*/
+static void keepalive_probe_update(fastd_peer_t *peer) {
+	if (!keepalive_adaptive(peer))
+		return;
+
+	if (peer->last_received <= peer->last_sent) {
+		peer->keepalive_probe_periods = 0;
+		return;
+	}
 
-	if (peer && !fastd_peer_is_established(peer))
-		exit_bug("tried to learn ethernet address on non-established peer");
+	if (++peer->keepalive_probe_periods < KEEPALIVE_PROBE_PERIODS)
+		return;
 
-	while (max > min) {
-		size_t cur = min + (max - min)/2;
-		int cmp = eth_addr_cmp(&addr, &VECTOR_INDEX(ctx.eth_addrs, cur).addr);
+	peer->keepalive_probe_periods = 0;
 
-		if (cmp == 0) {
-			VECTOR_INDEX(ctx.eth_addrs, cur).peer = peer;
-			VECTOR_INDEX(ctx.eth_addrs, cur).timeout = ctx.now + ETH_ADDR_STALE_TIME;
-			return; /* We're done here. */
-		}
-		else if (cmp < 0) {
-			max = cur;
-		}
-		else {
-			min = cur+1;
-		}
+	if (peer->keepalive_probe > peer->keepalive_confirmed) {
+		peer->keepalive_confirmed = peer->keepalive_probe;
+		pr_debug("keepalive interval of %u ms confirmed for %P", peer->keepalive_confirmed, peer);
 	}
 
-	VECTOR_INSERT(ctx.eth_addrs, ((fastd_peer_eth_addr_t) {addr, peer, ctx.now + ETH_ADDR_STALE_TIME}), min);
+	if (peer->keepalive_probe >= KEEPALIVE_MAX_INTERVAL || !fastd_timed_out(peer->keepalive_probe_hold))
+		return;
 
-	if (peer)
-		pr_debug("learned new MAC address %E on peer %P", &addr, peer);
-	else
-		pr_debug("learned new local MAC address %E", &addr);
+	peer->keepalive_probe += peer->keepalive_probe/4;
+	if (peer->keepalive_probe > KEEPALIVE_MAX_INTERVAL)
+		peer->keepalive_probe = KEEPALIVE_MAX_INTERVAL;
+
+	peer->keepalive_interval = peer->keepalive_probe;
+	pr_debug("probing keepalive interval of %u ms for %P", peer->keepalive_probe, peer);
 }
 
-/** Finds the peer that is associated with a given MAC address */
-bool fastd_peer_find_by_eth_addr(const fastd_eth_addr_t addr, fastd_peer_t **peer) {
-	const fastd_peer_eth_addr_t key = {.addr = addr};
-	fastd_peer_eth_addr_t *peer_eth_addr = VECTOR_BSEARCH(&key, ctx.eth_addrs, peer_eth_addr_cmp);
+/**
+   Shortens the adaptive keepalive interval after an established connection has become stale
 
-	if (!peer_eth_addr)
-		return false;
+   Falls back to the last confirmed interval if a longer one was being probed, and to a shorter
+   interval otherwise. Longer intervals aren't probed again for KEEPALIVE_PROBE_HOLD.
+*/
+static void keepalive_probe_failed(fastd_peer_t *peer) {
+	if (peer->keepalive_confirmed && peer->keepalive_probe > peer->keepalive_confirmed) {
+		peer->keepalive_probe = peer->keepalive_confirmed;
+	}
+	else {
+		peer->keepalive_probe -= peer->keepalive_probe/4;
+		if (peer->keepalive_probe < KEEPALIVE_MIN_INTERVAL)
+			peer->keepalive_probe = KEEPALIVE_MIN_INTERVAL;
 
-	*peer = peer_eth_addr->peer;
-	return true;
+		peer->keepalive_confirmed = 0;
+	}
+
+	peer->keepalive_probe_periods = 0;
+	peer->keepalive_probe_hold = ctx.now + KEEPALIVE_PROBE_HOLD;
+
+	pr_verbose("connection with %P became stale, using keepalive interval of %u ms", peer, peer->keepalive_probe);
 }
 
 /** Sends a handshake to one peer, if a scheduled handshake is due */
@@ -971,17 +1093,56 @@ static void handle_task_handshake(fastd_peer_t *peer) {
 		fastd_resolve_peer(peer, next_remote);
 }
 
+/** Sends a handshake that has been delayed by the handshake pacer */
+static void run_paced_handshake(fastd_handshake_pacer_entry_t *entry) {
+	fastd_peer_t *peer = container_of(entry, fastd_peer_t, handshake_pacer);
+
+	handle_task_handshake(peer);
+	schedule_peer_task(peer);
+}
+
+/** Skips a handshake that has been dropped by the handshake pacer */
+static void drop_paced_handshake(fastd_handshake_pacer_entry_t *entry) {
+	fastd_peer_t *peer = container_of(entry, fastd_peer_t, handshake_pacer);
+
+	pr_debug("not sending a handshake to %P (too many pending handshakes)", peer);
+
+	set_next_handshake_default(peer);
+	schedule_peer_task(peer);
+}
+
+/**
+   Passes a due handshake to the handshake pacer
+
+   The handshake is removed from the peer's schedule while it is waiting for the
+   pacer, so the peer task isn't run again in the meantime.
+*/
+static void submit_handshake(fastd_peer_t *peer) {
+	peer->next_handshake = FASTD_TIMEOUT_INV;
+
+	peer->handshake_pacer.priority = fastd_peer_handshake_priority(peer);
+	peer->handshake_pacer.timeout = FASTD_TIMEOUT_INV;
+	peer->handshake_pacer.run = run_paced_handshake;
+	peer->handshake_pacer.drop = drop_paced_handshake;
+
+	fastd_handshake_pacer_submit(&peer->handshake_pacer);
+}
+
 /**
    Performs maintenance tasks for a peer
 
    \li If no data was received from the peer for some time, it is reset.
-   \li If no data was sent to the peer for some time, a keepalive is sent.
+   \li If no data was sent to the peer for some time, a keepalive is sent (unless payload has been
+   received from the peer recently, see keepalive_postponed()).
  */
 void fastd_peer_handle_task(fastd_task_t *task) {
 	fastd_peer_t *peer = container_of(task, fastd_peer_t, task);
 
 	/* check for peer timeout */
 	if (fastd_timed_out(peer->reset_timeout)) {
+		if (fastd_peer_is_established(peer) && keepalive_adaptive(peer))
+			keepalive_probe_failed(peer);
+
 		if (fastd_peer_is_dynamic(peer))
 			fastd_peer_delete(peer);
 		else
@@ -992,46 +1153,37 @@ void fastd_peer_handle_task(fastd_task_t *task) {
 
 	/* check for keepalive timeout */
 	if (fastd_timed_out(peer->keepalive_timeout)) {
-		pr_debug2("sending keepalive to %P", peer);
-		conf.protocol->send(peer, fastd_buffer_alloc(0, conf.min_encrypt_head_space, conf.min_encrypt_tail_space));
-	}
-
-	if (fastd_timed_out(peer->next_handshake))
-		handle_task_handshake(peer);
+		fastd_timeout_t postponed = keepalive_postponed(peer);
 
-	schedule_peer_task(peer);
-}
-
-/** Removes all time-outed MAC addresses from \e ctx.eth_addrs */
-void fastd_peer_eth_addr_cleanup(void) {
-	size_t i, deleted = 0;
-
-	for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
-		if (fastd_timed_out(VECTOR_INDEX(ctx.eth_addrs, i).timeout)) {
-			deleted++;
-			pr_debug("MAC address %E not seen for more than %u seconds, removing",
-				 &VECTOR_INDEX(ctx.eth_addrs, i).addr, ETH_ADDR_STALE_TIME/1000);
+		if (postponed) {
+			pr_debug2("postponing keepalive to %P", peer);
+			peer->keepalive_timeout = postponed;
+			ctx.keepalives_suppressed++;
 		}
-		else if (deleted) {
-			VECTOR_INDEX(ctx.eth_addrs, i-deleted) = VECTOR_INDEX(ctx.eth_addrs, i);
+		else {
+			keepalive_probe_update(peer);
+
+			pr_debug2("sending keepalive to %P", peer);
+			conf.protocol->send(peer, fastd_buffer_alloc(0, conf.min_encrypt_head_space, conf.min_encrypt_tail_space));
+			ctx.keepalives_sent++;
 		}
 	}
 
-	VECTOR_RESIZE(ctx.eth_addrs, VECTOR_LEN(ctx.eth_addrs)-deleted);
+	if (fastd_timed_out(peer->next_handshake))
+		submit_handshake(peer);
+
+	schedule_peer_task(peer);
 }
 
 /** Resets all peers */
 void fastd_peer_reset_all(void) {
-	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers);) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+	fastd_peer_t *peer, *next;
+	for (peer = ctx.peers; peer; peer = next) {
+		next = peer->next;
 
-		if (fastd_peer_is_dynamic(peer)) {
+		if (fastd_peer_is_dynamic(peer))
 			fastd_peer_delete(peer);
-		}
-		else {
+		else
 			fastd_peer_reset(peer);
-			i++;
-		}
 	}
 }
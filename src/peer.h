@@ -54,43 +54,74 @@ typedef enum fastd_peer_config_state {
 #endif
 } fastd_peer_config_state_t;
 
-/** A peer's configuration and state */
-struct fastd_peer {
+/**
+   A peer's configuration and state
+
+   The fields read and written for every packet come first and fit into the first three
+   cache lines of a peer (see the assertion below). The traffic statistics are kept behind
+   the configuration, so they don't push the connection state out of these lines. Peers are
+   allocated from a slab (see fastd_peer_new()), which keeps them aligned to cache lines.
+*/
+struct __attribute__((aligned(64))) fastd_peer {
+	/* Hot fields accessed by the data path: */
+
+	fastd_peer_state_t state;			/**< The peer's state */
+	uint32_t eth_addrs;				/**< The first entry of the list of MAC addresses learned on this peer (0 if there is none) */
+
+	/** The socket used by the peer. This can either be a common bound socket or a
+	    dynamic, unbound socket that is used exclusively by this peer */
+	fastd_socket_t *sock;
+	fastd_iface_t *iface;				/**< The interface this peer is associated with */
+	fastd_protocol_peer_state_t *protocol_state;	/**< Protocol-specific peer state */
+
+	fastd_peer_t *established_prev;			/**< The previous peer in the list of established peers */
+	fastd_peer_t *established_next;			/**< The next peer in the list of established peers */
+
+	fastd_timeout_t reset_timeout;			/**< The timeout after which the peer is reset */
+	fastd_timeout_t keepalive_timeout;		/**< The timeout after which a keepalive is sent to the peer */
+	fastd_timeout_t last_sent;			/**< The time a packet was last sent to the peer */
+	fastd_timeout_t last_received;			/**< The time a valid packet was last received from the peer */
+	fastd_timeout_t last_data_received;		/**< The time a payload packet was last received from the peer */
+	unsigned keepalive_interval;			/**< The keepalive interval currently used for the peer (in milliseconds) */
+
+	fastd_peer_address_t address;			/**< The peers current address */
+	fastd_peer_address_t local_address;		/**< The local address used to communicate with this peer (last hot field) */
+
 	/* The following fields are more or less static configuration: */
 
 	uint64_t id;					/**< A unique ID assigned to each peer */
+	uint32_t slab_index;				/**< The index of the peer in the peer slab */
+
+	fastd_peer_t *prev;				/**< The previous peer in the list of all peers */
+	fastd_peer_t *next;				/**< The next peer in the list of all peers (or the next unused entry of the peer slab) */
 
 	char *name;					/**< The peer's name */
-	const fastd_peer_group_t *group;		/**< The peer group the peer belongs to */
+	fastd_peer_group_t *group;			/**< The peer group the peer belongs to */
 	const char *config_source_dir;			/**< The directory this peer's configuration was loaded from */
 
 	VECTOR(fastd_remote_t) remotes;			/**< The vector of the peer's remotes */
+	VECTOR(fastd_route_prefix_t) routes;		/**< The prefixes routed to the peer in TUN mode with a shared interface */
 	bool floating;					/**< Specifies if the peer has any floating remotes */
 
 	fastd_peer_config_state_t config_state;		/**< Specifies the way this peer was configured and if it is enabled */
 
 	fastd_protocol_key_t *key;			/**< The peer's public key */
-	fastd_protocol_peer_state_t *protocol_state;	/**< Protocol-specific peer state */
 
 	char *ifname;					/**< Peer-specific interface name */
 	uint16_t mtu;					/**< Peer-specific interface MTU */
 
-	/* Starting here, more dynamic fields follow: */
+	fastd_stats_t stats;				/**< Traffic statistics */
 
-	fastd_iface_t *iface;				/**< The interface this peer is associated with */
-	/** The socket used by the peer. This can either be a common bound socket or a
-	    dynamic, unbound socket that is used exclusively by this peer */
-	fastd_socket_t *sock;
-	fastd_peer_address_t local_address;		/**< The local address used to communicate with this peer */
-	fastd_peer_address_t address;			/**< The peers current address */
+	/* Starting here, more dynamic fields used for connection management follow: */
 
 	fastd_peer_address_t last_handshake_address;	/**< The address the last handshake was sent to */
 	fastd_peer_address_t last_handshake_response_address; /**< The address the last handshake was received from */
 	ssize_t next_remote;				/**< An index into the field remotes or -1 */
 
-	fastd_peer_state_t state;			/**< The peer's state */
+	unsigned learned_routes;			/**< The number of routes learned from packets received from the peer */
 
 	fastd_task_t task;				/**< Task queue entry for periodic maintenance tasks */
+	fastd_handshake_pacer_entry_t handshake_pacer;	/**< Handshake pacer entry for a handshake that is due */
 
 	fastd_timeout_t next_handshake;			/**< The time of the next handshake */
 	fastd_timeout_t last_handshake_timeout;		/**< No handshakes are sent to the peer until this timeout has occured to avoid flooding the peer */
@@ -98,10 +129,10 @@ struct fastd_peer {
 	fastd_timeout_t establish_handshake_timeout;	/**< A timeout during which all handshakes for this peer will be ignored after a new connection has been established */
 	int64_t established;				/**< The time this peer connection has been established */
 
-	fastd_timeout_t reset_timeout;			/**< The timeout after which the peer is reset */
-	fastd_timeout_t keepalive_timeout;		/**< The timeout after which a keepalive is sent to the peer */
-
-	fastd_stats_t stats;				/**< Traffic statistics */
+	unsigned keepalive_probe;			/**< The keepalive interval currently probed by adaptive keepalives (0 if probing hasn't started yet) */
+	unsigned keepalive_confirmed;			/**< The longest keepalive interval that has kept the connection alive (0 if there is none yet) */
+	unsigned keepalive_probe_periods;		/**< The number of successful keepalive periods at the probed interval */
+	fastd_timeout_t keepalive_probe_hold;		/**< No longer keepalive intervals are probed until this timeout has occured */
 
 #ifdef WITH_DYNAMIC_PEERS
 	fastd_timeout_t verify_timeout;			/**< Specifies the minimum time after which on-verify may be run again */
@@ -109,12 +140,22 @@ struct fastd_peer {
 #endif
 };
 
+_Static_assert(offsetof(fastd_peer_t, local_address) + sizeof(fastd_peer_address_t) <= 3*64,
+	       "the hot fields of fastd_peer_t don't fit into three cache lines");
+
 
 /** An entry for a MAC address seen at another peer */
 struct fastd_peer_eth_addr {
 	fastd_eth_addr_t addr;				/**< The MAC address */
+	uint16_t wheel_slot;				/**< The expiry wheel slot the entry is linked into */
+	uint32_t hash;					/**< The hash of the MAC address */
 	fastd_peer_t *peer;				/**< The corresponding peer */
 	fastd_timeout_t timeout;			/**< Timeout after which the address entry will be purged */
+
+	uint32_t peer_prev;				/**< The previous entry of the same peer (0 if there is none) */
+	uint32_t peer_next;				/**< The next entry of the same peer, or the next free entry (0 if there is none) */
+	uint32_t wheel_prev;				/**< The previous entry in the same wheel slot (0 if there is none) */
+	uint32_t wheel_next;				/**< The next entry in the same wheel slot (0 if there is none) */
 };
 
 /** A remote entry */
@@ -134,6 +175,9 @@ bool fastd_peer_address_equal(const fastd_peer_address_t *addr1, const fastd_pee
 void fastd_peer_address_simplify(fastd_peer_address_t *addr);
 void fastd_peer_address_widen(fastd_peer_address_t *addr);
 
+fastd_peer_t * fastd_peer_new(void);
+void fastd_peer_slab_free(void);
+
 bool fastd_peer_add(fastd_peer_t *peer);
 void fastd_peer_reset(fastd_peer_t *peer);
 void fastd_peer_delete(fastd_peer_t *peer);
@@ -153,6 +197,8 @@ void fastd_peer_exec_shell_command(const fastd_shell_command_t *command, const f
 
 void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr);
 bool fastd_peer_find_by_eth_addr(const fastd_eth_addr_t addr, fastd_peer_t **peer);
+void fastd_peer_eth_addr_remove_peer(fastd_peer_t *peer);
+void fastd_peer_eth_addr_free(void);
 
 void fastd_peer_handle_task(fastd_task_t *task);
 void fastd_peer_eth_addr_cleanup(void);
@@ -187,6 +233,7 @@ static inline void fastd_peer_schedule_handshake_default(fastd_peer_t *peer) {
 /** Cancels a scheduled handshake */
 static inline void fastd_peer_unschedule_handshake(fastd_peer_t *peer) {
 	peer->next_handshake = FASTD_TIMEOUT_INV;
+	fastd_handshake_pacer_cancel(&peer->handshake_pacer);
 }
 
 #ifdef WITH_DYNAMIC_PEERS
@@ -207,7 +254,7 @@ static inline void fastd_peer_set_verified(fastd_peer_t *peer, bool ok) {
 
 /** Checks if there's a handshake queued for the peer */
 static inline bool fastd_peer_handshake_scheduled(fastd_peer_t *peer) {
-	return (peer->next_handshake != FASTD_TIMEOUT_INV);
+	return (peer->next_handshake != FASTD_TIMEOUT_INV || fastd_handshake_pacer_queued(&peer->handshake_pacer));
 }
 
 /** Checks if a peer is floating (is has at least one floating remote or no remotes at all) */
@@ -256,14 +303,26 @@ static inline bool fastd_peer_is_established(const fastd_peer_t *peer) {
 	}
 }
 
+/** Returns the handshake pacer priority of handshakes with a peer */
+static inline fastd_handshake_priority_t fastd_peer_handshake_priority(const fastd_peer_t *peer) {
+	if (fastd_peer_is_established(peer))
+		return HANDSHAKE_PRIORITY_REFRESH;
+	else if (fastd_peer_is_dynamic(peer))
+		return HANDSHAKE_PRIORITY_DYNAMIC;
+	else
+		return HANDSHAKE_PRIORITY_STATIC;
+}
+
 /** Signals that a valid packet was received from the peer */
 static inline void fastd_peer_seen(fastd_peer_t *peer) {
 	peer->reset_timeout = ctx.now + PEER_STALE_TIME;
+	peer->last_received = ctx.now;
 }
 
-/** Resets the keepalive timeout */
+/** Resets the keepalive timeout after a packet has been sent to the peer */
 static inline void fastd_peer_clear_keepalive(fastd_peer_t *peer) {
-	peer->keepalive_timeout = ctx.now + KEEPALIVE_TIMEOUT;
+	peer->last_sent = ctx.now;
+	peer->keepalive_timeout = ctx.now + peer->keepalive_interval;
 }
 
 /** Checks if a peer uses dynamic sockets (which means that each connection attempt uses a new socket) */
@@ -287,7 +346,17 @@ static inline bool fastd_eth_addr_is_unicast(fastd_eth_addr_t addr) {
 	return ((addr.data[0] & 1) == 0);
 }
 
-/** Adds statistics for a single packet of a given size */
+/** Returns the first MAC address entry learned on a peer, or NULL if there is none */
+static inline const fastd_peer_eth_addr_t * fastd_peer_eth_addr_first(const fastd_peer_t *peer) {
+	return peer->eth_addrs ? &ctx.eth_addr_entries[peer->eth_addrs] : NULL;
+}
+
+/** Returns the next MAC address entry of the same peer, or NULL if there is none */
+static inline const fastd_peer_eth_addr_t * fastd_peer_eth_addr_next(const fastd_peer_eth_addr_t *entry) {
+	return entry->peer_next ? &ctx.eth_addr_entries[entry->peer_next] : NULL;
+}
+
+/** Adds statistics for a single packet of a given size (\e peer may be NULL to only update the global statistics) */
 static inline void fastd_stats_add(UNUSED fastd_peer_t *peer, UNUSED fastd_stat_type_t stat, UNUSED size_t bytes) {
 #ifdef WITH_STATUS_SOCKET
 	if (!bytes)
@@ -296,6 +365,9 @@ static inline void fastd_stats_add(UNUSED fastd_peer_t *peer, UNUSED fastd_stat_
 	ctx.stats.packets[stat]++;
 	ctx.stats.bytes[stat] += bytes;
 
+	if (!peer)
+		return;
+
 	peer->stats.packets[stat]++;
 	peer->stats.bytes[stat] += bytes;
 #endif
@@ -0,0 +1,359 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Table of MAC addresses learned on peers in TAP mode
+
+   The entries are stored in a pool and indexed by an open-addressing hashtable with
+   linear probing. Each entry is also linked into the list of its peer, so a peer's
+   addresses can be enumerated and removed without scanning the whole table, and into a
+   slot of a timer wheel, which is processed incrementally by the maintenance task to
+   purge stale addresses. Entries are linked by their pool indices; index 0 is never
+   used, so it terminates the lists.
+
+   Refreshing an entry only updates its timeout; entries are moved to a later wheel slot
+   lazily when their current slot is processed.
+*/
+
+
+#include "peer.h"
+#include "hash.h"
+
+
+/** Returns the entry with the given pool index */
+static inline fastd_peer_eth_addr_t * get_entry(uint32_t i) {
+	return &ctx.eth_addr_entries[i];
+}
+
+/** Checks if two MAC addresses are equal */
+static inline bool eth_addr_equal(const fastd_eth_addr_t *addr1, const fastd_eth_addr_t *addr2) {
+	return memcmp(addr1->data, addr2->data, sizeof(fastd_eth_addr_t)) == 0;
+}
+
+/** Hashes a MAC address */
+static inline uint32_t eth_addr_hash(const fastd_eth_addr_t *addr) {
+	uint32_t hash = ctx.eth_addr_seed;
+	fastd_hash(&hash, addr->data, sizeof(addr->data));
+	fastd_hash_final(&hash);
+	return hash;
+}
+
+/** Returns the wheel tick an entry with a given timeout should be processed at */
+static inline int64_t timeout_tick(fastd_timeout_t timeout) {
+	return (timeout + ETH_ADDR_WHEEL_TICK - 1) / ETH_ADDR_WHEEL_TICK;
+}
+
+
+/** Adds the entries from \e first to \e last to the free list */
+static void add_free_entries(uint32_t first, uint32_t last) {
+	uint32_t i;
+	for (i = last; i >= first; i--) {
+		get_entry(i)->peer_next = ctx.eth_addr_free;
+		ctx.eth_addr_free = i;
+	}
+}
+
+/** Initializes the MAC address table */
+static void init_table(void) {
+	fastd_random_bytes(&ctx.eth_addr_seed, sizeof(ctx.eth_addr_seed), false);
+
+	ctx.eth_addr_size = ETH_ADDR_TABLE_INITIAL_SIZE;
+	ctx.eth_addr_entries = fastd_new0_array(ctx.eth_addr_size, fastd_peer_eth_addr_t);
+	add_free_entries(1, ctx.eth_addr_size-1);
+
+	ctx.eth_addr_slots_size = 2*ctx.eth_addr_size;
+	ctx.eth_addr_slots = fastd_new0_array(ctx.eth_addr_slots_size, uint32_t);
+
+	ctx.eth_addr_wheel_tick = ctx.now / ETH_ADDR_WHEEL_TICK;
+}
+
+/** Frees the MAC address table */
+void fastd_peer_eth_addr_free(void) {
+	free(ctx.eth_addr_entries);
+	free(ctx.eth_addr_slots);
+
+	ctx.eth_addr_entries = NULL;
+	ctx.eth_addr_slots = NULL;
+}
+
+/** Finds the hashtable slot containing an address, or the empty slot it would be inserted at */
+static size_t find_slot(const fastd_eth_addr_t *addr, uint32_t hash) {
+	size_t mask = ctx.eth_addr_slots_size - 1;
+	size_t s = hash & mask;
+
+	while (true) {
+		uint32_t i = ctx.eth_addr_slots[s];
+		if (!i)
+			return s;
+
+		const fastd_peer_eth_addr_t *entry = get_entry(i);
+		if (entry->hash == hash && eth_addr_equal(&entry->addr, addr))
+			return s;
+
+		s = (s+1) & mask;
+	}
+}
+
+/** Removes the index in a given slot from the hashtable, moving back entries of the following probe sequence */
+static void clear_slot(size_t s) {
+	size_t mask = ctx.eth_addr_slots_size - 1;
+	size_t j = s;
+
+	while (true) {
+		j = (j+1) & mask;
+
+		uint32_t i = ctx.eth_addr_slots[j];
+		if (!i)
+			break;
+
+		/* The entry may be moved to s unless its home slot lies cyclically in (s, j] */
+		size_t home = get_entry(i)->hash & mask;
+		if (((j - home) & mask) < ((j - s) & mask))
+			continue;
+
+		ctx.eth_addr_slots[s] = i;
+		s = j;
+	}
+
+	ctx.eth_addr_slots[s] = 0;
+}
+
+/** Doubles the size of the entry pool and the hashtable */
+static void grow_table(void) {
+	size_t old_size = ctx.eth_addr_size, old_slots_size = ctx.eth_addr_slots_size;
+	uint32_t *old_slots = ctx.eth_addr_slots;
+
+	if (old_size > UINT32_MAX/2)
+		exit_bug("MAC address table overflow");
+
+	ctx.eth_addr_size *= 2;
+	ctx.eth_addr_entries = fastd_realloc_array(ctx.eth_addr_entries, ctx.eth_addr_size, sizeof(fastd_peer_eth_addr_t));
+	add_free_entries(old_size, ctx.eth_addr_size-1);
+
+	ctx.eth_addr_slots_size = 2*ctx.eth_addr_size;
+	ctx.eth_addr_slots = fastd_new0_array(ctx.eth_addr_slots_size, uint32_t);
+
+	pr_debug("resizing MAC address hashtable to %u slots", (unsigned)ctx.eth_addr_slots_size);
+
+	size_t s;
+	for (s = 0; s < old_slots_size; s++) {
+		uint32_t i = old_slots[s];
+		if (!i)
+			continue;
+
+		const fastd_peer_eth_addr_t *entry = get_entry(i);
+		ctx.eth_addr_slots[find_slot(&entry->addr, entry->hash)] = i;
+	}
+
+	free(old_slots);
+}
+
+
+/** Links an entry into the list of its peer */
+static void peer_link(uint32_t i) {
+	fastd_peer_eth_addr_t *entry = get_entry(i);
+
+	entry->peer_prev = 0;
+	entry->peer_next = 0;
+
+	if (!entry->peer)
+		return;
+
+	entry->peer_next = entry->peer->eth_addrs;
+	if (entry->peer_next)
+		get_entry(entry->peer_next)->peer_prev = i;
+	entry->peer->eth_addrs = i;
+}
+
+/** Unlinks an entry from the list of its peer */
+static void peer_unlink(uint32_t i) {
+	fastd_peer_eth_addr_t *entry = get_entry(i);
+
+	if (!entry->peer)
+		return;
+
+	if (entry->peer_prev)
+		get_entry(entry->peer_prev)->peer_next = entry->peer_next;
+	else
+		entry->peer->eth_addrs = entry->peer_next;
+
+	if (entry->peer_next)
+		get_entry(entry->peer_next)->peer_prev = entry->peer_prev;
+}
+
+/** Links an entry into the wheel slot of the given tick */
+static void wheel_link(uint32_t i, int64_t tick) {
+	fastd_peer_eth_addr_t *entry = get_entry(i);
+	size_t slot = tick % ETH_ADDR_WHEEL_SLOTS;
+
+	entry->wheel_slot = slot;
+	entry->wheel_prev = 0;
+	entry->wheel_next = ctx.eth_addr_wheel[slot];
+	if (entry->wheel_next)
+		get_entry(entry->wheel_next)->wheel_prev = i;
+	ctx.eth_addr_wheel[slot] = i;
+}
+
+/** Unlinks an entry from its wheel slot */
+static void wheel_unlink(uint32_t i) {
+	fastd_peer_eth_addr_t *entry = get_entry(i);
+
+	if (entry->wheel_prev)
+		get_entry(entry->wheel_prev)->wheel_next = entry->wheel_next;
+	else
+		ctx.eth_addr_wheel[entry->wheel_slot] = entry->wheel_next;
+
+	if (entry->wheel_next)
+		get_entry(entry->wheel_next)->wheel_prev = entry->wheel_prev;
+}
+
+/** Removes an entry from all lists and the hashtable and returns it to the free list */
+static void remove_entry(uint32_t i) {
+	fastd_peer_eth_addr_t *entry = get_entry(i);
+
+	peer_unlink(i);
+	wheel_unlink(i);
+	clear_slot(find_slot(&entry->addr, entry->hash));
+
+	entry->peer = NULL;
+	entry->peer_next = ctx.eth_addr_free;
+	ctx.eth_addr_free = i;
+
+	ctx.eth_addr_used--;
+}
+
+
+/** Adds a MAC address to the table of addresses associated with a peer (or updates the timeout of an existing entry) */
+void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
+	if (peer && !fastd_peer_is_established(peer))
+		exit_bug("tried to learn ethernet address on non-established peer");
+
+	if (!ctx.eth_addr_slots)
+		init_table();
+
+	uint32_t hash = eth_addr_hash(&addr);
+	size_t s = find_slot(&addr, hash);
+	uint32_t i = ctx.eth_addr_slots[s];
+
+	if (i) {
+		fastd_peer_eth_addr_t *entry = get_entry(i);
+		entry->timeout = ctx.now + ETH_ADDR_STALE_TIME;
+
+		if (entry->peer != peer) {
+			peer_unlink(i);
+			entry->peer = peer;
+			peer_link(i);
+		}
+
+		return; /* We're done here. */
+	}
+
+	if (!ctx.eth_addr_free) {
+		grow_table();
+		s = find_slot(&addr, hash);
+	}
+
+	i = ctx.eth_addr_free;
+	fastd_peer_eth_addr_t *entry = get_entry(i);
+	ctx.eth_addr_free = entry->peer_next;
+
+	entry->addr = addr;
+	entry->hash = hash;
+	entry->peer = peer;
+	entry->timeout = ctx.now + ETH_ADDR_STALE_TIME;
+
+	ctx.eth_addr_slots[s] = i;
+	ctx.eth_addr_used++;
+
+	peer_link(i);
+	wheel_link(i, timeout_tick(entry->timeout));
+
+	if (peer)
+		pr_debug("learned new MAC address %E on peer %P", &addr, peer);
+	else
+		pr_debug("learned new local MAC address %E", &addr);
+}
+
+/** Finds the peer that is associated with a given MAC address */
+bool fastd_peer_find_by_eth_addr(const fastd_eth_addr_t addr, fastd_peer_t **peer) {
+	if (!ctx.eth_addr_slots)
+		return false;
+
+	uint32_t i = ctx.eth_addr_slots[find_slot(&addr, eth_addr_hash(&addr))];
+	if (!i)
+		return false;
+
+	*peer = get_entry(i)->peer;
+	return true;
+}
+
+/** Removes all MAC addresses associated with a peer */
+void fastd_peer_eth_addr_remove_peer(fastd_peer_t *peer) {
+	while (peer->eth_addrs)
+		remove_entry(peer->eth_addrs);
+}
+
+/** Removes the time-outed MAC addresses from the wheel slots that have become due since the last call */
+void fastd_peer_eth_addr_cleanup(void) {
+	if (!ctx.eth_addr_slots)
+		return;
+
+	int64_t now_tick = ctx.now / ETH_ADDR_WHEEL_TICK;
+
+	/* Every slot needs to be processed at most once */
+	if (now_tick - ctx.eth_addr_wheel_tick > ETH_ADDR_WHEEL_SLOTS)
+		ctx.eth_addr_wheel_tick = now_tick - ETH_ADDR_WHEEL_SLOTS;
+
+	while (ctx.eth_addr_wheel_tick < now_tick) {
+		int64_t tick = ++ctx.eth_addr_wheel_tick;
+		uint32_t i = ctx.eth_addr_wheel[tick % ETH_ADDR_WHEEL_SLOTS];
+
+		while (i) {
+			fastd_peer_eth_addr_t *entry = get_entry(i);
+			uint32_t next = entry->wheel_next;
+
+			if (fastd_timed_out(entry->timeout)) {
+				pr_debug("MAC address %E not seen for more than %u seconds, removing",
+					 &entry->addr, ETH_ADDR_STALE_TIME/1000);
+				remove_entry(i);
+			}
+			else {
+				/* The entry has been refreshed, move it to the slot of its new timeout */
+				int64_t due = timeout_tick(entry->timeout);
+				if (due <= tick)
+					due = tick + 1;
+				else if (due - tick >= ETH_ADDR_WHEEL_SLOTS)
+					due = tick + ETH_ADDR_WHEEL_SLOTS - 1;
+
+				wheel_unlink(i);
+				wheel_link(i, due);
+			}
+
+			i = next;
+		}
+	}
+}
@@ -49,6 +49,9 @@ struct fastd_peer_group {
 	fastd_string_stack_t *peer_dirs;		/**< List of peer directories which belong to this group */
 
 	int max_connections;				/**< The maximum number of connections to allow in this group; -1 for no limit */
+	size_t n_established;				/**< The number of established peers in this group and its subgroups */
+	unsigned keepalive_interval;			/**< The time after which a keepalive is sent to an idle peer (in milliseconds); 0 to use the parent group's setting */
+	fastd_tristate_t keepalive_adaptive;		/**< Specifies if the keepalive interval is adapted to the peers' NATs; undefined to use the parent group's setting */
 	fastd_string_stack_t *methods;			/**< The list of configured method names */
 
 	fastd_shell_command_t on_up;			/**< The command to execute after the initialization of the tunnel interface */
@@ -26,56 +26,220 @@
 /**
    \file
 
-   A hashtable allowing fast lookup from an IP address to a peer
+   Hashtables allowing fast lookup from an IP address to a peer
+
+   Besides the table of the current peer addresses, a second table maps the statically
+   configured remote addresses to the peers owning them (see fastd_peer_owns_address()).
+
+   Both tables are flat open-addressing tables. Each bucket fills a cache line and holds
+   a few entries, consisting of the peer and the hash of its key, so most mismatches can
+   be rejected without touching the peer. Full buckets are probed linearly; every bucket
+   counts the entries that have been placed beyond it, so lookups can stop early and
+   entries can be removed without tombstones.
+
+   When a table needs to grow, a table of twice the size is allocated and the entries
+   of the old table are migrated a few buckets at a time by the following operations.
 */
 
 
 #include "peer_hashtable.h"
 
 
-/** Initializes the hashtable */
-static void init_hashtable(void) {
-	fastd_random_bytes(&ctx.peer_addr_ht_seed, sizeof(ctx.peer_addr_ht_seed), false);
-	ctx.peer_addr_ht = fastd_new0_array(ctx.peer_addr_ht_size, __typeof__(*ctx.peer_addr_ht));
+/** The number of entries per hashtable bucket */
+#define BUCKET_SLOTS 4
+
+
+/** A hashtable bucket */
+struct __attribute__((aligned(64))) fastd_peer_hashtable_bucket {
+	uint32_t hashes[BUCKET_SLOTS];			/**< The hashes of the entries */
+	fastd_peer_t *peers[BUCKET_SLOTS];		/**< The peers (NULL for unused slots) */
+	uint32_t overflow;				/**< The number of entries that had to be placed in a later bucket after probing this one */
+};
+
+
+/** Allocates the buckets of a table */
+static fastd_peer_hashtable_bucket_t * alloc_buckets(size_t size) {
+	fastd_peer_hashtable_bucket_t *buckets = fastd_alloc_aligned(size * sizeof(fastd_peer_hashtable_bucket_t), sizeof(fastd_peer_hashtable_bucket_t));
+	memset(buckets, 0, size * sizeof(fastd_peer_hashtable_bucket_t));
+	return buckets;
 }
 
-/** Initializes the hashtable with the default size */
-void fastd_peer_hashtable_init(void) {
-	ctx.peer_addr_ht_size = 8;
-	init_hashtable();
+/** Initializes a table with a given number of buckets (which must be a power of 2) */
+static void table_init(fastd_peer_hashtable_t *table, size_t size) {
+	*table = (fastd_peer_hashtable_t){
+		.size = size,
+		.buckets = alloc_buckets(size),
+	};
+
+	fastd_random_bytes(&table->seed, sizeof(table->seed), false);
 }
 
-/** Frees the resources used by the hashtable */
-void fastd_peer_hashtable_free(void) {
-	size_t i;
-	for (i = 0; i < ctx.peer_addr_ht_size; i++)
-		VECTOR_FREE(ctx.peer_addr_ht[i]);
+/** Frees the buckets of a table */
+static void table_free(fastd_peer_hashtable_t *table) {
+	free(table->buckets);
+	free(table->old_buckets);
+
+	*table = (fastd_peer_hashtable_t){};
+}
 
-	free(ctx.peer_addr_ht);
+/** Computes the hash of an address with the seed of a table */
+static inline uint32_t table_hash(const fastd_peer_hashtable_t *table, const fastd_peer_address_t *addr) {
+	uint32_t hash = table->seed;
+	fastd_peer_address_hash(&hash, addr);
+	return hash;
+}
+
+/** Places an entry into a set of buckets, which must not be full */
+static void buckets_insert(fastd_peer_hashtable_bucket_t *buckets, size_t size, uint32_t hash, fastd_peer_t *peer) {
+	size_t mask = size - 1, b, i;
+
+	for (b = hash & mask;; b = (b+1) & mask) {
+		fastd_peer_hashtable_bucket_t *bucket = &buckets[b];
+
+		for (i = 0; i < BUCKET_SLOTS; i++) {
+			if (!bucket->peers[i]) {
+				bucket->hashes[i] = hash;
+				bucket->peers[i] = peer;
+				return;
+			}
+		}
+
+		bucket->overflow++;
+	}
 }
 
-/** Doubles the size of the peer hashtable and rebuild it afterwards */
-static void resize_hashtable(void) {
-	fastd_peer_hashtable_free();
-	ctx.peer_addr_ht_used = 0;
+/** Removes an entry from a set of buckets; returns false if it wasn't found */
+static bool buckets_remove(fastd_peer_hashtable_bucket_t *buckets, size_t size, uint32_t hash, const fastd_peer_t *peer) {
+	size_t mask = size - 1, home = hash & mask, b, i;
+
+	for (b = home;; b = (b+1) & mask) {
+		fastd_peer_hashtable_bucket_t *bucket = &buckets[b];
 
-	ctx.peer_addr_ht_size *= 2;
-	pr_debug("resizing peer address hashtable to %u buckets", (unsigned)ctx.peer_addr_ht_size);
+		for (i = 0; i < BUCKET_SLOTS; i++) {
+			if (bucket->peers[i] != peer || bucket->hashes[i] != hash)
+				continue;
 
-	init_hashtable();
+			bucket->peers[i] = NULL;
+
+			/* Undo the overflow counts of the buckets that were passed when the entry was inserted */
+			for (; home != b; home = (home+1) & mask)
+				buckets[home].overflow--;
+
+			return true;
+		}
+
+		if (!bucket->overflow)
+			return false;
+	}
+}
+
+/** Looks up the first peer with a given hash in a set of buckets that is matched by a predicate */
+static fastd_peer_t * buckets_lookup(const fastd_peer_hashtable_bucket_t *buckets, size_t size, uint32_t hash,
+				     bool (*match)(const fastd_peer_t *peer, const void *arg), const void *arg) {
+	size_t mask = size - 1, b, i;
+
+	for (b = hash & mask;; b = (b+1) & mask) {
+		const fastd_peer_hashtable_bucket_t *bucket = &buckets[b];
+
+		for (i = 0; i < BUCKET_SLOTS; i++) {
+			fastd_peer_t *peer = bucket->peers[i];
+
+			if (peer && bucket->hashes[i] == hash && match(peer, arg))
+				return peer;
+		}
+
+		if (!bucket->overflow)
+			return NULL;
+	}
+}
+
+/** Migrates up to \e n buckets of the old table of an incremental resize to the new table */
+static void table_migrate(fastd_peer_hashtable_t *table, size_t n) {
+	if (!table->old_buckets)
+		return;
 
 	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++)
-		fastd_peer_hashtable_insert(VECTOR_INDEX(ctx.peers, i));
+	for (; n && table->migrated < table->old_size; n--, table->migrated++) {
+		fastd_peer_hashtable_bucket_t *bucket = &table->old_buckets[table->migrated];
+
+		/* The overflow count is kept, as other entries may still be found by probing past this bucket */
+		for (i = 0; i < BUCKET_SLOTS; i++) {
+			if (!bucket->peers[i])
+				continue;
+
+			buckets_insert(table->buckets, table->size, bucket->hashes[i], bucket->peers[i]);
+			bucket->peers[i] = NULL;
+		}
+	}
+
+	if (table->migrated == table->old_size) {
+		free(table->old_buckets);
+		table->old_buckets = NULL;
+	}
 }
 
-/** Gets the hash bucket used for an address */
-static size_t peer_address_bucket(const fastd_peer_address_t *addr) {
-	uint32_t hash = ctx.peer_addr_ht_seed;
-	fastd_peer_address_hash(&hash, addr);
-	fastd_hash_final(&hash);
+/** Starts an incremental resize of a table to twice its size */
+static void table_grow(fastd_peer_hashtable_t *table, const char *name) {
+	/* Only one resize can be in progress at a time */
+	table_migrate(table, SIZE_MAX);
 
-	return hash % ctx.peer_addr_ht_size;
+	table->old_size = table->size;
+	table->old_buckets = table->buckets;
+	table->migrated = 0;
+
+	table->size *= 2;
+	table->buckets = alloc_buckets(table->size);
+
+	pr_debug("resizing %s hashtable to %u buckets", name, (unsigned)table->size);
+}
+
+/** Inserts an entry into a table */
+static void table_insert(fastd_peer_hashtable_t *table, const char *name, uint32_t hash, fastd_peer_t *peer) {
+	table_migrate(table, PEER_HASHTABLE_MIGRATE_BUCKETS);
+
+	if (4*(table->used+1) > 3*BUCKET_SLOTS*table->size)
+		table_grow(table, name);
+
+	buckets_insert(table->buckets, table->size, hash, peer);
+	table->used++;
+}
+
+/** Removes an entry from a table; returns false if it wasn't found */
+static bool table_remove(fastd_peer_hashtable_t *table, uint32_t hash, const fastd_peer_t *peer) {
+	table_migrate(table, PEER_HASHTABLE_MIGRATE_BUCKETS);
+
+	if (!buckets_remove(table->buckets, table->size, hash, peer)) {
+		if (!table->old_buckets || !buckets_remove(table->old_buckets, table->old_size, hash, peer))
+			return false;
+	}
+
+	table->used--;
+	return true;
+}
+
+/** Looks up the first peer with a given hash in a table that is matched by a predicate */
+static fastd_peer_t * table_lookup(fastd_peer_hashtable_t *table, uint32_t hash,
+				   bool (*match)(const fastd_peer_t *peer, const void *arg), const void *arg) {
+	table_migrate(table, PEER_HASHTABLE_MIGRATE_BUCKETS);
+
+	fastd_peer_t *peer = buckets_lookup(table->buckets, table->size, hash, match, arg);
+
+	if (!peer && table->old_buckets)
+		peer = buckets_lookup(table->old_buckets, table->old_size, hash, match, arg);
+
+	return peer;
+}
+
+
+/** Initializes the hashtable with the default size */
+void fastd_peer_hashtable_init(void) {
+	table_init(&ctx.peer_addr_ht, 4);
+}
+
+/** Frees the resources used by the hashtables */
+void fastd_peer_hashtable_free(void) {
+	table_free(&ctx.peer_addr_ht);
+	table_free(&ctx.peer_owner_ht);
 }
 
 /**
@@ -87,15 +251,7 @@ void fastd_peer_hashtable_insert(fastd_peer_t *peer) {
 	if (!peer->address.sa.sa_family)
 		return;
 
-	ctx.peer_addr_ht_used++;
-
-	if (ctx.peer_addr_ht_used > 2*ctx.peer_addr_ht_size) {
-		resize_hashtable();
-		return;
-	}
-
-	size_t b = peer_address_bucket(&peer->address);
-	VECTOR_ADD(ctx.peer_addr_ht[b], peer);
+	table_insert(&ctx.peer_addr_ht, "peer address", table_hash(&ctx.peer_addr_ht, &peer->address), peer);
 }
 
 /**
@@ -107,30 +263,93 @@ void fastd_peer_hashtable_remove(fastd_peer_t *peer) {
 	if (!peer->address.sa.sa_family)
 		return;
 
-	size_t b = peer_address_bucket(&peer->address);
-
-	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peer_addr_ht[b]); i++) {
-		if (VECTOR_INDEX(ctx.peer_addr_ht[b], i) == peer) {
-			VECTOR_DELETE(ctx.peer_addr_ht[b], i);
-			break;
-		}
-	}
+	table_remove(&ctx.peer_addr_ht, table_hash(&ctx.peer_addr_ht, &peer->address), peer);
+}
 
-	ctx.peer_addr_ht_used--;
+/** Checks if a peer's current address is the given one */
+static bool match_address(const fastd_peer_t *peer, const void *addr) {
+	return fastd_peer_address_equal(&peer->address, addr);
 }
 
 /** Looks up a peer in the hashtable */
 fastd_peer_t *fastd_peer_hashtable_lookup(const fastd_peer_address_t *addr) {
-	size_t b = peer_address_bucket(addr);
+	return table_lookup(&ctx.peer_addr_ht, table_hash(&ctx.peer_addr_ht, addr), match_address, addr);
+}
+
+
+/** Checks if a peer is the one given as the predicate argument */
+static bool match_peer(const fastd_peer_t *peer, const void *other) {
+	return peer == other;
+}
+
+/**
+   Inserts the statically configured remote addresses of a peer into the owner hash table
+
+   The peer must already be part of the peer list. Its remotes must not change while the peer is part of the table.
+*/
+void fastd_peer_owner_insert(fastd_peer_t *peer) {
+	if (fastd_peer_is_floating(peer))
+		return;
+
+	if (!ctx.peer_owner_ht.buckets)
+		table_init(&ctx.peer_owner_ht, 4);
 
 	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peer_addr_ht[b]); i++) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peer_addr_ht[b], i);
+	for (i = 0; i < VECTOR_LEN(peer->remotes); i++) {
+		const fastd_remote_t *remote = &VECTOR_INDEX(peer->remotes, i);
 
-		if (fastd_peer_address_equal(&peer->address, addr))
-			return peer;
+		if (remote->hostname)
+			continue;
+
+		uint32_t hash = table_hash(&ctx.peer_owner_ht, &remote->address);
+
+		/* A peer may list the same address more than once */
+		if (table_lookup(&ctx.peer_owner_ht, hash, match_peer, peer))
+			continue;
+
+		table_insert(&ctx.peer_owner_ht, "peer owner", hash, peer);
 	}
+}
+
+/** Removes a peer from the owner hash table */
+void fastd_peer_owner_remove(fastd_peer_t *peer) {
+	if (fastd_peer_is_floating(peer) || !ctx.peer_owner_ht.buckets)
+		return;
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(peer->remotes); i++) {
+		const fastd_remote_t *remote = &VECTOR_INDEX(peer->remotes, i);
+
+		if (!remote->hostname)
+			table_remove(&ctx.peer_owner_ht, table_hash(&ctx.peer_owner_ht, &remote->address), peer);
+	}
+}
+
+/** The predicate argument used by fastd_peer_owner_lookup() */
+typedef struct owner_match_arg {
+	const fastd_peer_address_t *addr;		/**< The address to look up */
+	const fastd_peer_t *except;			/**< A peer to ignore */
+} owner_match_arg_t;
+
+/** Checks if a peer is an enabled owner of an address */
+static bool match_owner(const fastd_peer_t *peer, const void *arg) {
+	const owner_match_arg_t *match = arg;
+
+	if (peer == match->except || !fastd_peer_is_enabled(peer))
+		return false;
+
+	return fastd_peer_owns_address(peer, match->addr);
+}
+
+/**
+   Looks up an enabled peer owning an address in the owner hash table
+
+   Returns an enabled peer other than \e except for which fastd_peer_owns_address() is true, or NULL if there is none.
+*/
+fastd_peer_t *fastd_peer_owner_lookup(const fastd_peer_address_t *addr, const fastd_peer_t *except) {
+	if (!ctx.peer_owner_ht.buckets)
+		return NULL;
 
-	return NULL;
+	const owner_match_arg_t arg = { .addr = addr, .except = except };
+	return table_lookup(&ctx.peer_owner_ht, table_hash(&ctx.peer_owner_ht, addr), match_owner, &arg);
 }
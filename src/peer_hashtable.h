@@ -26,7 +26,7 @@
 /**
    \file
 
-   A hashtable allowing fast lookup from an IP address to a peer
+   Hashtables allowing fast lookup from an IP address to a peer
 */
 
 
@@ -37,24 +37,44 @@
 #include "peer.h"
 
 
-/** Hashes a peer address */
+/**
+   Hashes a peer address
+
+   The address is hashed together with the current hash value using SipHash-1-3 with
+   the secret key \e ctx.hash_key, so remote hosts can't choose addresses that collide.
+*/
 static inline void fastd_peer_address_hash(uint32_t *hash, const fastd_peer_address_t *addr) {
+	uint8_t buf[sizeof(*hash) + sizeof(addr->in6.sin6_addr) + sizeof(addr->in6.sin6_port) + sizeof(addr->in6.sin6_scope_id)];
+	size_t len = 0;
+
+	memcpy(buf, hash, sizeof(*hash));
+	len += sizeof(*hash);
+
 	switch(addr->sa.sa_family) {
 	case AF_INET:
-		fastd_hash(hash, &addr->in.sin_addr.s_addr, sizeof(addr->in.sin_addr.s_addr));
-		fastd_hash(hash, &addr->in.sin_port, sizeof(addr->in.sin_port));
+		memcpy(buf+len, &addr->in.sin_addr.s_addr, sizeof(addr->in.sin_addr.s_addr));
+		len += sizeof(addr->in.sin_addr.s_addr);
+		memcpy(buf+len, &addr->in.sin_port, sizeof(addr->in.sin_port));
+		len += sizeof(addr->in.sin_port);
 		break;
 
 	case AF_INET6:
-		fastd_hash(hash, &addr->in6.sin6_addr, sizeof(addr->in6.sin6_addr));
-		fastd_hash(hash, &addr->in6.sin6_port, sizeof(addr->in6.sin6_port));
-		if (IN6_IS_ADDR_LINKLOCAL(&addr->in6.sin6_addr))
-			fastd_hash(hash, &addr->in6.sin6_scope_id, sizeof(addr->in6.sin6_scope_id));
+		memcpy(buf+len, &addr->in6.sin6_addr, sizeof(addr->in6.sin6_addr));
+		len += sizeof(addr->in6.sin6_addr);
+		memcpy(buf+len, &addr->in6.sin6_port, sizeof(addr->in6.sin6_port));
+		len += sizeof(addr->in6.sin6_port);
+		if (IN6_IS_ADDR_LINKLOCAL(&addr->in6.sin6_addr)) {
+			memcpy(buf+len, &addr->in6.sin6_scope_id, sizeof(addr->in6.sin6_scope_id));
+			len += sizeof(addr->in6.sin6_scope_id);
+		}
 		break;
 
 	default:
 		exit_bug("peer_address_bucket: unknown address family");
 	}
+
+	uint64_t h = fastd_siphash13(ctx.hash_key, buf, len);
+	*hash = (uint32_t)h ^ (uint32_t)(h >> 32);
 }
 
 
@@ -64,3 +84,7 @@ void fastd_peer_hashtable_free(void);
 void fastd_peer_hashtable_insert(fastd_peer_t *peer);
 void fastd_peer_hashtable_remove(fastd_peer_t *peer);
 fastd_peer_t *fastd_peer_hashtable_lookup(const fastd_peer_address_t *addr);
+
+void fastd_peer_owner_insert(fastd_peer_t *peer);
+void fastd_peer_owner_remove(fastd_peer_t *peer);
+fastd_peer_t *fastd_peer_owner_lookup(const fastd_peer_address_t *addr, const fastd_peer_t *except);
@@ -79,7 +79,7 @@ static fastd_protocol_config_t * protocol_init(void) {
 
 /** Parses a peer's key */
 static fastd_protocol_key_t * protocol_read_key(const char *key) {
-	fastd_protocol_key_t *ret = fastd_new(fastd_protocol_key_t);
+	fastd_protocol_key_t *ret = fastd_new0(fastd_protocol_key_t);
 
 	if (read_key(ret->key.u8, key)) {
 		if (ecc_25519_load_packed_legacy(&ret->unpacked, &ret->key.int256)) {
@@ -173,12 +173,79 @@ static void protocol_handle_recv(fastd_peer_t *peer, fastd_buffer_t buffer) {
 	fastd_buffer_free(buffer);
 }
 
+/**
+   Handles multiple payload packets received from a peer at once
+
+   As long as there is a valid old session, each packet must be tried with both
+   sessions, so the packets are handled one by one in this case.
+*/
+static void protocol_handle_recv_batch(fastd_peer_t *peer, const fastd_buffer_t *buffers, size_t n) {
+	size_t i;
+
+	if (!peer->protocol_state || !check_session(peer) || is_session_valid(&peer->protocol_state->old_session)) {
+		for (i = 0; i < n; i++)
+			protocol_handle_recv(peer, buffers[i]);
+
+		return;
+	}
+
+	protocol_session_t *session = &peer->protocol_state->session;
+
+	fastd_buffer_t recv_buffers[n];
+	bool reordered[n], ok[n], any_ok = false;
+	memset(reordered, 0, sizeof(reordered));
+
+	fastd_method_decrypt_batch(session->method->provider, peer, session->method_state, recv_buffers, buffers, reordered, ok, n);
+
+	for (i = 0; i < n; i++) {
+		if (ok[i]) {
+			any_ok = true;
+			continue;
+		}
+
+		pr_debug2("verification failed for packet received from %P", peer);
+		fastd_buffer_free(buffers[i]);
+	}
+
+	if (!any_ok)
+		return;
+
+	if (peer->protocol_state->old_session.method) {
+		pr_debug("invalidating old session with %P", peer);
+		peer->protocol_state->old_session.method->provider->session_free(peer->protocol_state->old_session.method_state);
+		peer->protocol_state->old_session = (protocol_session_t){};
+	}
+
+	if (!session->handshakes_cleaned) {
+		pr_debug("cleaning left handshakes with %P", peer);
+		fastd_peer_unschedule_handshake(peer);
+		session->handshakes_cleaned = true;
+
+		if (session->method->provider->session_is_initiator(session->method_state))
+			fastd_protocol_ec25519_fhmqvc_send_empty(peer, session);
+	}
+
+	check_session_refresh(peer);
+
+	fastd_peer_seen(peer);
+
+	for (i = 0; i < n; i++) {
+		if (!ok[i])
+			continue;
+
+		if (recv_buffers[i].len)
+			fastd_handle_receive(peer, recv_buffers[i], reordered[i]);
+		else
+			fastd_buffer_free(recv_buffers[i]);
+	}
+}
+
 /** Encrypts and sends a packet to a peer using a specified session */
 static void session_send(fastd_peer_t *peer, fastd_buffer_t buffer, protocol_session_t *session) {
 	size_t stat_size = buffer.len;
 
 	fastd_buffer_t send_buffer;
-	if (!session->method->provider->encrypt(peer, session->method_state, &send_buffer, buffer)) {
+	if (!fastd_method_encrypt(session->method->provider, peer, session->method_state, &send_buffer, buffer)) {
 		fastd_buffer_free(buffer);
 		pr_error("failed to encrypt packet for %P", peer);
 		return;
@@ -188,22 +255,52 @@ static void session_send(fastd_peer_t *peer, fastd_buffer_t buffer, protocol_ses
 	fastd_peer_clear_keepalive(peer);
 }
 
-/** Encrypts and sends a packet to a peer */
-static void protocol_send(fastd_peer_t *peer, fastd_buffer_t buffer) {
-	if (!peer->protocol_state || !fastd_peer_is_established(peer) || !check_session(peer)) {
-		fastd_buffer_free(buffer);
-		return;
+/** Encrypts and sends a packet to a peer using a specified session, without consuming the buffer */
+static bool session_send_shared(fastd_peer_t *peer, const fastd_buffer_t buffer, protocol_session_t *session) {
+	fastd_buffer_t send_buffer;
+	if (!fastd_method_encrypt_shared(session->method->provider, peer, session->method_state, &send_buffer, buffer)) {
+		pr_error("failed to encrypt packet for %P", peer);
+		return false;
 	}
 
+	fastd_send(peer->sock, &peer->local_address, &peer->address, peer, send_buffer, buffer.len);
+	fastd_peer_clear_keepalive(peer);
+
+	return true;
+}
+
+/** Returns the session to send packets to a peer with, or NULL if packets can't be sent to the peer */
+static protocol_session_t * get_send_session(fastd_peer_t *peer) {
+	if (!peer->protocol_state || !fastd_peer_is_established(peer) || !check_session(peer))
+		return NULL;
+
 	check_session_refresh(peer);
 
 	if (use_old_session(peer->protocol_state)) {
 		pr_debug2("sending packet for old session to %P", peer);
-		session_send(peer, buffer, &peer->protocol_state->old_session);
-	}
-	else {
-		session_send(peer, buffer, &peer->protocol_state->session);
+		return &peer->protocol_state->old_session;
 	}
+
+	return &peer->protocol_state->session;
+}
+
+/** Encrypts and sends a packet to a peer */
+static void protocol_send(fastd_peer_t *peer, fastd_buffer_t buffer) {
+	protocol_session_t *session = get_send_session(peer);
+
+	if (session)
+		session_send(peer, buffer, session);
+	else
+		fastd_buffer_free(buffer);
+}
+
+/** Encrypts and sends a packet to a peer, leaving the buffer to the caller */
+static bool protocol_send_shared(fastd_peer_t *peer, const fastd_buffer_t buffer) {
+	protocol_session_t *session = get_send_session(peer);
+	if (!session)
+		return false;
+
+	return session_send_shared(peer, buffer, session);
 }
 
 /** Sends an empty payload packet (i.e. keepalive) to a peer using a specified session */
@@ -236,7 +333,9 @@ const fastd_protocol_t fastd_protocol_ec25519_fhmqvc = {
 #endif
 
 	.handle_recv = protocol_handle_recv,
+	.handle_recv_batch = protocol_handle_recv_batch,
 	.send = protocol_send,
+	.send_shared = protocol_send_shared,
 
 	.init_peer_state = fastd_protocol_ec25519_fhmqvc_init_peer_state,
 	.reset_peer_state = fastd_protocol_ec25519_fhmqvc_reset_peer_state,
@@ -65,10 +65,17 @@ struct fastd_protocol_config {
 	keypair_t key;				/**< The own keypair */
 };
 
+/** The window width used for multiplications with a peer's public key */
+#define PEER_KEY_WINDOW 3
+
+/** The number of precomputed odd multiples of a peer's public key (P, 3P, 5P, 7P) */
+#define PEER_KEY_MULTIPLES (1 << (PEER_KEY_WINDOW-1))
+
 /** A peer's public key */
 struct fastd_protocol_key {
 	aligned_int256_t key;			/**< The peer's public key */
 	ecc_25519_work_t unpacked;		/**< The peer's public key (unpacked) */
+	ecc_25519_work_t *multiples;		/**< Precomputed odd multiples of the unpacked key (allocated on the first handshake with the peer) */
 };
 
 
@@ -96,6 +103,8 @@ struct fastd_protocol_peer_state {
 
 	/* handshake cache */
 	uint64_t last_handshake_serial;		/**< The serial number of the ephemeral keypair used in the last handshake */
+	bool handshake_initiator;		/**< true if the cached values have been computed as the initiator of the handshake */
+	fastd_timeout_t handshake_pending_timeout; /**< While this timeout hasn't elapsed, a shared handshake key is being computed by the worker threads */
 	aligned_int256_t peer_handshake_key;	/**< The peer's ephemeral public key used in the last handshake */
 	aligned_int256_t sigma;			/**< The value of sigma used in the last handshake */
 	fastd_sha256_t shared_handshake_key;	/**< The shared handshake key used in the last handshake */
@@ -118,6 +127,7 @@ void fastd_protocol_ec25519_fhmqvc_handle_verify_return(fastd_peer_t *peer, fast
 void fastd_protocol_ec25519_fhmqvc_send_empty(fastd_peer_t *peer, protocol_session_t *session);
 
 fastd_peer_t * fastd_protocol_ec25519_fhmqvc_find_peer(const fastd_protocol_key_t *key);
+fastd_peer_t * fastd_protocol_ec25519_fhmqvc_lookup_key(const uint8_t key[PUBLICKEYBYTES]);
 
 void fastd_protocol_ec25519_fhmqvc_generate_key(void);
 void fastd_protocol_ec25519_fhmqvc_show_key(void);
@@ -153,6 +163,11 @@ static inline bool divide_key(ecc_int256_t *key) {
 	return (c == 0);
 }
 
+/** Returns the bit \e i of a 256bit integer */
+static inline unsigned int256_bit(const ecc_int256_t *n, size_t i) {
+	return (n->p[i >> 3] >> (i & 7)) & 1;
+}
+
 /** Multiplies a point by 8 */
 static inline void octuple_point(ecc_25519_work_t *p) {
 	ecc_25519_work_t work;
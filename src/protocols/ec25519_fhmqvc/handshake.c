@@ -34,7 +34,9 @@
 #include "../../handshake.h"
 #include "../../hkdf_sha256.h"
 #include "../../peer_group.h"
+#include "../../peer_hashtable.h"
 #include "../../verify.h"
+#include "../../worker.h"
 
 
 /** The size of the hash outputs used in the handshake */
@@ -53,11 +55,58 @@
 /** Provides the proper arguments for passing a key for the %H log format */
 #define KEY_PRINT(k) (const uint8_t *)(k), (size_t)PUBLICKEYBYTES
 
+/** The time after which a handshake computation queued for the worker threads is considered lost */
+#define HANDSHAKE_JOB_TIMEOUT 1000	/* 1 second */
 
-/** Derives a key of arbitraty length from the shared key material after a handshake using the HKDF algorithm */
-static void derive_key(fastd_sha256_t *out, size_t blocks, const uint32_t *salt, const char *method_name,
-		       const aligned_int256_t *A, const aligned_int256_t *B, const aligned_int256_t *X, const aligned_int256_t *Y,
-		       const aligned_int256_t *sigma) {
+
+/**
+   A shared handshake key computation that is offloaded to the worker threads
+
+   After the computation, the result is stored in the handshake cache of the peer and
+   the handshake is continued on the main thread.
+*/
+typedef struct handshake_job {
+	fastd_worker_job_t job;			/**< The generic worker job */
+	fastd_handshake_pacer_entry_t pacer;	/**< The handshake pacer entry (for received handshakes) */
+
+	uint64_t peer_id;			/**< The ID of the peer the handshake belongs to */
+	bool has_packet_peer;			/**< true if the handshake packet was received for a known peer */
+	uint64_t packet_peer_id;		/**< The ID of the peer the handshake packet was received for */
+
+	bool peer_sock;				/**< true if the handshake was received on the peer's dynamic socket */
+	size_t sock_index;			/**< The index of the socket in ctx.socks the handshake was received on (if \e peer_sock is false) */
+	fastd_peer_address_t sock_addr;		/**< The address the peer's dynamic socket was bound to (if \e peer_sock is true) */
+	fastd_peer_address_t local_addr;	/**< The local address the handshake was received on */
+	fastd_peer_address_t remote_addr;	/**< The address the handshake was received from */
+
+	bool initiator;				/**< true if the key is computed as the initiator of the handshake */
+	uint64_t serial;			/**< The serial number of the ephemeral keypair */
+	keypair_t handshake_key;		/**< The ephemeral keypair */
+	fastd_protocol_key_t peer_key;		/**< The peer's public key (without the pointer to the precomputed multiples) */
+	ecc_25519_work_t peer_key_multiples[PEER_KEY_MULTIPLES]; /**< The precomputed odd multiples of the peer's public key */
+	aligned_int256_t peer_handshake_key;	/**< The peer's ephemeral public key */
+
+	bool ok;				/**< true if the computation was successful */
+	aligned_int256_t sigma;			/**< The computed value of sigma */
+	fastd_sha256_t shared_handshake_key;	/**< The computed shared handshake key */
+	fastd_sha256_t shared_handshake_key_compat; /**< The computed shared handshake key (pre-v11 compatiblity protocol) */
+	int64_t cpu_time;			/**< The CPU time used by the computation (in microseconds) */
+
+	const fastd_method_info_t *method;	/**< The method to respond with (if there is no packet to handle again) */
+	bool little_endian;			/**< The handshake endianess to respond with (if there is no packet to handle again) */
+
+	size_t packet_len;			/**< The length of the copied handshake packet (0 if a handshake response is to be sent) */
+	uint8_t packet[] __attribute__((aligned(8))); /**< A copy of the handshake packet to handle after the computation */
+} handshake_job_t;
+
+
+static void respond_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
+			      const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian);
+
+
+/** Expands the pseudorandom key extracted from the shared key material to a key of arbitraty length */
+static void expand_key(fastd_sha256_t *out, size_t blocks, const fastd_sha256_t *prk, const char *method_name,
+		       const aligned_int256_t *A, const aligned_int256_t *B, const aligned_int256_t *X, const aligned_int256_t *Y) {
 	size_t methodlen = strlen(method_name);
 	uint8_t info[4*PUBLICKEYBYTES + methodlen] __attribute__((aligned(8)));
 
@@ -67,10 +116,17 @@ static void derive_key(fastd_sha256_t *out, size_t blocks, const uint32_t *salt,
 	memcpy(info+3*PUBLICKEYBYTES, Y, PUBLICKEYBYTES);
 	memcpy(info+4*PUBLICKEYBYTES, method_name, methodlen);
 
+	fastd_hkdf_sha256_expand(out, blocks, prk, info, sizeof(info));
+}
+
+/** Derives a key of arbitraty length from the shared key material after a handshake using the HKDF algorithm */
+static void derive_key(fastd_sha256_t *out, size_t blocks, const uint32_t *salt, const char *method_name,
+		       const aligned_int256_t *A, const aligned_int256_t *B, const aligned_int256_t *X, const aligned_int256_t *Y,
+		       const aligned_int256_t *sigma) {
 	fastd_sha256_t prk;
 	fastd_hkdf_sha256_extract(&prk, salt, sigma->u32, PUBLICKEYBYTES);
 
-	fastd_hkdf_sha256_expand(out, blocks, &prk, info, sizeof(info));
+	expand_key(out, blocks, &prk, method_name, A, B, X, Y);
 }
 
 /** Marks the active session as superseded and moves it to the \e old_session field of the protocol peer state */
@@ -186,9 +242,68 @@ static inline bool secure_handshake(const fastd_handshake_t *handshake) {
 }
 
 
+/** Returns the precomputed odd multiples of a peer's public key, computing them on first use */
+static const ecc_25519_work_t * get_peer_key_multiples(fastd_peer_t *peer) {
+	fastd_protocol_key_t *key = peer->key;
+
+	if (!key->multiples) {
+		key->multiples = fastd_new_array(PEER_KEY_MULTIPLES, ecc_25519_work_t);
+
+		ecc_25519_work_t twice;
+		ecc_25519_double(&twice, &key->unpacked);
+
+		key->multiples[0] = key->unpacked;
+
+		size_t i;
+		for (i = 1; i < PEER_KEY_MULTIPLES; i++)
+			ecc_25519_add(&key->multiples[i], &key->multiples[i-1], &twice);
+	}
+
+	return key->multiples;
+}
+
+/**
+   Multiplies a peer's public key with the lower 128 bits of a scalar
+
+   A sliding window over the precomputed odd multiples of the key is used, so this takes
+   128 point doublings, but only about 32 additions. As the number of additions depends on
+   the scalar, this must only be used with public values like \e d and \e e of FHMQV-C,
+   which are derived from the public keys.
+*/
+static void scalarmult_public_128(ecc_25519_work_t *out, const ecc_int256_t *n, const ecc_25519_work_t multiples[PEER_KEY_MULTIPLES]) {
+	ecc_25519_work_t work = ecc_25519_work_identity;
+
+	ssize_t i = 127;
+	while (i >= 0) {
+		if (!int256_bit(n, i)) {
+			ecc_25519_double(&work, &work);
+			i--;
+			continue;
+		}
+
+		ssize_t j = i - (PEER_KEY_WINDOW-1);
+		if (j < 0)
+			j = 0;
+
+		while (!int256_bit(n, j))
+			j++;
+
+		unsigned value = 0;
+		for (; i >= j; i--) {
+			ecc_25519_double(&work, &work);
+			value = value << 1 | int256_bit(n, i);
+		}
+
+		ecc_25519_add(&work, &work, &multiples[value >> 1]);
+	}
+
+	*out = work;
+}
+
 /** Derives the shares handshake key for computing the MACs used in the handshake */
 static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake_key,
-				      const fastd_protocol_key_t *peer_key, const aligned_int256_t *peer_handshake_key,
+				      const fastd_protocol_key_t *peer_key, const ecc_25519_work_t peer_key_multiples[PEER_KEY_MULTIPLES],
+				      const aligned_int256_t *peer_handshake_key,
 				      aligned_int256_t *sigma,
 				      fastd_sha256_t *shared_handshake_key,
 				      fastd_sha256_t *shared_handshake_key_compat) {
@@ -232,14 +347,14 @@ static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake
 		ecc_25519_gf_mult(&da, &d, &conf.protocol_config->key.secret);
 		ecc_25519_gf_add(&s, &da, &handshake_key->secret);
 
-		ecc_25519_scalarmult_bits(&work, &e, &peer_key->unpacked, 128);
+		scalarmult_public_128(&work, &e, peer_key_multiples);
 	}
 	else {
 		ecc_int256_t eb;
 		ecc_25519_gf_mult(&eb, &e, &conf.protocol_config->key.secret);
 		ecc_25519_gf_add(&s, &eb, &handshake_key->secret);
 
-		ecc_25519_scalarmult_bits(&work, &d, &peer_key->unpacked, 128);
+		scalarmult_public_128(&work, &d, peer_key_multiples);
 	}
 
 	ecc_25519_add(&work, &workXY, &work);
@@ -262,36 +377,298 @@ static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake
 
 	ecc_25519_store_packed_legacy(&sigma->int256, &work);
 
+	/*
+	  The HKDF extraction for the shared handshake key and the compat key
+	  are independent, so they are hashed together
+	*/
+	const uint32_t *const prk_blocks[] = { sigma->u32 };
+	const uint32_t *const compat_blocks[] = { Y->u32, X->u32, B->u32, A->u32, sigma->u32 };
+
+	fastd_sha256_t prk;
+	fastd_sha256_multi_t hashes[2];
+	size_t n_hashes = 0;
+
 	if (shared_handshake_key)
-		derive_key(shared_handshake_key, 1, zero_salt, "", A, B, X, Y, sigma);
+		hashes[n_hashes++] = (fastd_sha256_multi_t){
+			.out = &prk,
+			.key = zero_salt,
+			.blocks = prk_blocks,
+			.len = sizeof(prk_blocks)/sizeof(prk_blocks[0]) * PUBLICKEYBYTES,
+		};
 
 	if (shared_handshake_key_compat)
-		fastd_sha256_blocks(shared_handshake_key_compat, Y->u32, X->u32, B->u32, A->u32, sigma->u32, NULL);
+		hashes[n_hashes++] = (fastd_sha256_multi_t){
+			.out = shared_handshake_key_compat,
+			.blocks = compat_blocks,
+			.len = sizeof(compat_blocks)/sizeof(compat_blocks[0]) * PUBLICKEYBYTES,
+		};
+
+	if (n_hashes)
+		fastd_sha256_multi(hashes, n_hashes);
+
+	if (shared_handshake_key)
+		expand_key(shared_handshake_key, 1, &prk, "", A, B, X, Y);
 
 	return true;
 }
 
-/** Checks if the currently cached shared handshake key is valid and generates a new one otherwise  */
-static bool update_shared_handshake_key(const fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key) {
-	if (peer->protocol_state->last_handshake_serial == handshake_key->serial) {
-		if (secure_memequal(&peer->protocol_state->peer_handshake_key, peer_handshake_key, PUBLICKEYBYTES))
-			return true;
+/** Checks if the handshake cache of a peer contains the shared handshake key for the given keys */
+static inline bool is_shared_handshake_key_cached(const fastd_peer_t *peer, bool initiator, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key) {
+	if (peer->protocol_state->last_handshake_serial != handshake_key->serial)
+		return false;
+
+	if (peer->protocol_state->handshake_initiator != initiator)
+		return false;
+
+	return secure_memequal(&peer->protocol_state->peer_handshake_key, peer_handshake_key, PUBLICKEYBYTES);
+}
+
+/** Returns the valid ephemeral keypair with the given serial number */
+static const handshake_key_t * get_handshake_key(uint64_t serial) {
+	if (is_handshake_key_valid(&ctx.protocol_state->handshake_key) && ctx.protocol_state->handshake_key.serial == serial)
+		return &ctx.protocol_state->handshake_key;
+
+	if (is_handshake_key_valid(&ctx.protocol_state->prev_handshake_key) && ctx.protocol_state->prev_handshake_key.serial == serial)
+		return &ctx.protocol_state->prev_handshake_key;
+
+	return NULL;
+}
+
+/** Returns the CPU time used by the calling thread (in microseconds) */
+static int64_t thread_cpu_time(void) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return 0;
+
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** Computes a shared handshake key (called on a worker thread) */
+static void handshake_job_work(fastd_worker_job_t *job) {
+	handshake_job_t *hjob = container_of(job, handshake_job_t, job);
+
+	int64_t start = thread_cpu_time();
+
+	hjob->ok = make_shared_handshake_key(hjob->initiator, &hjob->handshake_key,
+					     &hjob->peer_key,
+					     hjob->peer_key_multiples,
+					     &hjob->peer_handshake_key,
+					     &hjob->sigma,
+					     &hjob->shared_handshake_key,
+					     &hjob->shared_handshake_key_compat);
+
+	hjob->cpu_time = thread_cpu_time() - start;
+}
+
+/** Frees a handshake job */
+static void free_handshake_job(handshake_job_t *hjob) {
+	secure_memzero(hjob, sizeof(*hjob));
+	free(hjob);
+}
+
+/** Frees a handshake job whose result is discarded */
+static void handshake_job_free(fastd_worker_job_t *job) {
+	free_handshake_job(container_of(job, handshake_job_t, job));
+}
+
+/**
+   Remembers the socket a handshake job belongs to
+
+   Dynamic peer sockets may be closed and freed while the job is pending, so the job doesn't
+   keep a pointer to the socket; see get_job_socket().
+*/
+static void set_job_socket(handshake_job_t *hjob, const fastd_peer_t *peer, const fastd_socket_t *sock) {
+	if (sock->peer) {
+		if (sock->peer != peer)
+			exit_bug("handshake job: dynamic socket of another peer");
+
+		hjob->peer_sock = true;
+		hjob->sock_addr = *sock->bound_addr;
+	}
+	else {
+		hjob->peer_sock = false;
+		hjob->sock_index = sock - ctx.socks;
+	}
+}
+
+/**
+   Looks up the socket a handshake job belongs to again
+
+   Returns NULL if the peer's dynamic socket the handshake was received on has been closed
+   or replaced in the meantime.
+*/
+static fastd_socket_t * get_job_socket(const handshake_job_t *hjob, const fastd_peer_t *peer) {
+	if (!hjob->peer_sock)
+		return &ctx.socks[hjob->sock_index];
+
+	fastd_socket_t *sock = peer->sock;
+	if (!sock || sock->peer != peer || !fastd_peer_address_equal(sock->bound_addr, &hjob->sock_addr))
+		return NULL;
+
+	return sock;
+}
+
+/** Stores a computed shared handshake key in the handshake cache and continues the handshake */
+static void handshake_job_done(fastd_worker_job_t *job) {
+	handshake_job_t *hjob = container_of(job, handshake_job_t, job);
+
+	fastd_peer_t *peer = fastd_peer_find_by_id(hjob->peer_id);
+	if (!peer)
+		goto out;
+
+	peer->protocol_state->handshake_pending_timeout = ctx.now;
+
+	ctx.handshake_computations++;
+	ctx.handshake_cpu_time += hjob->cpu_time;
+	pr_debug("computed shared handshake key for %P[%I] in %u us", peer, &hjob->remote_addr, (unsigned)hjob->cpu_time);
+
+	if (!hjob->ok || !secure_memequal(&peer->key->key, &hjob->peer_key.key, PUBLICKEYBYTES))
+		goto out;
+
+	if (!get_handshake_key(hjob->serial)) {
+		pr_debug("ignoring handshake from %P[%I] (handshake key expired during computation)", peer, &hjob->remote_addr);
+		goto out;
+	}
+
+	fastd_socket_t *sock = get_job_socket(hjob, peer);
+	if (!sock) {
+		pr_debug("ignoring handshake from %P[%I] (socket closed during computation)", peer, &hjob->remote_addr);
+		goto out;
+	}
+
+	peer->protocol_state->last_handshake_serial = hjob->serial;
+	peer->protocol_state->handshake_initiator = hjob->initiator;
+	peer->protocol_state->peer_handshake_key = hjob->peer_handshake_key;
+	peer->protocol_state->sigma = hjob->sigma;
+	peer->protocol_state->shared_handshake_key = hjob->shared_handshake_key;
+	peer->protocol_state->shared_handshake_key_compat = hjob->shared_handshake_key_compat;
+
+	if (hjob->packet_len) {
+		fastd_peer_t *packet_peer = NULL;
+
+		if (hjob->has_packet_peer) {
+			packet_peer = fastd_peer_find_by_id(hjob->packet_peer_id);
+			if (!packet_peer)
+				goto out;
+		}
+
+		fastd_buffer_t buffer = fastd_buffer_alloc(hjob->packet_len, 0, 0);
+		memcpy(buffer.data, hjob->packet, hjob->packet_len);
+
+		fastd_handshake_resume(sock, &hjob->local_addr, &hjob->remote_addr, packet_peer, buffer);
+	}
+	else if (hjob->serial == ctx.protocol_state->handshake_key.serial) {
+		respond_handshake(sock, &hjob->local_addr, &hjob->remote_addr, peer, &hjob->peer_handshake_key, hjob->method, hjob->little_endian);
+	}
+
+ out:
+	free_handshake_job(hjob);
+}
+
+/** Queues a handshake job for the worker threads; the job is dropped if the worker queue is full */
+static void submit_handshake_job(handshake_job_t *hjob) {
+	fastd_peer_t *peer = fastd_peer_find_by_id(hjob->peer_id);
+	if (!peer) {
+		free_handshake_job(hjob);
+		return;
+	}
+
+	if (!fastd_worker_submit(&hjob->job)) {
+		pr_debug("dropping handshake from %P[%I] (too many pending handshakes)", peer, &hjob->remote_addr);
+
+		peer->protocol_state->handshake_pending_timeout = ctx.now;
+		free_handshake_job(hjob);
+		return;
 	}
 
-	bool compat = !conf.secure_handshakes;
+	peer->protocol_state->handshake_pending_timeout = ctx.now + HANDSHAKE_JOB_TIMEOUT;
+}
+
+/** Submits a handshake job that has been delayed by the handshake pacer */
+static void run_paced_handshake_job(fastd_handshake_pacer_entry_t *entry) {
+	submit_handshake_job(container_of(entry, handshake_job_t, pacer));
+}
+
+/** Frees a handshake job that has been dropped by the handshake pacer */
+static void drop_paced_handshake_job(fastd_handshake_pacer_entry_t *entry) {
+	handshake_job_t *hjob = container_of(entry, handshake_job_t, pacer);
+
+	fastd_peer_t *peer = fastd_peer_find_by_id(hjob->peer_id);
+	if (peer) {
+		pr_debug("dropping handshake from %P[%I] (handshake limit exceeded)", peer, &hjob->remote_addr);
+		peer->protocol_state->handshake_pending_timeout = ctx.now;
+	}
+
+	free_handshake_job(hjob);
+}
+
+/**
+   Makes sure the shared handshake key for a handshake is available in the handshake cache
 
-	if (!make_shared_handshake_key(false, &handshake_key->key,
-				       peer->key,
-				       peer_handshake_key,
-				       &peer->protocol_state->sigma,
-				       &peer->protocol_state->shared_handshake_key,
-				       compat ? &peer->protocol_state->shared_handshake_key_compat : NULL))
+   If the key isn't cached, its computation is queued for the worker threads and false is returned.
+   After the computation, the handshake packet is handled again (or, if \a handshake is NULL, the
+   handshake response is sent). When the worker queue is full, the handshake is dropped.
+*/
+static bool request_shared_handshake_key(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr,
+					 const fastd_peer_t *packet_peer, fastd_peer_t *peer, bool initiator,
+					 const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
+					 const fastd_handshake_t *handshake, const fastd_method_info_t *method, bool little_endian) {
+	if (is_shared_handshake_key_cached(peer, initiator, handshake_key, peer_handshake_key))
+		return true;
+
+	if (!fastd_timed_out(peer->protocol_state->handshake_pending_timeout)) {
+		pr_debug("ignoring handshake from %P[%I] (previous handshake still being processed)", peer, remote_addr);
 		return false;
+	}
 
-	peer->protocol_state->last_handshake_serial = handshake_key->serial;
-	peer->protocol_state->peer_handshake_key = *peer_handshake_key;
+	size_t packet_len = handshake ? sizeof(fastd_handshake_packet_t) + handshake->tlv_len : 0;
+	handshake_job_t *hjob = fastd_alloc0(sizeof(handshake_job_t) + packet_len);
 
-	return true;
+	hjob->job.work = handshake_job_work;
+	hjob->job.done = handshake_job_done;
+	hjob->job.free = handshake_job_free;
+
+	hjob->peer_id = peer->id;
+	if (packet_peer) {
+		hjob->has_packet_peer = true;
+		hjob->packet_peer_id = packet_peer->id;
+	}
+
+	set_job_socket(hjob, peer, sock);
+	hjob->local_addr = *local_addr;
+	hjob->remote_addr = *remote_addr;
+
+	hjob->initiator = initiator;
+	hjob->serial = handshake_key->serial;
+	hjob->handshake_key = handshake_key->key;
+	hjob->peer_key = *peer->key;
+	hjob->peer_key.multiples = NULL;
+	memcpy(hjob->peer_key_multiples, get_peer_key_multiples(peer), sizeof(hjob->peer_key_multiples));
+	hjob->peer_handshake_key = *peer_handshake_key;
+
+	hjob->method = method;
+	hjob->little_endian = little_endian;
+
+	if (handshake) {
+		hjob->packet_len = packet_len;
+		memcpy(hjob->packet, (const uint8_t *)handshake->tlv_data - sizeof(fastd_handshake_packet_t), packet_len);
+	}
+
+	if (initiator) {
+		/* The handshake was initiated by us, so it has already passed the handshake pacer */
+		submit_handshake_job(hjob);
+		return false;
+	}
+
+	hjob->pacer.priority = fastd_peer_handshake_priority(peer);
+	hjob->pacer.timeout = ctx.now + HANDSHAKE_PACER_MAX_WAIT;
+	hjob->pacer.run = run_paced_handshake_job;
+	hjob->pacer.drop = drop_paced_handshake_job;
+
+	peer->protocol_state->handshake_pending_timeout = ctx.now + HANDSHAKE_PACER_MAX_WAIT + HANDSHAKE_JOB_TIMEOUT;
+	fastd_handshake_pacer_submit(&hjob->pacer);
+
+	return false;
 }
 
 /** Resets the handshake cache for a peer */
@@ -301,19 +678,25 @@ static void clear_shared_handshake_key(const fastd_peer_t *peer) {
 	memset(&peer->protocol_state->shared_handshake_key_compat, 0, sizeof(peer->protocol_state->shared_handshake_key_compat));
 
 	peer->protocol_state->last_handshake_serial = 0;
+	peer->protocol_state->handshake_initiator = false;
 	memset(&peer->protocol_state->peer_handshake_key, 0, sizeof(peer->protocol_state->peer_handshake_key));
 }
 
-/** Sends a reply to an initial handshake (type 1) */
-static void respond_handshake(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
-			      const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian) {
-	pr_debug("responding handshake with %P[%I]...", peer, remote_addr);
+/**
+   Sends a reply to an initial handshake (type 1)
 
+   If the shared handshake key isn't cached yet, it is computed by the worker threads first and
+   respond_handshake() is called again afterwards.
+*/
+static void respond_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
+			      const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian) {
 	const handshake_key_t *handshake_key = &ctx.protocol_state->handshake_key;
 
-	if (!update_shared_handshake_key(peer, handshake_key, peer_handshake_key))
+	if (!request_shared_handshake_key(sock, local_addr, remote_addr, NULL, peer, false, handshake_key, peer_handshake_key, NULL, method, little_endian))
 		return;
 
+	pr_debug("responding handshake with %P[%I]...", peer, remote_addr);
+
 	fastd_handshake_buffer_t buffer = fastd_handshake_new_reply(2, little_endian, fastd_peer_get_mtu(peer), method, *fastd_peer_group_lookup_peer(peer, methods), 4*(4+PUBLICKEYBYTES) + 2*(4+HASHBYTES));
 
 	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
@@ -342,15 +725,11 @@ static void finish_handshake(fastd_socket_t *sock, const fastd_peer_address_t *l
 
 	bool compat = !secure_handshake(handshake);
 
-	aligned_int256_t sigma;
-	fastd_sha256_t shared_handshake_key, shared_handshake_key_compat;
-	if (!make_shared_handshake_key(true, &handshake_key->key,
-				       peer->key,
-				       peer_handshake_key,
-				       &sigma,
-				       compat ? NULL : &shared_handshake_key,
-				       compat ? &shared_handshake_key_compat : NULL))
-		return;
+	/* The shared handshake key has been computed by request_shared_handshake_key() */
+	aligned_int256_t sigma = peer->protocol_state->sigma;
+	fastd_sha256_t shared_handshake_key = peer->protocol_state->shared_handshake_key;
+	fastd_sha256_t shared_handshake_key_compat = peer->protocol_state->shared_handshake_key_compat;
+	clear_shared_handshake_key(peer);
 
 	bool valid;
 	if (!compat) {
@@ -403,9 +782,7 @@ static void handle_finish_handshake(fastd_socket_t *sock, const fastd_peer_addre
 
 	bool compat = !secure_handshake(handshake);
 
-	if (!update_shared_handshake_key(peer, handshake_key, peer_handshake_key))
-		return;
-
+	/* The shared handshake key has been computed by request_shared_handshake_key() */
 	bool valid;
 	if (!compat) {
 		uint8_t mac[HASHBYTES];
@@ -429,33 +806,28 @@ static void handle_finish_handshake(fastd_socket_t *sock, const fastd_peer_addre
 	clear_shared_handshake_key(peer);
 }
 
-/** Searches the peer a public key belongs to, optionally restricting matches to a specific sender address */
+/**
+   Searches the peer a public key belongs to, optionally restricting matches to a specific sender address
+
+   When an address is given, disabled peers are ignored, and errno is set to EPERM if the
+   peer with the given key doesn't match the address or the address is statically configured
+   for a different peer.
+*/
 static fastd_peer_t * find_key(const uint8_t key[PUBLICKEYBYTES], const fastd_peer_address_t *address) {
 	errno = 0;
 
-	fastd_peer_t *ret = NULL;
-	size_t i;
+	fastd_peer_t *ret = fastd_protocol_ec25519_fhmqvc_lookup_key(key);
 
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
-
-		if (address && !fastd_peer_is_enabled(peer))
-			continue;
+	if (address) {
+		if (ret && !fastd_peer_is_enabled(ret))
+			ret = NULL;
 
-		if (secure_memequal(&peer->key->key, key, PUBLICKEYBYTES)) {
-			if (!address)
-				return peer;
-
-			if (!fastd_peer_matches_address(peer, address)) {
-				errno = EPERM;
-				return NULL;
-			}
-
-			ret = peer;
-			continue;
+		if (ret && !fastd_peer_matches_address(ret, address)) {
+			errno = EPERM;
+			return NULL;
 		}
 
-		if (address && fastd_peer_owns_address(peer, address)) {
+		if (fastd_peer_owner_lookup(address, ret)) {
 			errno = EPERM;
 			return NULL;
 		}
@@ -496,7 +868,7 @@ static fastd_peer_t * match_sender_key(const fastd_socket_t *sock, const fastd_p
 void fastd_protocol_ec25519_fhmqvc_handshake_init(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer) {
 	fastd_protocol_ec25519_fhmqvc_maintenance();
 
-	fastd_handshake_buffer_t buffer = fastd_handshake_new_init(3*(4+PUBLICKEYBYTES) /* sender key, recipient key, handshake key */);
+	fastd_handshake_buffer_t buffer = fastd_handshake_new_init(remote_addr, 3*(4+PUBLICKEYBYTES) /* sender key, recipient key, handshake key */);
 
 	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
 
@@ -557,7 +929,7 @@ static fastd_peer_t * add_dynamic(fastd_socket_t *sock, const fastd_peer_address
 		return NULL;
 	}
 
-	fastd_protocol_key_t peer_key;
+	fastd_protocol_key_t peer_key = {};
 	memcpy(&peer_key.key, key, PUBLICKEYBYTES);
 
 	if (!ecc_25519_load_packed_legacy(&peer_key.unpacked, &peer_key.key.int256)
@@ -566,7 +938,7 @@ static fastd_peer_t * add_dynamic(fastd_socket_t *sock, const fastd_peer_address
 		return NULL;
 	}
 
-	fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+	fastd_peer_t *peer = fastd_peer_new();
 	peer->group = conf.on_verify_group;
 	peer->config_state = CONFIG_DYNAMIC;
 
@@ -644,6 +1016,8 @@ static inline fastd_peer_t * add_dynamic(UNUSED fastd_socket_t *sock, const fast
 /** Handles a received handshake packet */
 void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr,
 						    fastd_peer_t *peer, const fastd_handshake_t *handshake) {
+	const fastd_peer_t *packet_peer = peer;
+
 	fastd_protocol_ec25519_fhmqvc_maintenance();
 
 	if (!has_field(handshake, RECORD_SENDER_KEY, PUBLICKEYBYTES)) {
@@ -760,12 +1134,18 @@ void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const
 
 	switch (handshake->type) {
 	case 2:
+		if (!request_shared_handshake_key(sock, local_addr, remote_addr, packet_peer, peer, true, handshake_key, &peer_handshake_key, handshake, method, handshake->little_endian))
+			return;
+
 		pr_verbose("received handshake response from %P[%I]%s%s", peer, remote_addr, handshake->peer_version ? " using fastd " : "", handshake->peer_version ?: "");
 
 		finish_handshake(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method);
 		break;
 
 	case 3:
+		if (!request_shared_handshake_key(sock, local_addr, remote_addr, packet_peer, peer, false, handshake_key, &peer_handshake_key, handshake, method, handshake->little_endian))
+			return;
+
 		pr_debug("received handshake finish from %P[%I]%s%s", peer, remote_addr, handshake->peer_version ? " using fastd " : "", handshake->peer_version ?: "");
 
 		handle_finish_handshake(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method);
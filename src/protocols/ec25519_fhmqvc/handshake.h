@@ -35,6 +35,10 @@
 #include "ec25519_fhmqvc.h"
 
 
+/** The number of entries of the fixed-base comb table used to generate ephemeral keys */
+#define BASE_COMB_ENTRIES 16
+
+
 /**
    An ephemeral keypair used for the handshake protocol
 
@@ -64,6 +68,17 @@ typedef struct handshake_key {
 struct fastd_protocol_state {
 	handshake_key_t prev_handshake_key;	/**< The previously generated handshake keypair */
 	handshake_key_t handshake_key;		/**< The newest handshake keypair */
+
+	size_t handshake_key_pool_len;		/**< The number of keypairs in handshake_key_pool */
+	keypair_t handshake_key_pool[HANDSHAKE_KEY_POOL_SIZE]; /**< Ephemeral keypairs generated in advance by the worker threads */
+	bool handshake_key_job_pending;		/**< true while a worker thread is generating a keypair for the pool */
+
+	ecc_25519_work_t base_comb[BASE_COMB_ENTRIES]; /**< Sums of subsets of {G, 2^64 G, 2^128 G, 2^192 G} for the base point G */
+
+	uint32_t peer_key_ht_seed;		/**< The hash seed used for peer_key_ht */
+	size_t peer_key_ht_size;		/**< The number of hash buckets in the peer key hashtable */
+	size_t peer_key_ht_used;		/**< The current number of entries in the peer key hashtable */
+	VECTOR(fastd_peer_t *) *peer_key_ht;	/**< An array of hash buckets indexing all peers by their public keys */
 };
 
 
@@ -32,8 +32,39 @@
 
 #include "handshake.h"
 #include "../../crypto.h"
+#include "../../hash.h"
+#include "../../worker.h"
 
 
+/** A job generating an ephemeral keypair on a worker thread */
+typedef struct handshake_key_job {
+	fastd_worker_job_t job;			/**< The generic worker job */
+	keypair_t key;				/**< The generated keypair */
+} handshake_key_job_t;
+
+
+/**
+   Precomputes the fixed-base comb table of the base point
+
+   Entry i contains the sum of 2^(64*t) G for all bits t set in i.
+*/
+static void init_base_comb(void) {
+	ecc_25519_work_t *comb = ctx.protocol_state->base_comb;
+	comb[0] = ecc_25519_work_identity;
+
+	size_t t;
+	for (t = 0; t < 4; t++) {
+		ecc_int256_t n = {};
+		n.p[8*t] = 1;
+
+		ecc_25519_scalarmult_base(&comb[1 << t], &n);
+
+		size_t i;
+		for (i = 1; i < (1u << t); i++)
+			ecc_25519_add(&comb[(1 << t) | i], &comb[1 << t], &comb[i]);
+	}
+}
+
 /** Allocates the protocol-specific state */
 static void init_protocol_state(void) {
 	if (!ctx.protocol_state) {
@@ -41,43 +72,245 @@ static void init_protocol_state(void) {
 
 		ctx.protocol_state->prev_handshake_key.preferred_till = ctx.now;
 		ctx.protocol_state->handshake_key.preferred_till = ctx.now;
+
+		init_base_comb();
 	}
 }
 
+/** Copies the entry \e index of the base comb table to \e out without any secret-dependent memory accesses */
+static void base_comb_select(ecc_25519_work_t *out, unsigned index) {
+	uint8_t *dst = (uint8_t *)out;
+	memset(dst, 0, sizeof(*out));
+
+	unsigned i;
+	size_t j;
+	for (i = 0; i < BASE_COMB_ENTRIES; i++) {
+		uint32_t diff = i ^ index;
+		uint8_t mask = ((diff | -diff) >> 31) - 1;
+
+		const uint8_t *src = (const uint8_t *)&ctx.protocol_state->base_comb[i];
+		for (j = 0; j < sizeof(*out); j++)
+			dst[j] |= src[j] & mask;
+	}
+}
+
+/**
+   Multiplies the base point with a secret scalar using the fixed-base comb table
+
+   This takes 64 point doublings and additions instead of the 256 each needed by ecc_25519_scalarmult_base(),
+   and runs in constant time as well.
+*/
+static void scalarmult_base_comb(ecc_25519_work_t *out, const ecc_int256_t *n) {
+	ecc_25519_work_t work = ecc_25519_work_identity, entry;
+
+	ssize_t i;
+	for (i = 63; i >= 0; i--) {
+		unsigned index = int256_bit(n, i) | int256_bit(n, i+64) << 1 | int256_bit(n, i+128) << 2 | int256_bit(n, i+192) << 3;
+
+		ecc_25519_double(&work, &work);
+
+		base_comb_select(&entry, index);
+		ecc_25519_add(&work, &work, &entry);
+	}
+
+	*out = work;
+	secure_memzero(&work, sizeof(work));
+	secure_memzero(&entry, sizeof(entry));
+}
+
 /** Generates a new ephemeral keypair */
 static void new_handshake_key(keypair_t *key) {
 	fastd_random_bytes(key->secret.p, SECRETKEYBYTES, false);
 	ecc_25519_gf_sanitize_secret(&key->secret, &key->secret);
 
 	ecc_25519_work_t work;
-	ecc_25519_scalarmult_base(&work, &key->secret);
+	scalarmult_base_comb(&work, &key->secret);
 	ecc_25519_store_packed_legacy(&key->public.int256, &work);
 
 	if (!divide_key(&key->secret))
 		exit_bug("generated invalid ephemeral key");
 }
 
+static void fill_handshake_key_pool(void);
+
+/** Generates an ephemeral keypair for the pool (called on a worker thread) */
+static void handshake_key_job_work(fastd_worker_job_t *job) {
+	handshake_key_job_t *kjob = container_of(job, handshake_key_job_t, job);
+	new_handshake_key(&kjob->key);
+}
+
+/** Frees a keypair generation job, erasing the keypair */
+static void handshake_key_job_free(fastd_worker_job_t *job) {
+	handshake_key_job_t *kjob = container_of(job, handshake_key_job_t, job);
+
+	secure_memzero(kjob, sizeof(*kjob));
+	free(kjob);
+}
+
+/** Adds a keypair generated by a worker thread to the pool */
+static void handshake_key_job_done(fastd_worker_job_t *job) {
+	handshake_key_job_t *kjob = container_of(job, handshake_key_job_t, job);
+
+	ctx.protocol_state->handshake_key_job_pending = false;
+
+	if (ctx.protocol_state->handshake_key_pool_len < HANDSHAKE_KEY_POOL_SIZE)
+		ctx.protocol_state->handshake_key_pool[ctx.protocol_state->handshake_key_pool_len++] = kjob->key;
+
+	handshake_key_job_free(job);
+
+	fill_handshake_key_pool();
+}
+
+/** Queues the generation of another ephemeral keypair if the pool isn't full */
+static void fill_handshake_key_pool(void) {
+	if (ctx.protocol_state->handshake_key_job_pending || ctx.protocol_state->handshake_key_pool_len >= HANDSHAKE_KEY_POOL_SIZE)
+		return;
+
+	handshake_key_job_t *kjob = fastd_new0(handshake_key_job_t);
+	kjob->job.work = handshake_key_job_work;
+	kjob->job.done = handshake_key_job_done;
+	kjob->job.free = handshake_key_job_free;
+
+	if (!fastd_worker_submit(&kjob->job)) {
+		free(kjob);
+		return;
+	}
+
+	ctx.protocol_state->handshake_key_job_pending = true;
+}
+
+/** Takes a keypair from the pool, or generates one synchronously if the pool is empty */
+static void take_handshake_key(keypair_t *key) {
+	if (!ctx.protocol_state->handshake_key_pool_len) {
+		pr_debug("generating new handshake key");
+		new_handshake_key(key);
+		return;
+	}
+
+	keypair_t *pooled = &ctx.protocol_state->handshake_key_pool[--ctx.protocol_state->handshake_key_pool_len];
+
+	*key = *pooled;
+	secure_memzero(pooled, sizeof(*pooled));
+}
+
 /**
    Performs maintenance tasks on the protocol state
 
    If there is currently no preferred ephemeral keypair, a new one
-   will be generated.
+   will be taken from the pool of pre-generated keypairs (or generated
+   if the pool is empty). Afterwards, the pool is refilled in the background.
 */
 void fastd_protocol_ec25519_fhmqvc_maintenance(void) {
 	init_protocol_state();
 
 	if (!is_handshake_key_preferred(&ctx.protocol_state->handshake_key)) {
-		pr_debug("generating new handshake key");
+		pr_debug("rotating handshake key");
 
+		secure_memzero(&ctx.protocol_state->prev_handshake_key.key, sizeof(ctx.protocol_state->prev_handshake_key.key));
 		ctx.protocol_state->prev_handshake_key = ctx.protocol_state->handshake_key;
 
 		ctx.protocol_state->handshake_key.serial++;
 
-		new_handshake_key(&ctx.protocol_state->handshake_key.key);
+		take_handshake_key(&ctx.protocol_state->handshake_key.key);
 
 		ctx.protocol_state->handshake_key.preferred_till = ctx.now + 15000;
 		ctx.protocol_state->handshake_key.valid_till = ctx.now + 30000;
 	}
+
+	fill_handshake_key_pool();
+}
+
+/** Gets the hash bucket used for a public key */
+static size_t peer_key_bucket(const uint8_t key[PUBLICKEYBYTES]) {
+	uint32_t hash = ctx.protocol_state->peer_key_ht_seed;
+	fastd_hash(&hash, key, PUBLICKEYBYTES);
+	fastd_hash_final(&hash);
+
+	return hash % ctx.protocol_state->peer_key_ht_size;
+}
+
+/** Initializes the peer key hashtable with a given size */
+static void init_key_hashtable(size_t size) {
+	ctx.protocol_state->peer_key_ht_size = size;
+	ctx.protocol_state->peer_key_ht_used = 0;
+
+	fastd_random_bytes(&ctx.protocol_state->peer_key_ht_seed, sizeof(ctx.protocol_state->peer_key_ht_seed), false);
+	ctx.protocol_state->peer_key_ht = fastd_new0_array(size, __typeof__(*ctx.protocol_state->peer_key_ht));
+}
+
+/** Frees the peer key hashtable */
+static void free_key_hashtable(void) {
+	size_t i;
+	for (i = 0; i < ctx.protocol_state->peer_key_ht_size; i++)
+		VECTOR_FREE(ctx.protocol_state->peer_key_ht[i]);
+
+	free(ctx.protocol_state->peer_key_ht);
+	ctx.protocol_state->peer_key_ht = NULL;
+	ctx.protocol_state->peer_key_ht_size = 0;
+}
+
+/** Adds a peer to its bucket of the peer key hashtable */
+static void key_bucket_add(fastd_peer_t *peer) {
+	VECTOR_ADD(ctx.protocol_state->peer_key_ht[peer_key_bucket(peer->key->key.u8)], peer);
+	ctx.protocol_state->peer_key_ht_used++;
+}
+
+/** Inserts a peer into the peer key hashtable, doubling its size when it gets too full */
+static void key_hashtable_insert(fastd_peer_t *peer) {
+	if (!ctx.protocol_state->peer_key_ht) {
+		init_key_hashtable(8);
+	}
+	else if (ctx.protocol_state->peer_key_ht_used >= 2*ctx.protocol_state->peer_key_ht_size) {
+		size_t size = 2*ctx.protocol_state->peer_key_ht_size;
+
+		free_key_hashtable();
+		init_key_hashtable(size);
+
+		pr_debug("resizing peer key hashtable to %u buckets", (unsigned)size);
+
+		fastd_peer_t *other;
+		for (other = ctx.peers; other; other = other->next) {
+			if (other != peer && other->protocol_state)
+				key_bucket_add(other);
+		}
+	}
+
+	key_bucket_add(peer);
+}
+
+/** Removes a peer from the peer key hashtable, freeing the table when it becomes empty */
+static void key_hashtable_remove(fastd_peer_t *peer) {
+	size_t b = peer_key_bucket(peer->key->key.u8);
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.protocol_state->peer_key_ht[b]); i++) {
+		if (VECTOR_INDEX(ctx.protocol_state->peer_key_ht[b], i) == peer) {
+			VECTOR_DELETE(ctx.protocol_state->peer_key_ht[b], i);
+			ctx.protocol_state->peer_key_ht_used--;
+			break;
+		}
+	}
+
+	if (!ctx.protocol_state->peer_key_ht_used)
+		free_key_hashtable();
+}
+
+/** Returns the first peer (including disabled peers) with a given public key, or NULL if there is none */
+fastd_peer_t * fastd_protocol_ec25519_fhmqvc_lookup_key(const uint8_t key[PUBLICKEYBYTES]) {
+	if (!ctx.protocol_state || !ctx.protocol_state->peer_key_ht)
+		return NULL;
+
+	size_t b = peer_key_bucket(key);
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.protocol_state->peer_key_ht[b]); i++) {
+		fastd_peer_t *peer = VECTOR_INDEX(ctx.protocol_state->peer_key_ht[b], i);
+
+		if (secure_memequal(&peer->key->key, key, PUBLICKEYBYTES))
+			return peer;
+	}
+
+	return NULL;
 }
 
 /** Allocated protocol-specific peer state */
@@ -89,6 +322,8 @@ void fastd_protocol_ec25519_fhmqvc_init_peer_state(fastd_peer_t *peer) {
 
 	peer->protocol_state = fastd_new0(fastd_protocol_peer_state_t);
 	peer->protocol_state->last_serial = ctx.protocol_state->handshake_key.serial;
+
+	key_hashtable_insert(peer);
 }
 
 /** Resets a the state of a session, freeing method-specific state */
@@ -109,7 +344,12 @@ void fastd_protocol_ec25519_fhmqvc_reset_peer_state(fastd_peer_t *peer) {
 
 /** Frees the protocol-specific state */
 void fastd_protocol_ec25519_fhmqvc_free_peer_state(fastd_peer_t *peer) {
+	free(peer->key->multiples);
+	peer->key->multiples = NULL;
+
 	if (peer->protocol_state) {
+		key_hashtable_remove(peer);
+
 		reset_session(&peer->protocol_state->old_session);
 		reset_session(&peer->protocol_state->session);
 
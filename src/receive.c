@@ -33,8 +33,10 @@
 #include "fastd.h"
 #include "handshake.h"
 #include "hash.h"
+#include "neighbor.h"
 #include "peer.h"
 #include "peer_hashtable.h"
+#include "route.h"
 
 #include <sys/uio.h>
 
@@ -159,8 +161,42 @@ static bool backoff_unknown(const fastd_peer_address_t *addr) {
 	return false;
 }
 
+/** A number of payload packets received from the same peer, which are handed to the protocol together */
+typedef struct receive_batch {
+	fastd_peer_t *peer;				/**< The peer the packets were received from */
+	size_t n;					/**< The number of packets in the batch */
+	fastd_buffer_t buffers[RECEIVE_BATCH_SIZE];	/**< The received packets */
+} receive_batch_t;
+
+/** Passes all packets of a batch to the protocol */
+static void receive_batch_flush(receive_batch_t *batch) {
+	if (!batch->n)
+		return;
+
+	if (batch->n == 1 || !conf.protocol->handle_recv_batch) {
+		size_t i;
+		for (i = 0; i < batch->n; i++)
+			conf.protocol->handle_recv(batch->peer, batch->buffers[i]);
+	}
+	else {
+		conf.protocol->handle_recv_batch(batch->peer, batch->buffers, batch->n);
+	}
+
+	batch->peer = NULL;
+	batch->n = 0;
+}
+
+/** Adds a payload packet to a batch, flushing the batch first if it contains packets of a different peer */
+static inline void receive_batch_add(receive_batch_t *batch, fastd_peer_t *peer, fastd_buffer_t buffer) {
+	if (batch->peer != peer || batch->n == RECEIVE_BATCH_SIZE)
+		receive_batch_flush(batch);
+
+	batch->peer = peer;
+	batch->buffers[batch->n++] = buffer;
+}
+
 /** Handles a packet received from a known peer address */
-static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer) {
+static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer, receive_batch_t *batch) {
 	if (!fastd_peer_may_connect(peer)) {
 		fastd_buffer_free(buffer);
 		return;
@@ -181,10 +217,12 @@ static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd
 			return;
 		}
 
-		conf.protocol->handle_recv(peer, buffer);
+		receive_batch_add(batch, peer, buffer);
 		break;
 
 	case PACKET_HANDSHAKE:
+		/* handshakes may modify the peer list, so all pending payload packets must be handled first */
+		receive_batch_flush(batch);
 		fastd_handshake_handle(sock, local_addr, remote_addr, peer, buffer);
 	}
 }
@@ -195,7 +233,7 @@ static inline bool allow_unknown_peers(void) {
 }
 
 /** Handles a packet received from an unknown address */
-static inline void handle_socket_receive_unknown(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer) {
+static inline void handle_socket_receive_unknown(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer, receive_batch_t *batch) {
 	const uint8_t *packet_type = buffer.data;
 	fastd_buffer_push_head(&buffer, 1);
 
@@ -210,12 +248,13 @@ static inline void handle_socket_receive_unknown(fastd_socket_t *sock, const fas
 		break;
 
 	case PACKET_HANDSHAKE:
+		receive_batch_flush(batch);
 		fastd_handshake_handle(sock, local_addr, remote_addr, NULL, buffer);
 	}
 }
 
 /** Handles a packet read from a socket */
-static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer) {
+static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer, receive_batch_t *batch) {
 	fastd_peer_t *peer = NULL;
 
 	if (sock->peer) {
@@ -231,10 +270,10 @@ static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_
 	}
 
 	if (peer) {
-		handle_socket_receive_known(sock, local_addr, remote_addr, peer, buffer);
+		handle_socket_receive_known(sock, local_addr, remote_addr, peer, buffer, batch);
 	}
 	else if (allow_unknown_peers()) {
-		handle_socket_receive_unknown(sock, local_addr, remote_addr, buffer);
+		handle_socket_receive_unknown(sock, local_addr, remote_addr, buffer, batch);
 	}
 	else  {
 		pr_debug("received packet from unknown peer %I", remote_addr);
@@ -242,11 +281,29 @@ static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_
 	}
 }
 
-/** Reads a packet from a socket */
-void fastd_receive(fastd_socket_t *sock) {
+/** Handles a message read from a socket */
+static inline void handle_socket_message(fastd_socket_t *sock, struct msghdr *message, fastd_peer_address_t *recvaddr, fastd_buffer_t buffer, receive_batch_t *batch) {
+	fastd_peer_address_t local_addr;
+
+	handle_socket_control(message, sock, &local_addr);
+
+#ifdef USE_PKTINFO
+	if (!local_addr.sa.sa_family) {
+		pr_error("received packet without packet info");
+		fastd_buffer_free(buffer);
+		return;
+	}
+#endif
+
+	fastd_peer_address_simplify(recvaddr);
+
+	handle_socket_receive(sock, &local_addr, recvaddr, buffer, batch);
+}
+
+/** Reads a single packet from a socket */
+static void receive_single(fastd_socket_t *sock) {
 	size_t max_len = 1 + fastd_max_payload(ctx.max_mtu) + conf.max_overhead;
 	fastd_buffer_t buffer = fastd_buffer_alloc(max_len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
-	fastd_peer_address_t local_addr;
 	fastd_peer_address_t recvaddr;
 	struct iovec buffer_vec = { .iov_base = buffer.data, .iov_len = buffer.len };
 	uint8_t cbuf[1024] __attribute__((aligned(8)));
@@ -271,19 +328,157 @@ void fastd_receive(fastd_socket_t *sock) {
 
 	buffer.len = len;
 
-	handle_socket_control(&message, sock, &local_addr);
+	receive_batch_t batch = {};
+	handle_socket_message(sock, &message, &recvaddr, buffer, &batch);
+	receive_batch_flush(&batch);
+}
 
-#ifdef USE_PKTINFO
-	if (!local_addr.sa.sa_family) {
-		pr_error("received packet without packet info");
-		fastd_buffer_free(buffer);
-		return;
+#ifdef HAVE_RECVMMSG
+
+/** The receive buffers kept allocated between calls to fastd_receive() */
+static struct {
+	size_t len;					/**< The size the buffers were allocated with */
+	size_t head_space;				/**< The head space the buffers were allocated with */
+	size_t tail_space;				/**< The tail space the buffers were allocated with */
+	fastd_buffer_t buffers[RECEIVE_BATCH_SIZE];	/**< The buffers; an entry with base == NULL must be allocated before use */
+} receive_pool;
+
+/** Frees the buffers of the receive pool */
+void fastd_receive_free(void) {
+	size_t i;
+	for (i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+		fastd_buffer_free(receive_pool.buffers[i]);
+		receive_pool.buffers[i].base = NULL;
 	}
+}
+
+/** Makes sure all buffers of the receive pool are allocated and large enough */
+static void receive_pool_fill(size_t len, size_t head_space, size_t tail_space) {
+	if (receive_pool.len != len || receive_pool.head_space != head_space || receive_pool.tail_space != tail_space) {
+		fastd_receive_free();
+
+		receive_pool.len = len;
+		receive_pool.head_space = head_space;
+		receive_pool.tail_space = tail_space;
+	}
+
+	size_t i;
+	for (i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+		fastd_buffer_t *buffer = &receive_pool.buffers[i];
+
+		if (buffer->base) {
+			buffer->data = buffer->base + head_space;
+			buffer->len = len;
+		}
+		else {
+			*buffer = fastd_buffer_alloc(len, head_space, tail_space);
+		}
+	}
+}
+
+/**
+   Reads multiple packets from a bound socket
+
+   Up to RECEIVE_BATCH_SIZE packets are read with a single recvmmsg() call, and
+   consecutive payload packets of the same peer are decrypted together. The
+   receive buffers are kept between calls; only the ones passed on to the
+   packet handlers are replaced.
+*/
+static void receive_batch(fastd_socket_t *sock) {
+	size_t max_len = 1 + fastd_max_payload(ctx.max_mtu) + conf.max_overhead;
+
+	fastd_peer_address_t recvaddrs[RECEIVE_BATCH_SIZE];
+	struct iovec buffer_vecs[RECEIVE_BATCH_SIZE];
+	uint8_t cbufs[RECEIVE_BATCH_SIZE][1024] __attribute__((aligned(8)));
+	struct mmsghdr messages[RECEIVE_BATCH_SIZE];
+
+	receive_pool_fill(max_len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
+
+	size_t i;
+	for (i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+		buffer_vecs[i] = (struct iovec){ .iov_base = receive_pool.buffers[i].data, .iov_len = receive_pool.buffers[i].len };
+
+		messages[i] = (struct mmsghdr){
+			.msg_hdr = {
+				.msg_name = &recvaddrs[i],
+				.msg_namelen = sizeof(recvaddrs[i]),
+				.msg_iov = &buffer_vecs[i],
+				.msg_iovlen = 1,
+				.msg_control = cbufs[i],
+				.msg_controllen = sizeof(cbufs[i]),
+			},
+		};
+	}
+
+	int n = recvmmsg(sock->fd.fd, messages, RECEIVE_BATCH_SIZE, 0, NULL);
+	if (n < 0) {
+		pr_warn_errno("recvmmsg");
+		n = 0;
+	}
+
+	receive_batch_t batch = {};
+
+	for (i = 0; i < (size_t)n; i++) {
+		if (!messages[i].msg_len)
+			continue;
+
+		fastd_buffer_t buffer = receive_pool.buffers[i];
+		buffer.len = messages[i].msg_len;
+		receive_pool.buffers[i].base = NULL;
+
+		handle_socket_message(sock, &messages[i].msg_hdr, &recvaddrs[i], buffer, &batch);
+	}
+
+	receive_batch_flush(&batch);
+}
+
+/**
+   Reads packets from a socket
+
+   Only the sockets bound to the configured addresses are read in batches. A peer's
+   dynamic socket may be closed while one of its packets is handled, so it is read
+   one packet at a time.
+*/
+void fastd_receive(fastd_socket_t *sock) {
+	if (sock->peer)
+		receive_single(sock);
+	else
+		receive_batch(sock);
+}
+
+#else
+
+/** Reads a packet from a socket */
+void fastd_receive(fastd_socket_t *sock) {
+	receive_single(sock);
+}
+
+/** Frees the buffers of the receive pool (no-op without recvmmsg() support) */
+void fastd_receive_free(void) {
+}
+
 #endif
 
-	fastd_peer_address_simplify(&recvaddr);
+/**
+   Checks if a packet received from a peer in TAP mode only needs to be forwarded
+
+   This is the case for unicast packets to a MAC address learned on another peer
+   than the one the packet was received from, which are forwarded without writing
+   them to the TAP interface.
+*/
+static inline bool forward_only(const fastd_peer_t *peer, const fastd_buffer_t buffer) {
+	if (conf.mode != MODE_TAP || !conf.forward)
+		return false;
 
-	handle_socket_receive(sock, &local_addr, &recvaddr, buffer);
+	fastd_eth_addr_t dest_addr = fastd_buffer_dest_address(buffer);
+	if (!fastd_eth_addr_is_unicast(dest_addr))
+		return false;
+
+	fastd_peer_t *dest;
+	if (!fastd_peer_find_by_eth_addr(dest_addr, &dest))
+		return false;
+
+	return dest && dest != peer;
 }
 
 /** Handles a received and decrypted payload packet */
@@ -300,6 +495,8 @@ void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reorde
 		if (fastd_eth_addr_is_unicast(src_addr))
 			fastd_peer_eth_addr_add(peer, src_addr);
 
+		fastd_neighbor_snoop(buffer);
+
 		if (buffer.len >= 15) {
 			uint16_t proto = ntohs(*(uint16_t*)(buffer.data+12));
 			uint8_t type = *(uint8_t*)(buffer.data+14);
@@ -312,13 +509,20 @@ void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reorde
 			}
 		}
 	}
+	else {
+		fastd_route_learn(peer, buffer);
+	}
 
 	fastd_stats_add(peer, STAT_RX, buffer.len);
+	peer->last_data_received = ctx.now;
 
 	if (reordered)
 		fastd_stats_add(peer, STAT_RX_REORDERED, buffer.len);
 
-	fastd_iface_write(peer->iface, buffer);
+	if (forward_only(peer, buffer))
+		ctx.forward_cut_through++;
+	else if (peer->iface)
+		fastd_iface_write(peer->iface, buffer);
 
 	if (conf.mode == MODE_TAP && conf.forward) {
 		fastd_send_data(buffer, peer, NULL);
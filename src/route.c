@@ -0,0 +1,420 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Longest-prefix-match route tables for TUN mode with a shared interface
+*/
+
+
+#include "route.h"
+#include "peer.h"
+
+#include <arpa/inet.h>
+
+
+/** A list of prefixes */
+typedef VECTOR(fastd_route_prefix_t) prefix_vector_t;
+
+
+/** Returns the route table for an address family */
+static inline fastd_route_node_t ** table_root(sa_family_t af) {
+	return (af == AF_INET) ? &ctx.routes4 : &ctx.routes6;
+}
+
+/** Returns the address length of an address family in bits */
+static inline unsigned af_bits(sa_family_t af) {
+	return (af == AF_INET) ? 32 : 128;
+}
+
+/** Returns the bit of an address at a given position */
+static inline unsigned addr_bit(const uint8_t *addr, unsigned bit) {
+	return (addr[bit/8] >> (7 - bit%8)) & 1;
+}
+
+/** Returns the number of leading bits two addresses have in common, up to \e max */
+static inline unsigned common_bits(const uint8_t *addr1, const uint8_t *addr2, unsigned max) {
+	unsigned i;
+	for (i = 0; i < max; i += 8) {
+		unsigned diff = addr1[i/8] ^ addr2[i/8];
+
+		if (diff) {
+			unsigned bits = i + __builtin_clz(diff) - (8*sizeof(unsigned) - 8);
+			return (bits < max) ? bits : max;
+		}
+	}
+
+	return max;
+}
+
+/** Checks if an address is a unicast address that may be routed to a peer */
+static inline bool is_unicast(sa_family_t af, const uint8_t *addr) {
+	static const uint8_t zero[16] = {};
+
+	if (af == AF_INET)
+		return (addr[0] & 0xf0) != 0xe0 && (addr[0] & 0xf0) != 0xf0 && memcmp(addr, zero, 4);
+	else
+		return addr[0] != 0xff && memcmp(addr, zero, 16);
+}
+
+/**
+   Finds the source or destination address of an IP packet
+
+   Returns false if the packet isn't a valid IPv4 or IPv6 packet.
+*/
+static inline bool get_packet_address(const fastd_buffer_t buffer, bool source, sa_family_t *af, const uint8_t **addr) {
+	const uint8_t *data = buffer.data;
+
+	if (!buffer.len)
+		return false;
+
+	switch (data[0] >> 4) {
+	case 4:
+		if (buffer.len < 20)
+			return false;
+
+		*af = AF_INET;
+		*addr = data + (source ? 12 : 16);
+		return true;
+
+	case 6:
+		if (buffer.len < 40)
+			return false;
+
+		*af = AF_INET6;
+		*addr = data + (source ? 8 : 24);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Formats a prefix for log messages */
+static void format_prefix(char *buf, size_t len, sa_family_t af, const uint8_t *addr, unsigned prefix_len) {
+	char addr_buf[INET6_ADDRSTRLEN];
+
+	if (!inet_ntop(af, addr, addr_buf, sizeof(addr_buf)))
+		addr_buf[0] = 0;
+
+	snprintf(buf, len, "%s/%u", addr_buf, prefix_len);
+}
+
+/** Allocates a new route table node for a prefix (the address is masked to the prefix length) */
+static fastd_route_node_t * new_node(const uint8_t *addr, unsigned len) {
+	fastd_route_node_t *node = fastd_new0(fastd_route_node_t);
+
+	node->len = len;
+	memcpy(node->addr, addr, (len+7)/8);
+
+	if (len % 8)
+		node->addr[len/8] &= 0xff << (8 - len%8);
+
+	return node;
+}
+
+/** Returns the node for a prefix, inserting it (without a route) if it doesn't exist yet */
+static fastd_route_node_t * insert_node(fastd_route_node_t **slot, const uint8_t *addr, unsigned len) {
+	fastd_route_node_t *node;
+	unsigned common;
+
+	while (true) {
+		node = *slot;
+		if (!node) {
+			*slot = new_node(addr, len);
+			return *slot;
+		}
+
+		common = common_bits(node->addr, addr, (node->len < len) ? node->len : len);
+		if (common < node->len)
+			break;
+
+		if (node->len == len)
+			return node;
+
+		slot = &node->child[addr_bit(addr, node->len)];
+	}
+
+	/* The node's prefix isn't a prefix of the new one, so the new prefix or a
+	   common parent must be inserted in its place */
+	fastd_route_node_t *ret = new_node(addr, len);
+
+	if (common == len) {
+		ret->child[addr_bit(node->addr, len)] = node;
+		*slot = ret;
+	}
+	else {
+		fastd_route_node_t *parent = new_node(addr, common);
+		parent->child[addr_bit(node->addr, common)] = node;
+		parent->child[addr_bit(addr, common)] = ret;
+		*slot = parent;
+	}
+
+	return ret;
+}
+
+/** Finds the node with the longest prefix matching an address that has a route */
+static inline fastd_route_node_t * lookup_node(fastd_route_node_t *node, const uint8_t *addr, unsigned bits) {
+	fastd_route_node_t *ret = NULL;
+
+	while (node && common_bits(node->addr, addr, node->len) == node->len) {
+		if (node->peer)
+			ret = node;
+
+		if (node->len == bits)
+			break;
+
+		node = node->child[addr_bit(addr, node->len)];
+	}
+
+	return ret;
+}
+
+/** Finds the node for exactly the given prefix, or returns NULL if it doesn't exist */
+static inline fastd_route_node_t * find_node(fastd_route_node_t *node, const uint8_t *addr, unsigned len) {
+	while (node && node->len <= len && common_bits(node->addr, addr, node->len) == node->len) {
+		if (node->len == len)
+			return node;
+
+		node = node->child[addr_bit(addr, node->len)];
+	}
+
+	return NULL;
+}
+
+/**
+   Removes the routes of a peer from a subtree, returning the new root of the subtree
+
+   The prefixes of removed configured routes other peers have configured as well are added to \e shadowed.
+*/
+static fastd_route_node_t * remove_routes(fastd_route_node_t *node, sa_family_t af, fastd_peer_t *peer, bool learned_only, prefix_vector_t *shadowed) {
+	if (!node)
+		return NULL;
+
+	node->child[0] = remove_routes(node->child[0], af, peer, learned_only, shadowed);
+	node->child[1] = remove_routes(node->child[1], af, peer, learned_only, shadowed);
+
+	if (node->peer == peer && (node->learned || !learned_only)) {
+		if (node->learned) {
+			peer->learned_routes--;
+			ctx.n_learned_routes--;
+		}
+
+		if (node->shadowed) {
+			fastd_route_prefix_t prefix = { .af = af, .len = node->len };
+			memcpy(prefix.addr, node->addr, sizeof(prefix.addr));
+			VECTOR_ADD(*shadowed, prefix);
+
+			node->shadowed = 0;
+		}
+
+		node->peer = NULL;
+		node->learned = false;
+		ctx.n_routes--;
+	}
+
+	if (node->peer || (node->child[0] && node->child[1]))
+		return node;
+
+	fastd_route_node_t *child = node->child[0] ? node->child[0] : node->child[1];
+	free(node);
+	return child;
+}
+
+
+/** Adds the configured routes of a peer to the route tables */
+void fastd_route_add_peer(fastd_peer_t *peer) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(peer->routes); i++) {
+		const fastd_route_prefix_t *prefix = &VECTOR_INDEX(peer->routes, i);
+		fastd_route_node_t *node = insert_node(table_root(prefix->af), prefix->addr, prefix->len);
+
+		if (node->peer && !node->learned) {
+			if (node->peer == peer)
+				continue;
+
+			char buf[INET6_ADDRSTRLEN + 5];
+			format_prefix(buf, sizeof(buf), prefix->af, prefix->addr, prefix->len);
+			pr_warn("route %s of peer %P is already used by peer %P, ignoring", buf, peer, node->peer);
+
+			node->shadowed++;
+			continue;
+		}
+
+		if (node->peer) {
+			/* Configured routes replace learned ones */
+			node->peer->learned_routes--;
+			ctx.n_learned_routes--;
+		}
+		else {
+			ctx.n_routes++;
+		}
+
+		node->peer = peer;
+		node->learned = false;
+	}
+}
+
+/** Makes the first other peer which has configured a prefix the owner of its route */
+static void restore_route(const fastd_route_prefix_t *prefix, const fastd_peer_t *removed) {
+	fastd_route_node_t *node = NULL;
+
+	fastd_peer_t *other;
+	for (other = ctx.peers; other; other = other->next) {
+		if (other == removed)
+			continue;
+
+		size_t i;
+		for (i = 0; i < VECTOR_LEN(other->routes); i++) {
+			if (!fastd_route_prefix_equal(&VECTOR_INDEX(other->routes, i), prefix))
+				continue;
+
+			if (!node) {
+				node = insert_node(table_root(prefix->af), prefix->addr, prefix->len);
+
+				if (node->peer) {
+					node->peer->learned_routes--;
+					ctx.n_learned_routes--;
+				}
+				else {
+					ctx.n_routes++;
+				}
+
+				node->peer = other;
+				node->learned = false;
+			}
+			else if (node->peer != other) {
+				node->shadowed++;
+			}
+		}
+	}
+}
+
+/**
+   Removes all routes (or only the learned routes) of a peer from the route tables
+
+   When configured routes are removed, only the prefixes which were also configured for other peers
+   (and ignored for them) are looked up again, so the next of these peers becomes their owner.
+*/
+void fastd_route_remove_peer(fastd_peer_t *peer, bool learned_only) {
+	if (!peer->learned_routes && (learned_only || !VECTOR_LEN(peer->routes)))
+		return;
+
+	size_t i;
+
+	if (!learned_only) {
+		/* Forget the claims of the peer on prefixes other peers own */
+		for (i = 0; i < VECTOR_LEN(peer->routes); i++) {
+			const fastd_route_prefix_t *prefix = &VECTOR_INDEX(peer->routes, i);
+			fastd_route_node_t *node = find_node(*table_root(prefix->af), prefix->addr, prefix->len);
+
+			if (node && node->peer != peer && node->shadowed)
+				node->shadowed--;
+		}
+	}
+
+	prefix_vector_t shadowed = {};
+
+	ctx.routes4 = remove_routes(ctx.routes4, AF_INET, peer, learned_only, &shadowed);
+	ctx.routes6 = remove_routes(ctx.routes6, AF_INET6, peer, learned_only, &shadowed);
+
+	for (i = 0; i < VECTOR_LEN(shadowed); i++)
+		restore_route(&VECTOR_INDEX(shadowed, i), peer);
+
+	VECTOR_FREE(shadowed);
+}
+
+/**
+   Looks up the peer a packet read from the TUN interface is routed to
+
+   Returns false for multicast and broadcast packets and packets that aren't
+   valid IP packets, which need to be sent to all peers. Otherwise, \e peer is
+   set to the peer with the longest matching prefix, or NULL if there is none.
+*/
+bool fastd_route_lookup(const fastd_buffer_t buffer, fastd_peer_t **peer) {
+	sa_family_t af;
+	const uint8_t *addr;
+
+	if (!get_packet_address(buffer, false, &af, &addr) || !is_unicast(af, addr))
+		return false;
+
+	const fastd_route_node_t *node = lookup_node(*table_root(af), addr, af_bits(af));
+	*peer = node ? node->peer : NULL;
+
+	return true;
+}
+
+/**
+   Learns a host route for the source address of a packet received from a peer
+
+   Addresses covered by configured routes are never learned, and a peer can't
+   have more than ROUTE_LEARN_LIMIT learned routes at a time. When an address
+   is seen at another peer, its learned route is moved to the new peer.
+*/
+void fastd_route_learn_source(fastd_peer_t *peer, const fastd_buffer_t buffer) {
+	sa_family_t af;
+	const uint8_t *addr;
+
+	if (!get_packet_address(buffer, true, &af, &addr) || !is_unicast(af, addr))
+		return;
+
+	unsigned bits = af_bits(af);
+	fastd_route_node_t *node = lookup_node(*table_root(af), addr, bits);
+
+	if (node && (node->peer == peer || !node->learned))
+		return;
+
+	if (peer->learned_routes >= ROUTE_LEARN_LIMIT) {
+		pr_debug2("not learning more routes for %P", peer);
+		return;
+	}
+
+	char buf[INET6_ADDRSTRLEN + 5];
+	format_prefix(buf, sizeof(buf), af, addr, bits);
+
+	if (node) {
+		pr_debug("route %s has moved from %P to %P", buf, node->peer, peer);
+		node->peer->learned_routes--;
+	}
+	else {
+		pr_debug("learned route %s for %P", buf, peer);
+
+		node = insert_node(table_root(af), addr, bits);
+		node->learned = true;
+
+		ctx.n_routes++;
+		ctx.n_learned_routes++;
+	}
+
+	node->peer = peer;
+	peer->learned_routes++;
+}
+
+/** Checks if two prefixes are equal */
+bool fastd_route_prefix_equal(const fastd_route_prefix_t *prefix1, const fastd_route_prefix_t *prefix2) {
+	return prefix1->af == prefix2->af && prefix1->len == prefix2->len
+		&& !memcmp(prefix1->addr, prefix2->addr, sizeof(prefix1->addr));
+}
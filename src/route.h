@@ -0,0 +1,84 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Routing of payload packets to peers in TUN mode with a shared interface
+
+   When all peers share a single TUN interface, the destination address of
+   each packet read from the interface is looked up in a longest-prefix-match
+   table built from the peers' configured routes (and optionally from the
+   source addresses of packets received from the peers), so unicast packets
+   are only sent to a single peer.
+*/
+
+#pragma once
+
+#include "fastd.h"
+
+
+/** An IPv4 or IPv6 prefix */
+struct fastd_route_prefix {
+	sa_family_t af;					/**< The address family (AF_INET or AF_INET6) */
+	uint8_t len;					/**< The prefix length */
+	uint8_t addr[16];				/**< The prefix address (only the first 4 bytes are used for IPv4) */
+};
+
+/**
+   A node of a route table
+
+   The route tables are path-compressed binary tries: each node stores its full
+   prefix, and only nodes that carry a route or have two children exist.
+*/
+struct fastd_route_node {
+	fastd_route_node_t *child[2];			/**< The subtrees for a 0 and a 1 bit after the node's prefix */
+	fastd_peer_t *peer;				/**< The peer the prefix is routed to (NULL for nodes without a route) */
+	bool learned;					/**< true if the route was learned from a received packet */
+	unsigned shadowed;				/**< The number of configured routes of other peers ignored because the prefix is already used */
+	uint8_t len;					/**< The prefix length */
+	uint8_t addr[16];				/**< The prefix address */
+};
+
+
+void fastd_route_add_peer(fastd_peer_t *peer);
+void fastd_route_remove_peer(fastd_peer_t *peer, bool learned_only);
+
+bool fastd_route_lookup(const fastd_buffer_t buffer, fastd_peer_t **peer);
+void fastd_route_learn_source(fastd_peer_t *peer, const fastd_buffer_t buffer);
+
+bool fastd_route_prefix_equal(const fastd_route_prefix_t *prefix1, const fastd_route_prefix_t *prefix2);
+
+
+/** Checks if packets are routed by the route tables (i.e. TUN mode with a shared interface is used) */
+static inline bool fastd_route_enabled(void) {
+	return conf.mode == MODE_TUN && conf.tun_shared;
+}
+
+/** Learns a route for the source address of a packet received from a peer, if enabled */
+static inline void fastd_route_learn(fastd_peer_t *peer, const fastd_buffer_t buffer) {
+	if (conf.route_learn && fastd_route_enabled())
+		fastd_route_learn_source(peer, buffer);
+}
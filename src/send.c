@@ -35,7 +35,11 @@
 
 
 #include "fastd.h"
+#include "batadv.h"
+#include "filter.h"
+#include "neighbor.h"
 #include "peer.h"
+#include "route.h"
 
 #include <sys/uio.h>
 
@@ -84,94 +88,201 @@ static inline void add_pktinfo(struct msghdr *msg, const fastd_peer_address_t *l
 	}
 }
 
-/** Sends a packet of a given type */
-static void send_type(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
-	if (!sock)
-		exit_bug("send: sock == NULL");
+/** A packet prepared for sending */
+typedef struct send_msg {
+	struct msghdr msg;			/**< The message header passed to sendmsg() */
+	struct iovec iov[2];			/**< The packet type and the packet data */
+	fastd_peer_address_t remote_addr;	/**< The (possibly widened) destination address */
+	uint8_t packet_type;			/**< The packet type */
+	uint8_t cbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))] __attribute__((aligned(8))); /**< Ancillary data */
+
+	fastd_peer_t *peer;			/**< The peer the packet is sent to (may be NULL) */
+	fastd_buffer_t buffer;			/**< The packet data */
+	size_t stat_size;			/**< The payload size to account in the statistics */
+} send_msg_t;
+
+#ifdef HAVE_SENDMMSG
+
+/** Packets queued for a sendmmsg() call */
+static struct {
+	bool active;				/**< true while packets are collected instead of being sent immediately */
+	const fastd_socket_t *sock;		/**< The socket all queued packets are sent on */
+	size_t n;				/**< The number of queued packets */
+	send_msg_t msgs[SEND_BATCH_SIZE];	/**< The queued packets */
+	struct mmsghdr mmsgs[SEND_BATCH_SIZE];	/**< The message headers passed to sendmmsg() */
+} send_batch;
+
+#endif
+
+
+/** Sets up the message header of a packet */
+static void prepare_msg(send_msg_t *m, const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
+	memset(&m->msg, 0, sizeof(m->msg));
 
-	struct msghdr msg = {};
-	uint8_t cbuf[1024] __attribute__((aligned(8))) = {};
-	fastd_peer_address_t remote_addr6;
+	m->remote_addr = *remote_addr;
+	m->packet_type = packet_type;
+	m->peer = peer;
+	m->buffer = buffer;
+	m->stat_size = stat_size;
 
-	switch (remote_addr->sa.sa_family) {
+	if (sock->bound_addr->sa.sa_family == AF_INET6)
+		fastd_peer_address_widen(&m->remote_addr);
+
+	switch (m->remote_addr.sa.sa_family) {
 	case AF_INET:
-		msg.msg_name = (void *)&remote_addr->in;
-		msg.msg_namelen = sizeof(struct sockaddr_in);
+		m->msg.msg_name = &m->remote_addr.in;
+		m->msg.msg_namelen = sizeof(struct sockaddr_in);
 		break;
 
 	case AF_INET6:
-		msg.msg_name = (void *)&remote_addr->in6;
-		msg.msg_namelen = sizeof(struct sockaddr_in6);
+		m->msg.msg_name = &m->remote_addr.in6;
+		m->msg.msg_namelen = sizeof(struct sockaddr_in6);
 		break;
 
 	default:
 		exit_bug("unsupported address family");
 	}
 
-	if (sock->bound_addr->sa.sa_family == AF_INET6) {
-		remote_addr6 = *remote_addr;
-		fastd_peer_address_widen(&remote_addr6);
-
-		msg.msg_name = (void *)&remote_addr6.in6;
-		msg.msg_namelen = sizeof(struct sockaddr_in6);
-	}
-
-	struct iovec iov[2] = {
-		{ .iov_base = &packet_type, .iov_len = 1 },
-		{ .iov_base = buffer.data, .iov_len = buffer.len }
-	};
+	m->iov[0] = (struct iovec){ .iov_base = &m->packet_type, .iov_len = 1 };
+	m->iov[1] = (struct iovec){ .iov_base = buffer.data, .iov_len = buffer.len };
 
-	msg.msg_iov = iov;
-	msg.msg_iovlen = buffer.len ? 2 : 1;
-	msg.msg_control = cbuf;
-	msg.msg_controllen = 0;
+	m->msg.msg_iov = m->iov;
+	m->msg.msg_iovlen = buffer.len ? 2 : 1;
+	m->msg.msg_control = m->cbuf;
+	m->msg.msg_controllen = 0;
 
-	add_pktinfo(&msg, local_addr);
+	memset(m->cbuf, 0, sizeof(m->cbuf));
+	add_pktinfo(&m->msg, local_addr);
 
-	if (!msg.msg_controllen)
-		msg.msg_control = NULL;
-
-	int ret = sendmsg(sock->fd.fd, &msg, 0);
-
-	if (ret < 0 && errno == EINVAL && msg.msg_controllen) {
-		pr_debug2("sendmsg failed, trying again without pktinfo");
-
-		if (peer && !fastd_peer_handshake_scheduled(peer))
-			fastd_peer_schedule_handshake_default(peer);
-
-		msg.msg_control = NULL;
-		msg.msg_controllen = 0;
-
-		ret = sendmsg(sock->fd.fd, &msg, 0);
-	}
+	if (!m->msg.msg_controllen)
+		m->msg.msg_control = NULL;
+}
 
-	if (ret < 0) {
+/** Updates the statistics after a packet has been sent (or sending has failed) and frees the packet data */
+static void finish_msg(send_msg_t *m, bool ok) {
+	if (!ok) {
 		switch (errno) {
 		case EAGAIN:
 #if EAGAIN != EWOULDBLOCK
 		case EWOULDBLOCK:
 #endif
 			pr_debug2_errno("sendmsg");
-			fastd_stats_add(peer, STAT_TX_DROPPED, stat_size);
+			fastd_stats_add(m->peer, STAT_TX_DROPPED, m->stat_size);
 			break;
 
 		case ENETDOWN:
 		case ENETUNREACH:
 		case EHOSTUNREACH:
 			pr_debug_errno("sendmsg");
-			fastd_stats_add(peer, STAT_TX_ERROR, stat_size);
+			fastd_stats_add(m->peer, STAT_TX_ERROR, m->stat_size);
 			break;
 
 		default:
 			pr_warn_errno("sendmsg");
-			fastd_stats_add(peer, STAT_TX_ERROR, stat_size);
+			fastd_stats_add(m->peer, STAT_TX_ERROR, m->stat_size);
 		}
 	}
 	else {
-		fastd_stats_add(peer, STAT_TX, stat_size);
+		fastd_stats_add(m->peer, STAT_TX, m->stat_size);
 	}
 
-	fastd_buffer_free(buffer);
+	fastd_buffer_free(m->buffer);
+}
+
+/** Sends a single prepared packet */
+static void send_msg(const fastd_socket_t *sock, send_msg_t *m) {
+	int ret = sendmsg(sock->fd.fd, &m->msg, 0);
+
+	if (ret < 0 && errno == EINVAL && m->msg.msg_controllen) {
+		pr_debug2("sendmsg failed, trying again without pktinfo");
+
+		if (m->peer && !fastd_peer_handshake_scheduled(m->peer))
+			fastd_peer_schedule_handshake_default(m->peer);
+
+		m->msg.msg_control = NULL;
+		m->msg.msg_controllen = 0;
+
+		ret = sendmsg(sock->fd.fd, &m->msg, 0);
+	}
+
+	finish_msg(m, ret >= 0);
+}
+
+#ifdef HAVE_SENDMMSG
+
+/**
+   Sends all queued packets
+
+   The packets are passed to the kernel with as few sendmmsg() calls as possible; when
+   sendmmsg() fails for a packet, this packet is retried using send_msg() for the usual
+   error handling before continuing with the rest of the batch.
+*/
+static void send_batch_flush(void) {
+	size_t i = 0;
+
+	while (i < send_batch.n) {
+		int ret = sendmmsg(send_batch.sock->fd.fd, &send_batch.mmsgs[i], send_batch.n - i, 0);
+
+		if (ret <= 0) {
+			send_msg(send_batch.sock, &send_batch.msgs[i]);
+			i++;
+			continue;
+		}
+
+		size_t end = i + ret;
+		for (; i < end; i++)
+			finish_msg(&send_batch.msgs[i], true);
+	}
+
+	send_batch.n = 0;
+	send_batch.sock = NULL;
+}
+
+/** Queues a packet for sending with the next sendmmsg() call */
+static void send_batch_add(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
+	if (send_batch.n == SEND_BATCH_SIZE || (send_batch.n && send_batch.sock != sock))
+		send_batch_flush();
+
+	send_msg_t *m = &send_batch.msgs[send_batch.n];
+	prepare_msg(m, sock, local_addr, remote_addr, peer, packet_type, buffer, stat_size);
+
+	send_batch.mmsgs[send_batch.n] = (struct mmsghdr){ .msg_hdr = m->msg };
+	send_batch.sock = sock;
+	send_batch.n++;
+}
+
+#endif
+
+/** Starts collecting packets to be sent together */
+static inline void send_batch_begin(void) {
+#ifdef HAVE_SENDMMSG
+	send_batch.active = true;
+#endif
+}
+
+/** Sends all collected packets and stops collecting packets */
+static inline void send_batch_end(void) {
+#ifdef HAVE_SENDMMSG
+	send_batch_flush();
+	send_batch.active = false;
+#endif
+}
+
+/** Sends a packet of a given type */
+static void send_type(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
+	if (!sock)
+		exit_bug("send: sock == NULL");
+
+#ifdef HAVE_SENDMMSG
+	if (send_batch.active) {
+		send_batch_add(sock, local_addr, remote_addr, peer, packet_type, buffer, stat_size);
+		return;
+	}
+#endif
+
+	send_msg_t m;
+	prepare_msg(&m, sock, local_addr, remote_addr, peer, packet_type, buffer, stat_size);
+	send_msg(sock, &m);
 }
 
 /** Sends a payload packet */
@@ -184,16 +295,25 @@ void fastd_send_handshake(const fastd_socket_t *sock, const fastd_peer_address_t
 	send_type(sock, local_addr, remote_addr, peer, PACKET_HANDSHAKE, buffer, 0);
 }
 
-/** Encrypts and sends a payload packet to all peers */
-static inline void send_all(fastd_buffer_t buffer, fastd_peer_t *source) {
-	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *dest = VECTOR_INDEX(ctx.peers, i);
-		if (dest == source || !fastd_peer_is_established(dest))
+/** Returns the current value of the monotonic clock in ns */
+static inline uint64_t fanout_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return 1000000000*(uint64_t)ts.tv_sec + ts.tv_nsec;
+}
+
+/** Encrypts and sends a payload packet to all peers by duplicating it for each peer */
+static inline void send_all_dup(fastd_buffer_t buffer, fastd_peer_t *source) {
+	fastd_peer_t *dest, *next;
+	for (dest = ctx.established_peers; dest; dest = next) {
+		next = dest->established_next;
+
+		if (dest == source)
 			continue;
 
 		/* optimization, primarily for TUN mode: don't duplicate the buffer for the last (or only) peer */
-		if (i == VECTOR_LEN(ctx.peers)-1) {
+		if (!next || (next == source && !next->established_next)) {
 			conf.protocol->send(dest, buffer);
 			return;
 		}
@@ -204,6 +324,43 @@ static inline void send_all(fastd_buffer_t buffer, fastd_peer_t *source) {
 	fastd_buffer_free(buffer);
 }
 
+/**
+   Encrypts and sends a payload packet to all peers
+
+   When the protocol supports it, all peers' packets are encrypted from the same
+   plaintext buffer, and the resulting packets are passed to the kernel in batches.
+*/
+static inline void send_all(fastd_buffer_t buffer, fastd_peer_t *source) {
+	if (!conf.protocol->send_shared) {
+		send_all_dup(buffer, source);
+		return;
+	}
+
+	uint64_t start = fanout_clock();
+	size_t sends = 0;
+
+	send_batch_begin();
+
+	fastd_peer_t *dest, *next;
+	for (dest = ctx.established_peers; dest; dest = next) {
+		next = dest->established_next;
+
+		if (dest == source)
+			continue;
+
+		if (conf.protocol->send_shared(dest, buffer))
+			sends++;
+	}
+
+	send_batch_end();
+
+	fastd_buffer_free(buffer);
+
+	ctx.fanout_packets++;
+	ctx.fanout_sends += sends;
+	ctx.fanout_time += fanout_clock() - start;
+}
+
 /** Handles sending of a payload packet to a single peer in TAP mode */
 static inline bool send_data_tap_single(fastd_buffer_t buffer, fastd_peer_t *source) {
 	if (conf.mode != MODE_TAP)
@@ -220,6 +377,8 @@ static inline bool send_data_tap_single(fastd_buffer_t buffer, fastd_peer_t *sou
 
 		if (fastd_eth_addr_is_unicast(src_addr))
 			fastd_peer_eth_addr_add(NULL, src_addr);
+
+		fastd_neighbor_snoop(buffer);
 	}
 
 	fastd_eth_addr_t dest_addr = fastd_buffer_dest_address(buffer);
@@ -253,6 +412,26 @@ static inline bool send_data_tap_single(fastd_buffer_t buffer, fastd_peer_t *sou
 	return true;
 }
 
+/** Handles sending of a payload packet to a single peer in TUN mode with a shared interface */
+static inline bool send_data_tun_routed(fastd_buffer_t buffer, fastd_peer_t *source) {
+	if (!fastd_route_enabled() || !ctx.n_routes)
+		return false;
+
+	fastd_peer_t *dest;
+	if (!fastd_route_lookup(buffer, &dest))
+		return false;
+
+	if (!dest || dest == source || !fastd_peer_is_established(dest)) {
+		pr_debug2("no route for packet");
+		ctx.route_unroutable++;
+		fastd_buffer_free(buffer);
+		return true;
+	}
+
+	conf.protocol->send(dest, buffer);
+	return true;
+}
+
 /** Sends a buffer of payload data to other peers */
 void fastd_send_data(fastd_buffer_t buffer, fastd_peer_t *source, fastd_peer_t *dest) {
 	if (dest) {
@@ -263,6 +442,21 @@ void fastd_send_data(fastd_buffer_t buffer, fastd_peer_t *source, fastd_peer_t *
 	if (send_data_tap_single(buffer, source))
 		return;
 
-	/* TUN mode or multicast packet */
+	if (send_data_tun_routed(buffer, source))
+		return;
+
+	/* Unrouted TUN packet or multicast packet */
+	if (fastd_batadv_bcast_duplicate(buffer)) {
+		pr_debug2("dropping duplicate BATMAN-adv broadcast");
+		fastd_stats_add(source, STAT_RX_BATADV_DUPLICATE, buffer.len);
+		fastd_buffer_free(buffer);
+		return;
+	}
+
+	if (fastd_neighbor_proxy(buffer, source) || !fastd_filter_flood(buffer)) {
+		fastd_buffer_free(buffer);
+		return;
+	}
+
 	send_all(buffer, source);
 }
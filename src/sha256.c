@@ -31,19 +31,150 @@
 
 
 #include "sha256.h"
+#include "sha256_impl.h"
 #include "crypto.h"
 
+#if defined(HAVE_SHA256_SHANI) || defined(HAVE_SHA256_AVX2)
+#include "cpuid.h"
+#endif
+
 #include <stdarg.h>
 #include <string.h>
 
 #include <arpa/inet.h>
 
 
+/** The SHA256 round constants */
+const uint32_t fastd_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/** The SHA256 initial hash value */
+static const uint32_t sha256_iv[FASTD_SHA256_HASH_WORDS] = {
+	0x6a09e667,
+	0xbb67ae85,
+	0x3c6ef372,
+	0xa54ff53a,
+	0x510e527f,
+	0x9b05688c,
+	0x1f83d9ab,
+	0x5be0cd19
+};
+
+/** The second half of the HMAC inner padding block */
+static const uint32_t ipad2[8] = {
+	0x36363636,
+	0x36363636,
+	0x36363636,
+	0x36363636,
+	0x36363636,
+	0x36363636,
+	0x36363636,
+	0x36363636,
+};
+
+/** The second half of the HMAC outer padding block */
+static const uint32_t opad2[8] = {
+	0x5c5c5c5c,
+	0x5c5c5c5c,
+	0x5c5c5c5c,
+	0x5c5c5c5c,
+	0x5c5c5c5c,
+	0x5c5c5c5c,
+	0x5c5c5c5c,
+	0x5c5c5c5c,
+};
+
+
 /** right-rotation of a 32bit value */
 static inline uint32_t rotr(uint32_t x, int r) {
 	return (x >> r) | (x << (32-r));
 }
 
+/** Portable SHA256 compression function */
+static void sha256_compress_generic(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t in[16]) {
+	uint32_t w[64], v[8];
+	size_t i;
+
+	memcpy(w, in, 16*sizeof(uint32_t));
+
+	for (i = 16; i < 64; i++) {
+		uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	memcpy(v, h, sizeof(v));
+
+	for (i = 0; i < 64; i++) {
+		uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+		uint32_t ch = (v[4] & v[5]) ^ ((~v[4]) & v[6]);
+		uint32_t temp1 = v[7] + s1 + ch + fastd_sha256_k[i] + w[i];
+		uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+		uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		uint32_t temp2 = s0 + maj;
+
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = v[3] + temp1;
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = temp1 + temp2;
+	}
+
+	for (i = 0; i < 8; i++)
+		h[i] += v[i];
+}
+
+
+/** The compression function used for single messages, selected by fastd_sha256_init() */
+static void (*sha256_compress)(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[16]) = sha256_compress_generic;
+
+#ifdef HAVE_SHA256_AVX2
+/** Set by fastd_sha256_init() if multiple messages should be hashed using the AVX2 multi-buffer implementation */
+static bool sha256_use_avx2 = false;
+#endif
+
+
+/**
+   Selects the fastest SHA256 implementation supported by the CPU
+
+   Must be called before any other threads are started.
+*/
+void fastd_sha256_init(void) {
+#if defined(HAVE_SHA256_SHANI) || defined(HAVE_SHA256_AVX2)
+	const uint64_t cpuid = fastd_cpuid(), cpuid_ext = fastd_cpuid_ext();
+#endif
+
+#ifdef HAVE_SHA256_SHANI
+	static const uint64_t REQ_SHANI = CPUID_SSE2|CPUID_SSSE3|CPUID_SSE41;
+
+	if ((cpuid & REQ_SHANI) == REQ_SHANI && (cpuid_ext & CPUID_EXT_SHA)) {
+		/* A single SHA-NI stream is faster than the multi-buffer code with the few lanes we use */
+		sha256_compress = fastd_sha256_compress_shani;
+		return;
+	}
+#endif
+
+#ifdef HAVE_SHA256_AVX2
+	static const uint64_t REQ_AVX = CPUID_OSXSAVE|CPUID_AVX;
+	static const uint64_t REQ_XCR0 = XCR0_SSE|XCR0_AVX;
+
+	if ((cpuid & REQ_AVX) == REQ_AVX && (cpuid_ext & CPUID_EXT_AVX2) && (fastd_xgetbv() & REQ_XCR0) == REQ_XCR0)
+		sha256_use_avx2 = true;
+#endif
+}
+
+
 /**
    Copies a (potentially incomplete) input block, while switching from big endian to CPU byte order
 
@@ -71,73 +202,104 @@ static inline void copy_words(uint32_t w[8], const uint32_t *in, ssize_t *left)
 	}
 }
 
+/**
+   Prepares the next 16 words to compress from a list of input blocks
+
+   Returns false if the whole message including the padding has already been consumed.
+*/
+static inline bool next_words(uint32_t w[16], const uint32_t *const **in, ssize_t *left, size_t len) {
+	if (*left < -8)
+		return false;
+
+	copy_words(w, (*left > 0) ? *((*in)++) : NULL, left);
+	copy_words(w+8, (*left > 0) ? *((*in)++) : NULL, left);
+
+	if (*left < -8)
+		w[15] = len << 3;
+
+	return true;
+}
+
 /** Hashes a list of input blocks */
 static void sha256_list(uint32_t out[FASTD_SHA256_HASH_WORDS], const uint32_t *const *in, size_t len) {
-	static const uint32_t k[64] = {
-		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-	};
-
-	uint32_t h[8] = {
-		0x6a09e667,
-		0xbb67ae85,
-		0x3c6ef372,
-		0xa54ff53a,
-		0x510e527f,
-		0x9b05688c,
-		0x1f83d9ab,
-		0x5be0cd19
-	};
+	uint32_t h[FASTD_SHA256_HASH_WORDS], w[16];
 	ssize_t left = len;
 	size_t i;
 
-	while (left >= -8) {
-		uint32_t w[64], v[8];
+	memcpy(h, sha256_iv, sizeof(h));
+
+	while (next_words(w, &in, &left, len))
+		sha256_compress(h, w);
+
+	for (i = 0; i < FASTD_SHA256_HASH_WORDS; i++)
+		out[i] = htonl(h[i]);
+}
+
+#ifdef HAVE_SHA256_AVX2
+
+/**
+   Hashes up to FASTD_SHA256_LANES lists of input blocks in parallel
 
-		copy_words(w, *(in++), &left);
-		copy_words(w+8, *(in++), &left);
+   Lanes that have already been completed are compressed along with the others,
+   but their result is ignored.
+*/
+static void sha256_list_avx2(fastd_sha256_t *out, const uint32_t *const *const *in, const size_t *len, size_t n) {
+	uint32_t h[FASTD_SHA256_LANES][FASTD_SHA256_HASH_WORDS], w[FASTD_SHA256_LANES][16] = {};
+	const uint32_t *const *pos[FASTD_SHA256_LANES];
+	ssize_t left[FASTD_SHA256_LANES];
+	bool pending[FASTD_SHA256_LANES];
+	size_t i, j, active = n;
+
+	for (i = 0; i < FASTD_SHA256_LANES; i++)
+		memcpy(h[i], sha256_iv, sizeof(h[i]));
+
+	for (i = 0; i < n; i++) {
+		pos[i] = in[i];
+		left[i] = len[i];
+		pending[i] = true;
+	}
 
-		if (left < -8)
-			w[15] = len << 3;
+	while (active) {
+		for (i = 0; i < n; i++)
+			next_words(w[i], &pos[i], &left[i], len[i]);
 
-		for (i = 16; i < 64; i++) {
-			uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
-			uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
-			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		fastd_sha256_compress_avx2(h, w);
+
+		for (i = 0; i < n; i++) {
+			if (!pending[i] || left[i] >= -8)
+				continue;
+
+			for (j = 0; j < FASTD_SHA256_HASH_WORDS; j++)
+				out[i].w[j] = htonl(h[i][j]);
+
+			pending[i] = false;
+			active--;
 		}
+	}
+}
+
+#endif
 
-		memcpy(v, h, sizeof(v));
-
-		for (i = 0; i < 64; i++) {
-			uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
-			uint32_t ch = (v[4] & v[5]) ^ ((~v[4]) & v[6]);
-			uint32_t temp1 = v[7] + s1 + ch + k[i] + w[i];
-			uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
-			uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
-			uint32_t temp2 = s0 + maj;
-
-			v[7] = v[6];
-			v[6] = v[5];
-			v[5] = v[4];
-			v[4] = v[3] + temp1;
-			v[3] = v[2];
-			v[2] = v[1];
-			v[1] = v[0];
-			v[0] = temp1 + temp2;
+/** Hashes multiple independent lists of input blocks */
+static void sha256_list_multi(fastd_sha256_t *out, const uint32_t *const *const *in, const size_t *len, size_t n) {
+	size_t i;
+
+#ifdef HAVE_SHA256_AVX2
+	if (sha256_use_avx2 && n > 1) {
+		for (i = 0; i < n; i += FASTD_SHA256_LANES) {
+			size_t lanes = n - i;
+			if (lanes > FASTD_SHA256_LANES)
+				lanes = FASTD_SHA256_LANES;
+
+			sha256_list_avx2(out+i, in+i, len+i, lanes);
 		}
 
-		for (i = 0; i < 8; i++)
-			h[i] += v[i];
+		return;
 	}
+#endif
 
-	for (i = 0; i < 8; i++)
-		out[i] = htonl(h[i]);
+	for (i = 0; i < n; i++)
+		sha256_list(out[i].w, in[i], len[i]);
 }
 
 /** Hashes a NULL-terminated va_list of complete input blocks */
@@ -182,27 +344,6 @@ void fastd_sha256(fastd_sha256_t *out, const uint32_t *in, size_t len) {
 
 /** Computes the HMAC-SHA256 of a list of (potentially incomplete) input blocks */
 static void hmacsha256_list(fastd_sha256_t *out, const uint32_t key[FASTD_HMACSHA256_KEY_WORDS], const uint32_t *const *in, size_t len) {
-	static const uint32_t ipad2[8] = {
-		0x36363636,
-		0x36363636,
-		0x36363636,
-		0x36363636,
-		0x36363636,
-		0x36363636,
-		0x36363636,
-		0x36363636,
-	};
-	static const uint32_t opad2[8] = {
-		0x5c5c5c5c,
-		0x5c5c5c5c,
-		0x5c5c5c5c,
-		0x5c5c5c5c,
-		0x5c5c5c5c,
-		0x5c5c5c5c,
-		0x5c5c5c5c,
-		0x5c5c5c5c,
-	};
-
 	size_t i, count = (len+FASTD_SHA256_BLOCK_BYTES-1) / FASTD_SHA256_BLOCK_BYTES;
 	const uint32_t *blocks[count+2];
 	uint32_t ipad[8], opad[8];
@@ -283,3 +424,86 @@ bool fastd_hmacsha256_verify(const uint8_t mac[FASTD_SHA256_HASH_BYTES], const u
 	fastd_hmacsha256(&out, key, in, len);
 	return secure_memequal(out.b, mac, FASTD_SHA256_HASH_BYTES);
 }
+
+/**
+   Computes multiple independent SHA256 hashes and HMAC-SHA256 values at once
+
+   Depending on the CPU, the inputs are processed in parallel using a multi-buffer
+   implementation.
+*/
+void fastd_sha256_multi(const fastd_sha256_multi_t *in, size_t n) {
+	size_t i, j, total = 0, hmacs = 0;
+
+	for (i = 0; i < n; i++) {
+		total += (in[i].len+FASTD_SHA256_BLOCK_BYTES-1) / FASTD_SHA256_BLOCK_BYTES;
+
+		if (in[i].key) {
+			total += 2;
+			hmacs++;
+		}
+	}
+
+	const uint32_t *blocks[total];
+	const uint32_t *const *lists[n];
+	size_t lens[n];
+	uint32_t ipad[n][8], opad[n][8];
+	fastd_sha256_t inner[n];
+
+	const uint32_t **block = blocks;
+
+	for (i = 0; i < n; i++) {
+		size_t count = (in[i].len+FASTD_SHA256_BLOCK_BYTES-1) / FASTD_SHA256_BLOCK_BYTES;
+
+		lists[i] = block;
+		lens[i] = in[i].len;
+
+		if (in[i].key) {
+			for (j = 0; j < 8; j++) {
+				ipad[i][j] = in[i].key[j] ^ 0x36363636;
+				opad[i][j] = in[i].key[j] ^ 0x5c5c5c5c;
+			}
+
+			*(block++) = ipad[i];
+			*(block++) = ipad2;
+			lens[i] += 2*FASTD_SHA256_BLOCK_BYTES;
+		}
+
+		for (j = 0; j < count; j++)
+			*(block++) = in[i].blocks[j];
+	}
+
+	sha256_list_multi(inner, lists, lens, n);
+
+	if (!hmacs) {
+		for (i = 0; i < n; i++)
+			*in[i].out = inner[i];
+
+		return;
+	}
+
+	const uint32_t *outer_blocks[hmacs][3];
+	const uint32_t *const *outer_lists[hmacs];
+	size_t outer_lens[hmacs];
+	fastd_sha256_t outer[hmacs];
+
+	for (i = 0, j = 0; i < n; i++) {
+		if (!in[i].key) {
+			*in[i].out = inner[i];
+			continue;
+		}
+
+		outer_blocks[j][0] = opad[i];
+		outer_blocks[j][1] = opad2;
+		outer_blocks[j][2] = inner[i].w;
+		outer_lists[j] = outer_blocks[j];
+		outer_lens[j] = 3*FASTD_SHA256_BLOCK_BYTES;
+		j++;
+	}
+
+	sha256_list_multi(outer, outer_lists, outer_lens, hmacs);
+
+	for (i = 0, j = 0; i < n; i++) {
+		if (in[i].key)
+			*in[i].out = outer[j++];
+	}
+}
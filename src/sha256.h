@@ -61,6 +61,16 @@ typedef union fastd_sha256 {
 	uint8_t b[FASTD_SHA256_HASH_BYTES];		/**< bytewise access */
 } fastd_sha256_t;
 
+/** A single input of fastd_sha256_multi() */
+typedef struct fastd_sha256_multi {
+	fastd_sha256_t *out;				/**< The output hash */
+	const uint32_t *key;				/**< The HMAC-SHA256 key, or NULL for a plain SHA256 hash */
+	const uint32_t *const *blocks;			/**< The (potentially incomplete) input blocks */
+	size_t len;					/**< The length of the input in bytes */
+} fastd_sha256_multi_t;
+
+
+void fastd_sha256_init(void);
 
 void fastd_sha256_blocks(fastd_sha256_t *out, ...);
 void fastd_sha256(fastd_sha256_t *out, const uint32_t *in, size_t len);
@@ -69,3 +79,5 @@ void fastd_hmacsha256_blocks(fastd_sha256_t *out, const uint32_t key[FASTD_HMACS
 bool fastd_hmacsha256_blocks_verify(const uint8_t mac[FASTD_SHA256_HASH_BYTES], const uint32_t key[FASTD_HMACSHA256_KEY_WORDS], ...);
 void fastd_hmacsha256(fastd_sha256_t *out, const uint32_t key[FASTD_HMACSHA256_KEY_WORDS], const uint32_t *in, size_t len);
 bool fastd_hmacsha256_verify(const uint8_t mac[FASTD_SHA256_HASH_BYTES], const uint32_t key[FASTD_HMACSHA256_KEY_WORDS], const uint32_t *in, size_t len);
+
+void fastd_sha256_multi(const fastd_sha256_multi_t *in, size_t n);
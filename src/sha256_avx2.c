@@ -0,0 +1,100 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Multi-buffer SHA256 compression function using AVX2
+
+   Eight independent messages are compressed at once, one in each 32bit lane
+   of the AVX2 registers.
+*/
+
+
+#include "sha256_impl.h"
+
+#include <immintrin.h>
+
+
+/** Right-rotation of all lanes */
+static inline __m256i rotr(__m256i x, int r) {
+	return _mm256_or_si256(_mm256_srli_epi32(x, r), _mm256_slli_epi32(x, 32-r));
+}
+
+/** Gathers word \e i of all lanes into a single register */
+static inline __m256i gather(const uint32_t (*v)[16], size_t i) {
+	return _mm256_set_epi32(v[7][i], v[6][i], v[5][i], v[4][i], v[3][i], v[2][i], v[1][i], v[0][i]);
+}
+
+
+/** Compresses one block of each of the eight lanes, given as 16 words in CPU byte order */
+void fastd_sha256_compress_avx2(uint32_t h[FASTD_SHA256_LANES][FASTD_SHA256_HASH_WORDS], const uint32_t w[FASTD_SHA256_LANES][16]) {
+	__m256i s[8], v[8], m[16];
+	size_t i;
+
+	for (i = 0; i < 8; i++) {
+		s[i] = _mm256_set_epi32(h[7][i], h[6][i], h[5][i], h[4][i], h[3][i], h[2][i], h[1][i], h[0][i]);
+		v[i] = s[i];
+	}
+
+	for (i = 0; i < 16; i++)
+		m[i] = gather(w, i);
+
+	for (i = 0; i < 64; i++) {
+		if (i >= 16) {
+			__m256i w15 = m[(i-15)&15], w2 = m[(i-2)&15];
+			__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr(w15, 7), rotr(w15, 18)), _mm256_srli_epi32(w15, 3));
+			__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr(w2, 17), rotr(w2, 19)), _mm256_srli_epi32(w2, 10));
+			m[i&15] = _mm256_add_epi32(_mm256_add_epi32(m[i&15], s0), _mm256_add_epi32(m[(i-7)&15], s1));
+		}
+
+		__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr(v[4], 6), rotr(v[4], 11)), rotr(v[4], 25));
+		__m256i ch = _mm256_xor_si256(_mm256_and_si256(v[4], v[5]), _mm256_andnot_si256(v[4], v[6]));
+		__m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(v[7], s1), _mm256_add_epi32(ch, m[i&15]));
+		temp1 = _mm256_add_epi32(temp1, _mm256_set1_epi32(fastd_sha256_k[i]));
+		__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr(v[0], 2), rotr(v[0], 13)), rotr(v[0], 22));
+		__m256i maj = _mm256_xor_si256(_mm256_and_si256(v[0], _mm256_xor_si256(v[1], v[2])), _mm256_and_si256(v[1], v[2]));
+		__m256i temp2 = _mm256_add_epi32(s0, maj);
+
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = _mm256_add_epi32(v[3], temp1);
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = _mm256_add_epi32(temp1, temp2);
+	}
+
+	for (i = 0; i < 8; i++) {
+		uint32_t out[FASTD_SHA256_LANES] __attribute__((aligned(32)));
+		size_t j;
+
+		_mm256_store_si256((__m256i *)out, _mm256_add_epi32(s[i], v[i]));
+
+		for (j = 0; j < FASTD_SHA256_LANES; j++)
+			h[j][i] = out[j];
+	}
+}
@@ -0,0 +1,52 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**
+   \file
+
+   Internal interface between the generic SHA256 code and the CPU-specific compression functions
+*/
+
+
+#pragma once
+
+#include "sha256.h"
+#include <generated/build.h>
+
+
+/** Number of messages compressed in parallel by the multi-buffer compression function */
+#define FASTD_SHA256_LANES 8
+
+
+/** The SHA256 round constants */
+extern const uint32_t fastd_sha256_k[64];
+
+
+#ifdef HAVE_SHA256_SHANI
+void fastd_sha256_compress_shani(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[16]);
+#endif
+
+#ifdef HAVE_SHA256_AVX2
+void fastd_sha256_compress_avx2(uint32_t h[FASTD_SHA256_LANES][FASTD_SHA256_HASH_WORDS], const uint32_t w[FASTD_SHA256_LANES][16]);
+#endif
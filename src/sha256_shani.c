@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   SHA256 compression function using the x86 SHA extensions
+*/
+
+
+#include "sha256_impl.h"
+
+#include <immintrin.h>
+
+
+/** Performs the four rounds of message group \e i, expanding the message schedule on the way */
+#define ROUNDS(i) do {							\
+		__m128i msg = _mm_add_epi32(m[(i)&3], _mm_loadu_si128((const __m128i *)&fastd_sha256_k[4*(i)])); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg);	\
+		if ((i) >= 3 && (i) < 15) {				\
+			__m128i tmp = _mm_alignr_epi8(m[(i)&3], m[((i)-1)&3], 4); \
+			m[((i)+1)&3] = _mm_add_epi32(m[((i)+1)&3], tmp); \
+			m[((i)+1)&3] = _mm_sha256msg2_epu32(m[((i)+1)&3], m[(i)&3]); \
+		}							\
+		msg = _mm_shuffle_epi32(msg, 0x0e);			\
+		state0 = _mm_sha256rnds2_epu32(state0, state1, msg);	\
+		if ((i) >= 1 && (i) < 13)				\
+			m[((i)-1)&3] = _mm_sha256msg1_epu32(m[((i)-1)&3], m[(i)&3]); \
+	} while (0)
+
+
+/** Compresses a single block given as 16 words in CPU byte order into the state \e h */
+void fastd_sha256_compress_shani(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[16]) {
+	/* The SHA instructions expect the state as ABEF and CDGH */
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xb1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1b);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	const __m128i abef = state0, cdgh = state1;
+
+	__m128i m[4] = {
+		_mm_loadu_si128((const __m128i *)&w[0]),
+		_mm_loadu_si128((const __m128i *)&w[4]),
+		_mm_loadu_si128((const __m128i *)&w[8]),
+		_mm_loadu_si128((const __m128i *)&w[12]),
+	};
+
+	ROUNDS(0);
+	ROUNDS(1);
+	ROUNDS(2);
+	ROUNDS(3);
+	ROUNDS(4);
+	ROUNDS(5);
+	ROUNDS(6);
+	ROUNDS(7);
+	ROUNDS(8);
+	ROUNDS(9);
+	ROUNDS(10);
+	ROUNDS(11);
+	ROUNDS(12);
+	ROUNDS(13);
+	ROUNDS(14);
+	ROUNDS(15);
+
+	state0 = _mm_add_epi32(state0, abef);
+	state1 = _mm_add_epi32(state1, cdgh);
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	_mm_storeu_si128((__m128i *)&h[0], _mm_blend_epi16(tmp, state1, 0xf0));
+	_mm_storeu_si128((__m128i *)&h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
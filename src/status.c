@@ -35,8 +35,11 @@
 
 #ifdef WITH_STATUS_SOCKET
 
+#include "filter.h"
 #include "method.h"
 #include "peer.h"
+#include "peer_group.h"
+#include "route.h"
 
 #include <json-c/json.h>
 #include <net/if.h>
@@ -99,6 +102,7 @@ static json_object * dump_stats(const fastd_stats_t *stats) {
 	json_object_object_add(statistics, "rx_reordered", dump_stat(stats, STAT_RX_REORDERED));
 	json_object_object_add(statistics, "rx_batadv_mcast", dump_stat(stats, STAT_RX_BATADV_MCAST));
 	json_object_object_add(statistics, "rx_batadv_ucast", dump_stat(stats, STAT_RX_BATADV_UCAST));
+	json_object_object_add(statistics, "rx_batadv_duplicate", dump_stat(stats, STAT_RX_BATADV_DUPLICATE));
 
 	json_object_object_add(statistics, "tx", dump_stat(stats, STAT_TX));
 	json_object_object_add(statistics, "tx_dropped", dump_stat(stats, STAT_TX_DROPPED));
@@ -110,6 +114,75 @@ static json_object * dump_stats(const fastd_stats_t *stats) {
 }
 
 
+/** Dumps the state of the handshake pacer as a JSON object */
+static json_object * dump_handshake_pacer(void) {
+	static const char *const priority_names[HANDSHAKE_PRIORITY_MAX] = {
+		[HANDSHAKE_PRIORITY_REFRESH] = "refresh",
+		[HANDSHAKE_PRIORITY_STATIC] = "static",
+		[HANDSHAKE_PRIORITY_DYNAMIC] = "dynamic",
+	};
+
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "limit", conf.handshake_limit ? json_object_new_int64(conf.handshake_limit) : NULL);
+	json_object_object_add(ret, "delayed", json_object_new_int64(ctx.handshake_pacer_delayed));
+	json_object_object_add(ret, "dropped", json_object_new_int64(ctx.handshake_pacer_dropped));
+
+	struct json_object *queued = json_object_new_object();
+	json_object_object_add(ret, "queued", queued);
+
+	size_t i;
+	for (i = 0; i < HANDSHAKE_PRIORITY_MAX; i++)
+		json_object_object_add(queued, priority_names[i], json_object_new_int64(ctx.handshake_pacer_queues[i].len));
+
+	return ret;
+}
+
+/** Dumps the filter rules and their counters as a JSON array */
+static json_object * dump_filters(void) {
+	static const char *const action_names[] = {
+		[FILTER_PASS] = "pass",
+		[FILTER_DROP] = "drop",
+		[FILTER_LIMIT] = "limit",
+	};
+
+	struct json_object *ret = json_object_new_array();
+
+	size_t i;
+	for (i = 0; i < ctx.n_filters; i++) {
+		const fastd_filter_t *filter = &ctx.filters[i];
+		struct json_object *rule = json_object_new_object();
+
+		json_object_object_add(rule, "action", json_object_new_string(action_names[filter->action]));
+		json_object_object_add(rule, "limit", filter->action == FILTER_LIMIT ? json_object_new_int64(filter->limit) : NULL);
+		json_object_object_add(rule, "hits", json_object_new_int64(filter->hits));
+		json_object_object_add(rule, "dropped", json_object_new_int64(filter->dropped));
+
+		json_object_array_add(ret, rule);
+	}
+
+	return ret;
+}
+
+/** Dumps a peer group and its subgroups as a JSON object */
+static json_object * dump_group(const fastd_peer_group_t *group) {
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "established", json_object_new_int64(group->n_established));
+	json_object_object_add(ret, "max_connections", group->max_connections >= 0 ? json_object_new_int64(group->max_connections) : NULL);
+
+	if (group->children) {
+		struct json_object *groups = json_object_new_object();
+		json_object_object_add(ret, "groups", groups);
+
+		const fastd_peer_group_t *child;
+		for (child = group->children; child; child = child->next)
+			json_object_object_add(groups, child->name, dump_group(child));
+	}
+
+	return ret;
+}
+
 /** Dumps a peer's status as a JSON object */
 static json_object * dump_peer(const fastd_peer_t *peer) {
 	struct json_object *ret = json_object_new_object();
@@ -121,7 +194,7 @@ static json_object * dump_peer(const fastd_peer_t *peer) {
 	json_object_object_add(ret, "name", peer->name ? json_object_new_string(peer->name) : NULL);
 	json_object_object_add(ret, "address", json_object_new_string(addr_buf));
 
-	if (!ctx.iface)
+	if (!ctx.iface && peer->iface)
 		json_object_object_add(ret, "interface", dump_iface(peer->iface));
 
 	struct json_object *connection = NULL;
@@ -139,6 +212,7 @@ static json_object * dump_peer(const fastd_peer_t *peer) {
 			method = json_object_new_string(method_info->name);
 
 		json_object_object_add(connection, "method", method);
+		json_object_object_add(connection, "keepalive_interval", json_object_new_int64(peer->keepalive_interval));
 
 		json_object_object_add(connection, "statistics", dump_stats(&peer->stats));
 
@@ -146,13 +220,8 @@ static json_object * dump_peer(const fastd_peer_t *peer) {
 			struct json_object *mac_addresses = json_object_new_array();
 			json_object_object_add(connection, "mac_addresses", mac_addresses);
 
-			size_t i;
-			for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
-				fastd_peer_eth_addr_t *addr = &VECTOR_INDEX(ctx.eth_addrs, i);
-
-				if (addr->peer != peer)
-					continue;
-
+			const fastd_peer_eth_addr_t *addr;
+			for (addr = fastd_peer_eth_addr_first(peer); addr; addr = fastd_peer_eth_addr_next(addr)) {
 				const uint8_t *d = addr->addr.data;
 
 				char eth_addr_buf[18];
@@ -181,13 +250,70 @@ static void dump_status(int fd) {
 
 	json_object_object_add(json, "statistics", dump_stats(&ctx.stats));
 
+	struct json_object *wakeups = json_object_new_object();
+	json_object_object_add(wakeups, "total", json_object_new_int64(ctx.wakeups));
+	json_object_object_add(wakeups, "per_second", json_object_new_double(ctx.wakeup_rate));
+	json_object_object_add(json, "wakeups", wakeups);
+
+	struct json_object *handshakes = json_object_new_object();
+	json_object_object_add(handshakes, "computed", json_object_new_int64(ctx.handshake_computations));
+	json_object_object_add(handshakes, "cpu_time", json_object_new_int64(ctx.handshake_cpu_time));
+	json_object_object_add(handshakes, "pacer", dump_handshake_pacer());
+	json_object_object_add(json, "handshakes", handshakes);
+
+	if (fastd_route_enabled()) {
+		struct json_object *routing = json_object_new_object();
+		json_object_object_add(routing, "routes", json_object_new_int64(ctx.n_routes));
+		json_object_object_add(routing, "learned", json_object_new_int64(ctx.n_learned_routes));
+		json_object_object_add(routing, "unroutable", json_object_new_int64(ctx.route_unroutable));
+		json_object_object_add(json, "routing", routing);
+	}
+
+	if (conf.mode == MODE_TAP)
+		json_object_object_add(json, "filters", dump_filters());
+
+	if (conf.neighbor_proxy) {
+		struct json_object *neighbor_proxy = json_object_new_object();
+		json_object_object_add(neighbor_proxy, "hits", json_object_new_int64(ctx.neighbor_hits));
+		json_object_object_add(neighbor_proxy, "misses", json_object_new_int64(ctx.neighbor_misses));
+		json_object_object_add(json, "neighbor_proxy", neighbor_proxy);
+	}
+
+	struct json_object *keepalives = json_object_new_object();
+	json_object_object_add(keepalives, "sent", json_object_new_int64(ctx.keepalives_sent));
+	json_object_object_add(keepalives, "suppressed", json_object_new_int64(ctx.keepalives_suppressed));
+	json_object_object_add(json, "keepalives", keepalives);
+
+	struct json_object *fanout = json_object_new_object();
+	json_object_object_add(fanout, "packets", json_object_new_int64(ctx.fanout_packets));
+	json_object_object_add(fanout, "sends", json_object_new_int64(ctx.fanout_sends));
+	json_object_object_add(fanout, "time", json_object_new_int64(ctx.fanout_time));
+	json_object_object_add(fanout, "time_per_packet", json_object_new_int64(ctx.fanout_packets ? ctx.fanout_time / ctx.fanout_packets : 0));
+	json_object_object_add(json, "fanout", fanout);
+
+	if (conf.mode == MODE_TAP && conf.forward) {
+		struct json_object *forward = json_object_new_object();
+		json_object_object_add(forward, "cut_through", json_object_new_int64(ctx.forward_cut_through));
+		json_object_object_add(json, "forward", forward);
+	}
+
+	size_t slab_bytes = VECTOR_LEN(ctx.peer_slabs) * PEER_SLAB_CHUNK * sizeof(fastd_peer_t);
+
+	struct json_object *memory = json_object_new_object();
+	json_object_object_add(memory, "peers", json_object_new_int64(ctx.n_peers));
+	json_object_object_add(memory, "established", json_object_new_int64(ctx.n_established));
+	json_object_object_add(memory, "peer_size", json_object_new_int64(sizeof(fastd_peer_t)));
+	json_object_object_add(memory, "slab_bytes", json_object_new_int64(slab_bytes));
+	json_object_object_add(memory, "bytes_per_peer", json_object_new_int64(ctx.n_peers ? slab_bytes / ctx.n_peers : 0));
+	json_object_object_add(json, "memory", memory);
+
+	json_object_object_add(json, "group", dump_group(conf.peer_group));
+
 	struct json_object *peers = json_object_new_object();
 	json_object_object_add(json, "peers", peers);
 
-	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
-
+	const fastd_peer_t *peer;
+	for (peer = ctx.peers; peer; peer = peer->next) {
 		if (!fastd_peer_is_enabled(peer))
 			continue;
 
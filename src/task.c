@@ -33,17 +33,42 @@
 #include "peer.h"
 
 
+/** Updates the main loop wakeup rate shown on the status socket */
+static void update_wakeup_rate(void) {
+	if (ctx.now > ctx.wakeup_rate_time)
+		ctx.wakeup_rate = (double)(ctx.wakeups - ctx.wakeup_rate_count) * 1000 / (ctx.now - ctx.wakeup_rate_time);
+
+	ctx.wakeup_rate_time = ctx.now;
+	ctx.wakeup_rate_count = ctx.wakeups;
+}
+
 /** Performs periodic maintenance tasks */
 static inline void maintenance(void) {
 	fastd_peer_eth_addr_cleanup();
+	update_wakeup_rate();
 	fastd_task_reschedule_relative(&ctx.next_maintenance, MAINTENANCE_INTERVAL);
 }
 
-/** Handles one task */
-static void handle_task(void) {
-	fastd_task_t *task = container_of(ctx.task_queue, fastd_task_t, entry);
-	fastd_pqueue_remove(ctx.task_queue);
+/**
+   Returns the time a task is actually run at
+
+   Of all times in the tolerance window [\e timeout, \e timeout + \e slack], the one with
+   the most trailing zero bits is chosen. Tasks with overlapping tolerance windows
+   thus tend to be moved to the same time and can be handled with a single wakeup.
+*/
+static inline fastd_timeout_t apply_slack(fastd_timeout_t timeout, int slack) {
+	if (slack <= 0 || timeout == FASTD_TIMEOUT_INV)
+		return timeout;
+
+	uint64_t limit = timeout + slack;
+	uint64_t mask = (uint64_t)timeout ^ limit;
+	mask = (UINT64_C(1) << (63 - __builtin_clzll(mask))) - 1;
+
+	return limit & ~mask;
+}
 
+/** Handles one task that has been removed from the task queue */
+static void handle_task(fastd_task_t *task) {
 	switch (task->type) {
 	case TASK_TYPE_MAINTENANCE:
 		maintenance();
@@ -53,20 +78,64 @@ static void handle_task(void) {
 		fastd_peer_handle_task(task);
 		break;
 
+	case TASK_TYPE_HANDSHAKE_PACER:
+		fastd_handshake_pacer_handle_task();
+		break;
+
 	default:
 		exit_bug("unknown task type");
 	}
 }
 
+#ifdef WITH_TASK_WHEEL
+
 /** Handles all tasks whose timeout has been reached */
 void fastd_task_handle(void) {
-	while (ctx.task_queue && fastd_timed_out(ctx.task_queue->value))
-		handle_task();
+	fastd_timer_wheel_advance(&ctx.task_queue, ctx.now);
+
+	fastd_timer_wheel_entry_t *entry;
+	while ((entry = fastd_timer_wheel_pop(&ctx.task_queue)))
+		handle_task(container_of(entry, fastd_task_t, entry));
 }
 
 /** Puts a task back into the queue with a new timeout */
 void fastd_task_reschedule(fastd_task_t *task, fastd_timeout_t timeout) {
-	task->entry.value = timeout;
+	task->timeout = timeout;
+	task->entry.value = apply_slack(timeout, task->slack);
+	fastd_timer_wheel_insert(&ctx.task_queue, &task->entry);
+}
+
+/** Removes a task from the queue */
+void fastd_task_unschedule(fastd_task_t *task) {
+	fastd_timer_wheel_remove(&ctx.task_queue, &task->entry);
+}
+
+/**
+   Gets the time the task queue needs to be handled next
+
+   This may be earlier than the next timeout, as the timer wheel must be advanced
+   to move tasks to lower levels.
+*/
+fastd_timeout_t fastd_task_queue_timeout(void) {
+	return fastd_timer_wheel_next(&ctx.task_queue);
+}
+
+#else
+
+/** Handles all tasks whose timeout has been reached */
+void fastd_task_handle(void) {
+	while (ctx.task_queue && fastd_timed_out(ctx.task_queue->value)) {
+		fastd_task_t *task = container_of(ctx.task_queue, fastd_task_t, entry);
+		fastd_pqueue_remove(ctx.task_queue);
+
+		handle_task(task);
+	}
+}
+
+/** Puts a task back into the queue with a new timeout */
+void fastd_task_reschedule(fastd_task_t *task, fastd_timeout_t timeout) {
+	task->timeout = timeout;
+	task->entry.value = apply_slack(timeout, task->slack);
 	fastd_pqueue_insert(&ctx.task_queue, &task->entry);
 }
 
@@ -77,3 +146,5 @@ fastd_timeout_t fastd_task_queue_timeout(void) {
 
 	return ctx.task_queue->value;
 }
+
+#endif
@@ -31,13 +31,25 @@
 
 #pragma once
 
+#include "types.h"
+
+#ifdef WITH_TASK_WHEEL
+#include "timer_wheel.h"
+#else
 #include "pqueue.h"
+#endif
 
 
 /** A scheduled task */
 struct fastd_task {
-	fastd_pqueue_t entry;	/**< Task queue entry */
-	fastd_task_type_t type;	/**< Type of the task */
+#ifdef WITH_TASK_WHEEL
+	fastd_timer_wheel_entry_t entry;	/**< Task queue entry */
+#else
+	fastd_pqueue_t entry;			/**< Task queue entry */
+#endif
+	fastd_timeout_t timeout;		/**< The time the task is due */
+	int slack;				/**< The time the task may be delayed by, so it can be handled together with other tasks */
+	fastd_task_type_t type;			/**< Type of the task */
 };
 
 
@@ -49,29 +61,46 @@ fastd_timeout_t fastd_task_queue_timeout(void);
 
 /** Checks if the given task is currently scheduled */
 static inline bool fastd_task_scheduled(fastd_task_t *task) {
+#ifdef WITH_TASK_WHEEL
+	return fastd_timer_wheel_linked(&task->entry);
+#else
 	return fastd_pqueue_linked(&task->entry);
+#endif
 }
 
-/** Gets the timeout of a task */
+/** Gets the timeout of a task (without the slack applied) */
 static inline fastd_timeout_t fastd_task_timeout(fastd_task_t *task) {
 	if (!fastd_task_scheduled(task))
 		return FASTD_TIMEOUT_INV;
 
-	return task->entry.value;
+	return task->timeout;
 }
 
+#ifdef WITH_TASK_WHEEL
+
+void fastd_task_unschedule(fastd_task_t *task);
+
+#else
+
 /** Removes a task from the queue */
 static inline void fastd_task_unschedule(fastd_task_t *task) {
 	fastd_pqueue_remove(&task->entry);
 }
 
+#endif
+
 /** Puts a task back into the queue with a new timeout relative to the old one */
 static inline void fastd_task_reschedule_relative(fastd_task_t *task, int64_t delay) {
-	fastd_task_reschedule(task, task->entry.value + delay);
+	fastd_task_reschedule(task, task->timeout + delay);
 }
 
-/** Schedules a task with given type and timeout */
-static inline void fastd_task_schedule(fastd_task_t *task, fastd_task_type_t type, fastd_timeout_t timeout) {
+/**
+   Schedules a task with given type and timeout
+
+   The task will be run after \e timeout, but no later than \e timeout + \e slack.
+*/
+static inline void fastd_task_schedule(fastd_task_t *task, fastd_task_type_t type, fastd_timeout_t timeout, int slack) {
 	task->type = type;
+	task->slack = slack;
 	fastd_task_reschedule(task, timeout);
 }
@@ -0,0 +1,230 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Hierarchical timer wheels
+
+   The slot selection and the advancing of the wheel follow the scheme used by
+   William Ahern's timeout.c: an element is put on the level given by the highest
+   set bit of the distance to its timeout, and when the wheel is advanced, all
+   slots that have been passed on any level are emptied and their elements are
+   reinserted, either on a lower level or into the list of expired elements.
+*/
+
+
+#include "timer_wheel.h"
+#include "log.h"
+
+
+/** The bitmask to get the slot number on a level */
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/** The maximum distance that can be represented by the wheel */
+#define MAX_DISTANCE ((UINT64_C(1) << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+/** The slot index used for elements in the list of expired elements */
+#define SLOT_EXPIRED (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+
+
+/** Rotates a 64bit value left */
+static inline uint64_t rotl(uint64_t v, unsigned c) {
+	c &= 63;
+	return c ? ((v << c) | (v >> (64 - c))) : v;
+}
+
+/** Rotates a 64bit value right */
+static inline uint64_t rotr(uint64_t v, unsigned c) {
+	c &= 63;
+	return c ? ((v >> c) | (v << (64 - c))) : v;
+}
+
+/** Links an element at the head of a list */
+static inline void link_entry(fastd_timer_wheel_entry_t **list, fastd_timer_wheel_entry_t *elem) {
+	elem->pprev = list;
+	elem->next = *list;
+	if (elem->next)
+		elem->next->pprev = &elem->next;
+
+	*list = elem;
+}
+
+/** Unlinks an element from its list */
+static inline void unlink_entry(fastd_timer_wheel_entry_t *elem) {
+	*elem->pprev = elem->next;
+	if (elem->next)
+		elem->next->pprev = elem->pprev;
+
+	elem->pprev = NULL;
+	elem->next = NULL;
+}
+
+
+/** Inserts a new element into a timer wheel */
+void fastd_timer_wheel_insert(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem) {
+	if (elem->pprev || elem->next)
+		exit_bug("fastd_timer_wheel_insert: tried to insert linked element");
+
+	if (elem->value <= wheel->time) {
+		elem->slot = SLOT_EXPIRED;
+		link_entry(&wheel->expired, elem);
+		return;
+	}
+
+	uint64_t distance = (uint64_t)elem->value - (uint64_t)wheel->time;
+	if (distance > MAX_DISTANCE)
+		distance = MAX_DISTANCE;
+
+	unsigned level = (63 - __builtin_clzll(distance)) / TIMER_WHEEL_BITS;
+
+	/* Elements on higher levels are put one slot earlier, so they are moved to a lower level before they time out */
+	unsigned slot = SLOT_MASK & (((uint64_t)elem->value >> (level * TIMER_WHEEL_BITS)) - !!level);
+
+	elem->slot = level * TIMER_WHEEL_SLOTS + slot;
+	link_entry(&wheel->slots[level][slot], elem);
+	wheel->pending[level] |= UINT64_C(1) << slot;
+}
+
+/** Removes an element from a timer wheel */
+void fastd_timer_wheel_remove(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem) {
+	if (!fastd_timer_wheel_linked(elem))
+		return;
+
+	unlink_entry(elem);
+
+	if (elem->slot == SLOT_EXPIRED)
+		return;
+
+	unsigned level = elem->slot / TIMER_WHEEL_SLOTS, slot = elem->slot % TIMER_WHEEL_SLOTS;
+	if (!wheel->slots[level][slot])
+		wheel->pending[level] &= ~(UINT64_C(1) << slot);
+}
+
+/**
+   Advances a timer wheel to the given time
+
+   All elements whose timeout has been reached are moved to the list of expired
+   elements, which can be emptied using fastd_timer_wheel_pop().
+*/
+void fastd_timer_wheel_advance(fastd_timer_wheel_t *wheel, int64_t time) {
+	if (time <= wheel->time)
+		return;
+
+	uint64_t old_time = wheel->time, new_time = time;
+	uint64_t elapsed = new_time - old_time;
+	fastd_timer_wheel_entry_t *todo = NULL;
+
+	unsigned level;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		unsigned shift = level * TIMER_WHEEL_BITS;
+		uint64_t passed;
+
+		if ((elapsed >> shift) > SLOT_MASK) {
+			passed = ~UINT64_C(0);
+		}
+		else {
+			unsigned n = SLOT_MASK & (elapsed >> shift);
+			unsigned old_slot = SLOT_MASK & (old_time >> shift);
+			unsigned new_slot = SLOT_MASK & (new_time >> shift);
+			uint64_t mask = (UINT64_C(1) << n) - 1;
+
+			passed = rotl(mask, old_slot) | rotr(rotl(mask, new_slot), n) | (UINT64_C(1) << new_slot);
+		}
+
+		uint64_t slots = passed & wheel->pending[level];
+		while (slots) {
+			unsigned slot = __builtin_ctzll(slots);
+			slots &= slots - 1;
+
+			fastd_timer_wheel_entry_t *elem;
+			while ((elem = wheel->slots[level][slot])) {
+				unlink_entry(elem);
+				link_entry(&todo, elem);
+			}
+		}
+		wheel->pending[level] &= ~passed;
+
+		/* The next level has only been advanced when slot 0 of this level has been passed */
+		if (!(passed & 1))
+			break;
+
+		if (elapsed < ((uint64_t)TIMER_WHEEL_SLOTS << shift))
+			elapsed = (uint64_t)TIMER_WHEEL_SLOTS << shift;
+	}
+
+	wheel->time = time;
+
+	while (todo) {
+		fastd_timer_wheel_entry_t *elem = todo;
+		unlink_entry(elem);
+		fastd_timer_wheel_insert(wheel, elem);
+	}
+}
+
+/** Removes and returns an expired element from a timer wheel, or returns NULL if there are none */
+fastd_timer_wheel_entry_t * fastd_timer_wheel_pop(fastd_timer_wheel_t *wheel) {
+	fastd_timer_wheel_entry_t *elem = wheel->expired;
+	if (elem)
+		unlink_entry(elem);
+
+	return elem;
+}
+
+/**
+   Returns the time at which the wheel must be advanced next, or FASTD_TIMEOUT_INV if it is empty
+
+   The returned time may lie before the earliest timeout of the elements in the
+   wheel when elements need to be moved to a lower level first.
+*/
+int64_t fastd_timer_wheel_next(const fastd_timer_wheel_t *wheel) {
+	if (wheel->expired)
+		return wheel->time;
+
+	uint64_t time = wheel->time, ret = UINT64_MAX, passed_mask = 0;
+
+	unsigned level;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		unsigned shift = level * TIMER_WHEEL_BITS;
+
+		if (wheel->pending[level]) {
+			unsigned slot = SLOT_MASK & (time >> shift);
+
+			/* Elements on higher levels are always at least one rotation of the lower levels away */
+			uint64_t distance = ((uint64_t)__builtin_ctzll(rotr(wheel->pending[level], slot)) + !!level) << shift;
+			distance -= passed_mask & time;
+
+			if (distance < ret)
+				ret = distance;
+		}
+
+		passed_mask = (passed_mask << TIMER_WHEEL_BITS) | SLOT_MASK;
+	}
+
+	if (ret == UINT64_MAX)
+		return FASTD_TIMEOUT_INV;
+
+	return wheel->time + ret;
+}
@@ -0,0 +1,82 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Hierarchical timer wheels
+*/
+
+#pragma once
+
+#include "types.h"
+
+
+/** log2 of the number of slots per level of a timer wheel */
+#define TIMER_WHEEL_BITS 6
+
+/** The number of slots per level of a timer wheel */
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+/** The number of levels of a timer wheel (6 levels of 64 slots cover about two years in milliseconds) */
+#define TIMER_WHEEL_LEVELS 6
+
+
+/** Element of a timer wheel */
+struct fastd_timer_wheel_entry {
+	fastd_timer_wheel_entry_t **pprev;	/**< \e next element of the previous element (or the slot list head); NULL if not linked */
+	fastd_timer_wheel_entry_t *next;	/**< Next element in the same slot */
+
+	int64_t value;				/**< The timeout */
+	unsigned slot;				/**< The index of the slot the element is linked in */
+};
+
+/**
+   A hierarchical timer wheel
+
+   Each level consists of TIMER_WHEEL_SLOTS slots; a slot on level \e n spans
+   TIMER_WHEEL_SLOTS^n time units. Elements are inserted on the level matching
+   the distance of their timeout and are moved to lower levels as the time
+   advances; elements whose timeout has been reached are collected in a separate
+   list. Insertion and removal are O(1).
+*/
+struct fastd_timer_wheel {
+	int64_t time;							/**< The time the wheel has been advanced to */
+	uint64_t pending[TIMER_WHEEL_LEVELS];				/**< Bitmaps of the non-empty slots of each level */
+	fastd_timer_wheel_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];	/**< The slot lists */
+	fastd_timer_wheel_entry_t *expired;				/**< Elements whose timeout has been reached */
+};
+
+
+/** Checks if an element is currently part of a timer wheel */
+static inline bool fastd_timer_wheel_linked(const fastd_timer_wheel_entry_t *elem) {
+	return elem->pprev;
+}
+
+void fastd_timer_wheel_insert(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem);
+void fastd_timer_wheel_remove(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem);
+void fastd_timer_wheel_advance(fastd_timer_wheel_t *wheel, int64_t time);
+fastd_timer_wheel_entry_t * fastd_timer_wheel_pop(fastd_timer_wheel_t *wheel);
+int64_t fastd_timer_wheel_next(const fastd_timer_wheel_t *wheel);
@@ -91,8 +91,17 @@ typedef enum fastd_task_type {
 	TASK_TYPE_UNSPEC = 0,	/**< Unspecified task type */
 	TASK_TYPE_MAINTENANCE,	/**< Scheduled maintenance */
 	TASK_TYPE_PEER,		/**< Peer maintenance (handshake, reset, keepalive) */
+	TASK_TYPE_HANDSHAKE_PACER, /**< Runs handshakes queued by the handshake pacer */
 } fastd_task_type_t;
 
+/** Handshake priorities of the handshake pacer (lower values are handled first) */
+typedef enum fastd_handshake_priority {
+	HANDSHAKE_PRIORITY_REFRESH = 0,	/**< Handshakes refreshing the keys of an established session */
+	HANDSHAKE_PRIORITY_STATIC,	/**< New connections with statically configured peers */
+	HANDSHAKE_PRIORITY_DYNAMIC,	/**< New connections with dynamic peers */
+	HANDSHAKE_PRIORITY_MAX,		/**< The number of handshake priorities */
+} fastd_handshake_priority_t;
+
 
 /** A timestamp used as a timeout */
 typedef int64_t fastd_timeout_t;
@@ -101,10 +110,15 @@ typedef int64_t fastd_timeout_t;
 #define FASTD_TIMEOUT_INV INT64_MAX
 
 
+typedef struct fastd_batadv_bcast fastd_batadv_bcast_t;
 typedef struct fastd_buffer fastd_buffer_t;
 typedef struct fastd_poll_fd fastd_poll_fd_t;
 typedef struct fastd_pqueue fastd_pqueue_t;
 typedef struct fastd_task fastd_task_t;
+typedef struct fastd_handshake_pacer_entry fastd_handshake_pacer_entry_t;
+typedef struct fastd_handshake_pacer_queue fastd_handshake_pacer_queue_t;
+typedef struct fastd_timer_wheel fastd_timer_wheel_t;
+typedef struct fastd_timer_wheel_entry fastd_timer_wheel_entry_t;
 
 typedef union fastd_peer_address fastd_peer_address_t;
 typedef struct fastd_bind_address fastd_bind_address_t;
@@ -113,11 +127,20 @@ typedef struct fastd_socket fastd_socket_t;
 typedef struct fastd_peer_group fastd_peer_group_t;
 typedef struct fastd_eth_addr fastd_eth_addr_t;
 typedef struct fastd_eth_header fastd_eth_header_t;
+typedef struct fastd_filter_rule fastd_filter_rule_t;
+typedef struct fastd_filter fastd_filter_t;
+typedef struct fastd_neighbor fastd_neighbor_t;
 typedef struct fastd_peer fastd_peer_t;
 typedef struct fastd_peer_eth_addr fastd_peer_eth_addr_t;
 typedef struct fastd_remote fastd_remote_t;
+typedef struct fastd_route_prefix fastd_route_prefix_t;
+typedef struct fastd_route_node fastd_route_node_t;
 typedef struct fastd_stats fastd_stats_t;
 typedef struct fastd_handshake_timeout fastd_handshake_timeout_t;
+typedef struct fastd_handshake_bucket fastd_handshake_bucket_t;
+typedef struct fastd_handshake_cookie fastd_handshake_cookie_t;
+typedef struct fastd_peer_hashtable fastd_peer_hashtable_t;
+typedef struct fastd_peer_hashtable_bucket fastd_peer_hashtable_bucket_t;
 
 typedef struct fastd_config fastd_config_t;
 typedef struct fastd_context fastd_context_t;
@@ -131,6 +154,7 @@ typedef struct fastd_cipher fastd_cipher_t;
 
 typedef struct fastd_mac_info fastd_mac_info_t;
 typedef struct fastd_mac fastd_mac_t;
+typedef struct fastd_mac_stream fastd_mac_stream_t;
 
 typedef struct fastd_handshake fastd_handshake_t;
 typedef struct fastd_handshake_buffer fastd_handshake_buffer_t;
@@ -139,6 +163,8 @@ typedef struct fastd_lex fastd_lex_t;
 typedef struct fastd_parser_state fastd_parser_state_t;
 typedef struct fastd_string_stack fastd_string_stack_t;
 
+typedef struct fastd_worker_job fastd_worker_job_t;
+
 typedef struct fastd_shell_command fastd_shell_command_t;
 typedef struct fastd_shell_env fastd_shell_env_t;
 
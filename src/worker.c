@@ -0,0 +1,146 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Worker threads for expensive computations (like the ECC operations of handshakes)
+*/
+
+
+#include "worker.h"
+#include "async.h"
+#include "fastd.h"
+
+
+/** Worker thread main function */
+static void * worker_thread(UNUSED void *arg) {
+	while (true) {
+		pthread_mutex_lock(&ctx.worker_mutex);
+
+		while (!ctx.worker_queue && !ctx.worker_stop)
+			pthread_cond_wait(&ctx.worker_cond, &ctx.worker_mutex);
+
+		if (ctx.worker_stop) {
+			pthread_mutex_unlock(&ctx.worker_mutex);
+			return NULL;
+		}
+
+		fastd_worker_job_t *job = ctx.worker_queue;
+		ctx.worker_queue = job->next;
+		if (!ctx.worker_queue)
+			ctx.worker_queue_tail = &ctx.worker_queue;
+
+		pthread_mutex_unlock(&ctx.worker_mutex);
+
+		job->next = NULL;
+		job->work(job);
+
+		fastd_async_enqueue(ASYNC_TYPE_WORKER_RETURN, &job, sizeof(job));
+	}
+}
+
+/** Starts the worker threads */
+void fastd_worker_init(void) {
+	ctx.worker_queue = NULL;
+	ctx.worker_queue_tail = &ctx.worker_queue;
+	ctx.worker_pending = 0;
+	ctx.worker_stop = false;
+
+	if ((errno = pthread_mutex_init(&ctx.worker_mutex, NULL)) != 0)
+		exit_errno("pthread_mutex_init");
+	if ((errno = pthread_cond_init(&ctx.worker_cond, NULL)) != 0)
+		exit_errno("pthread_cond_init");
+
+	size_t i;
+	for (i = 0; i < WORKER_THREADS; i++) {
+		if ((errno = pthread_create(&ctx.worker_threads[i], NULL, worker_thread, NULL)) != 0)
+			exit_errno("unable to create worker thread");
+	}
+}
+
+/**
+   Stops the worker threads
+
+   All jobs that haven't been started yet and all computed jobs that haven't been
+   handled yet are discarded through their free handlers.
+*/
+void fastd_worker_free(void) {
+	pthread_mutex_lock(&ctx.worker_mutex);
+	ctx.worker_stop = true;
+	pthread_cond_broadcast(&ctx.worker_cond);
+	pthread_mutex_unlock(&ctx.worker_mutex);
+
+	size_t i;
+	for (i = 0; i < WORKER_THREADS; i++)
+		pthread_join(ctx.worker_threads[i], NULL);
+
+	while (ctx.worker_queue) {
+		fastd_worker_job_t *job = ctx.worker_queue;
+		ctx.worker_queue = job->next;
+
+		ctx.worker_pending--;
+		job->free(job);
+	}
+
+	fastd_async_discard();
+
+	pthread_cond_destroy(&ctx.worker_cond);
+	pthread_mutex_destroy(&ctx.worker_mutex);
+}
+
+/**
+   Queues a job for the worker threads
+
+   \return false if WORKER_QUEUE_LIMIT jobs are already pending; the job is not queued in this case
+*/
+bool fastd_worker_submit(fastd_worker_job_t *job) {
+	if (ctx.worker_pending >= WORKER_QUEUE_LIMIT)
+		return false;
+
+	ctx.worker_pending++;
+
+	job->next = NULL;
+
+	pthread_mutex_lock(&ctx.worker_mutex);
+	*ctx.worker_queue_tail = job;
+	ctx.worker_queue_tail = &job->next;
+	pthread_cond_signal(&ctx.worker_cond);
+	pthread_mutex_unlock(&ctx.worker_mutex);
+
+	return true;
+}
+
+/** Handles a job that has been computed by a worker thread */
+void fastd_worker_handle_return(fastd_worker_job_t *job) {
+	ctx.worker_pending--;
+	job->done(job);
+}
+
+/** Frees a job that has been computed by a worker thread without handling its result */
+void fastd_worker_discard_return(fastd_worker_job_t *job) {
+	ctx.worker_pending--;
+	job->free(job);
+}
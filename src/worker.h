@@ -0,0 +1,62 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Worker threads for expensive computations (like the ECC operations of handshakes)
+
+   Jobs are computed by a fixed number of worker threads. Their results are handed back
+   to the main thread through the asynchronous notification mechanism, so all state
+   changes can happen on the main thread.
+*/
+
+
+#pragma once
+
+#include "types.h"
+
+
+/** A job that is computed by a worker thread */
+struct fastd_worker_job {
+	fastd_worker_job_t *next;			/**< The next job in the queue */
+
+	/** Performs the computation; is called on a worker thread, so it must not modify any global state */
+	void (*work)(fastd_worker_job_t *job);
+
+	/** Handles the result; is called on the main thread and must free the job */
+	void (*done)(fastd_worker_job_t *job);
+
+	/** Frees a job whose result is discarded on shutdown; is called on the main thread */
+	void (*free)(fastd_worker_job_t *job);
+};
+
+
+void fastd_worker_init(void);
+void fastd_worker_free(void);
+
+bool fastd_worker_submit(fastd_worker_job_t *job);
+void fastd_worker_handle_return(fastd_worker_job_t *job);
+void fastd_worker_discard_return(fastd_worker_job_t *job);